@@ -9,22 +9,39 @@
 #include <linux/blkdev.h> // For at least, struct block_device_operations
 #include <linux/hdreg.h> // For struct hd_geometry
 #include <linux/workqueue.h> // For workqueue related functionalities
+#include <linux/list.h>
+#include <linux/slab.h> // For kzalloc, ...
 #include <linux/errno.h>
-#include <asm/atomic.h> // For atomic_t, ...
 
 #include "ddk_block.h"
 #include "ddk_storage.h"
+#include "ddk_cache.h"
+#include "io_stats.h"
 
 #define DDK_FIRST_MINOR 0
 #define DDK_MINOR_CNT 16
 
+static int ddk_queue_depth = 4;
+module_param(ddk_queue_depth, int, 0444);
+MODULE_PARM_DESC(ddk_queue_depth, "Requests taken off the queue ahead of the one on the wire (default 4)");
+
+/* A request in flight, i.e. fetched & not yet completed */
+struct ddk_slot
+{
+	struct list_head list; /* In pending, or in free */
+	struct request *req;
+	u64 start; /* When it was fetched */
+};
+
 /* 
  * The internal structure representation of our Device
  */
 struct ddk_device
 {
-	/* USB Device of this interface */
-	struct usb_device *device;
+	/* USB Device of this interface, & its data path */
+	struct ddk_storage storage;
+	/* Write-back cache in front of it, if on */
+	struct ddk_cache cache;
 	u_int major;
 	/* Size is the size of the device (in sectors) */
 	unsigned int size;
@@ -34,10 +51,18 @@ struct ddk_device
 	struct request_queue *queue;
 	/* This is kernel's representation of an individual disk device */
 	struct gendisk *disk;
-	/* Data structures used in request processing work */
-	atomic_t under_process; /* Allows only one read / write at a time */
-	struct request *current_req;
+	/*
+	 * Data structures used in request processing work: the requests are
+	 * fetched into the pending slots (under lock), up to the queue depth, &
+	 * transferred in order, one at a time, by the work on its own workqueue
+	 */
+	struct list_head pending;
+	struct list_head free;
+	struct workqueue_struct *wq;
 	struct work_struct work;
+	/* Latency histograms, byte & op counts */
+	struct io_stats stats;
+	struct ddk_slot slots[];
 };
 
 static int ddk_open(struct block_device *bdev, fmode_t mode)
@@ -52,10 +77,9 @@ static int ddk_open(struct block_device *bdev, fmode_t mode)
 	return 0;
 }
 
-static int ddk_close(struct gendisk *disk, fmode_t mode)
+static void ddk_close(struct gendisk *disk, fmode_t mode)
 {
 	printk(KERN_INFO "ddkb: Device is closed\n");
-	return 0;
 }
 
 static void ddk_geo_fill(struct hd_geometry *geo)
@@ -126,15 +150,12 @@ static int ddk_getgeo(struct block_device *bdev, struct hd_geometry *geo)
 	return 0;
 }
 
-static void ddk_transfer(struct work_struct *w)
+static int ddk_transfer_req(struct ddk_device *ddk_dev, struct request *req)
 {
-	struct ddk_device *ddk_dev = container_of(w, struct ddk_device, work);
-	struct request *req = ddk_dev->current_req;
 	int dir = rq_data_dir(req);
-	sector_t start_sector = blk_rq_pos(req);
 	unsigned int sector_cnt = blk_rq_sectors(req);
 
-	struct bio_vec *bv;
+	struct bio_vec bv;
 	struct req_iterator iter;
 
 	sector_t sector_offset;
@@ -143,31 +164,37 @@ static void ddk_transfer(struct work_struct *w)
 
 	int ret = 0, ret2;
 
-	//printk(KERN_DEBUG "ddkb: Dir:%d; Sec:%lld; Cnt:%d\n", dir, start_sector, sector_cnt);
+	//printk(KERN_DEBUG "ddkb: Dir:%d; Sec:%lld; Cnt:%d\n", dir, blk_rq_pos(req), sector_cnt);
+
+	if (req_op(req) == REQ_OP_FLUSH)
+	{
+		return ddkc_flush(&ddk_dev->cache);
+	}
 
 	sector_offset = 0;
 	rq_for_each_segment(bv, req, iter)
 	{
-		buffer = page_address(bv->bv_page) + bv->bv_offset;
-		if (bv->bv_len % DDK_SECTOR_SIZE != 0)
+		buffer = page_address(bv.bv_page) + bv.bv_offset;
+		if (bv.bv_len % DDK_SECTOR_SIZE != 0)
 		{
 			printk(KERN_ERR "ddkb: Should never happen: "
 				"bio size (%d) is not a multiple of DDK_SECTOR_SIZE (%d).\n"
 				"This may lead to data truncation.\n",
-				bv->bv_len, DDK_SECTOR_SIZE);
+				bv.bv_len, DDK_SECTOR_SIZE);
 			ret = -EIO;
 		}
-		sectors = bv->bv_len / DDK_SECTOR_SIZE;
+		sectors = bv.bv_len / DDK_SECTOR_SIZE;
 		printk(KERN_DEBUG "ddkb: Sector Offset: %lld; Buffer: %p; Length: %d sectors\n",
 			sector_offset, buffer, sectors);
 
-		if (dir == WRITE) /* TODO: Write to the device */
+		/* Through the cache & the readahead, each passing through, if off */
+		if (dir == WRITE)
 		{
-			//ret2 = 
+			ret2 = ddkc_write(&ddk_dev->cache, blk_rq_pos(req) + sector_offset, buffer, sectors);
 		}
-		else /* TODO: Read from the device */
+		else
 		{
-			//ret2 = 
+			ret2 = ddkc_read(&ddk_dev->cache, blk_rq_pos(req) + sector_offset, buffer, sectors);
 		}
 
 		if (ret2 < 0)
@@ -181,24 +208,41 @@ static void ddk_transfer(struct work_struct *w)
 		printk(KERN_ERR "ddkb: bio info doesn't match with the request info");
 		ret = -EIO;
 	}
-
-	blk_end_request_all(req, ret); // Servicing the request done
-	atomic_set(&ddk_dev->under_process, 0);
+	if (!ret && (req->cmd_flags & REQ_FUA))
+	{
+		ret = ddkc_flush(&ddk_dev->cache);
+	}
+	return ret;
 }
 
-static int ddk_initiate_transfer(struct request *req)
+/*
+ * Transfers the pending requests, in order. Each one completed frees its
+ * slot & refetches, so that the next ones are already lined up while this
+ * one is on the wire, & the device doesn't idle between them
+ */
+static void ddk_transfer(struct work_struct *w)
 {
-	struct ddk_device *ddk_dev = (struct ddk_device *)(req->rq_disk->private_data);
+	struct ddk_device *ddk_dev = container_of(w, struct ddk_device, work);
+	struct ddk_slot *slot;
 	int ret;
 
-	atomic_set(&ddk_dev->under_process, 1);
-	ddk_dev->current_req = req;
-	if ((ret = schedule_work(&ddk_dev->work)) < 0)
+	spin_lock_irq(&ddk_dev->lock);
+	while (!list_empty(&ddk_dev->pending))
 	{
-		atomic_set(&ddk_dev->under_process, 0);
-		return ret;
+		/* Stays at the head, till done; ddk_request only adds at the tail */
+		slot = list_first_entry(&ddk_dev->pending, struct ddk_slot, list);
+		spin_unlock_irq(&ddk_dev->lock);
+
+		ret = ddk_transfer_req(ddk_dev, slot->req);
+		ios_account(&ddk_dev->stats, rq_data_dir(slot->req), blk_rq_bytes(slot->req), slot->start);
+
+		spin_lock_irq(&ddk_dev->lock);
+		__blk_end_request_all(slot->req, ret); // Servicing the request done
+		slot->req = NULL;
+		list_move_tail(&slot->list, &ddk_dev->free);
+		__blk_run_queue(ddk_dev->queue);
 	}
-	return 0;
+	spin_unlock_irq(&ddk_dev->lock);
 }
 
 /*
@@ -208,60 +252,30 @@ static int ddk_initiate_transfer(struct request *req)
  */
 static void ddk_request(struct request_queue *q)
 {
-	struct request *req = blk_peek_request(q);
-	struct ddk_device *ddk_dev;
-	int ret;
-
-	if (!req)
-		return;
-	else
-		ddk_dev = (struct ddk_device *)(req->rq_disk->private_data);
-
-	if (atomic_read(&ddk_dev->under_process)) // Already under process, come again later
-	{
-		return;
-	}
-	/*
-	 * The above 'test' & then 'set' in ddk_initiate_transfer need not be atomic,
-	 * as this func is non-reentrant bcoz of request queue's spin lock
-	 */
+	struct ddk_device *ddk_dev = (struct ddk_device *)(q->queuedata);
+	struct ddk_slot *slot;
+	struct request *req;
+	int fetched = 0;
 
-	/* Gets the current request from the dispatch queue */
-	while ((req = blk_fetch_request(q)) != NULL)
+	/* Gets the requests from the dispatch queue, while there are free slots; else, come again later */
+	while (!list_empty(&ddk_dev->free) && ((req = blk_fetch_request(q)) != NULL))
 	{
-#if 0
 		/*
-		 * This function tells us whether we are looking at a filesystem request
-		 * - one that moves block of data
+		 * The transfer is initiated here & returns asynchronously, as we
+		 * can't yield here, as request functions doesn't execute in any
+		 * process context - in fact they may get executed in interrupt context.
+		 * The completing of the request using *blk_end_request* will be done
+		 * once the request is actually processed
 		 */
-		if (!blk_fs_request(req))
-		{
-			printk(KERN_NOTICE "ddkb: Skip non-fs request\n");
-			/* We pass 0 to indicate that we successfully completed the request */
-			__blk_end_request_all(req, 0);
-			continue;
-		}
-#endif
-		/*
-		 * The following call initiates the transfer & returns asynchronously,
-		 * as we can't yield here, as request functions doesn't execute in any
-		 * process context - in fact they may get executed in interrupt context
-		 */
-		ret = ddk_initiate_transfer(req);
-		if (ret < 0) // Transfer not possible: Finish off this request & continue
-		{
-			__blk_end_request_all(req, ret);
-			//__blk_end_request(req, ret, blk_rq_bytes(req)); // Partial request served
-		}
-		else
-		/*
-		 * Request under processing - come again later. Also, the completing of
-		 * the request using *blk_end_request* will be done once the request is
-		 * actually processed
-		 */
-		{
-			return;
-		}
+		slot = list_first_entry(&ddk_dev->free, struct ddk_slot, list);
+		slot->req = req;
+		slot->start = ios_now();
+		list_move_tail(&slot->list, &ddk_dev->pending);
+		fetched = 1;
+	}
+	if (fetched)
+	{
+		queue_work(ddk_dev->wq, &ddk_dev->work);
 	}
 }
 
@@ -281,39 +295,68 @@ static struct block_device_operations ddk_fops =
  * This is the registration and initialization section of the ddk block device
  * driver
  */
-int block_register_dev(struct usb_interface *interface)
+int block_register_dev(struct usb_interface *interface, struct ddk_storage *st)
 {
 	struct ddk_device *ddk_dev;
-	int ret;
+	int depth = max(ddk_queue_depth, 1);
+	int i, ret;
 
-	if ((ddk_dev = (struct ddk_device *)(kzalloc(sizeof(struct ddk_device), GFP_KERNEL))) == NULL)
+	if ((ddk_dev = (struct ddk_device *)(kzalloc(sizeof(struct ddk_device) + depth * sizeof(struct ddk_slot), GFP_KERNEL))) == NULL)
 		return -ENOMEM;
-	/* TODO: Initialize with USB device */
-	ddk_dev->device = NULL;
+	ddk_dev->storage = *st;
 	/*
 	 * Set up the request processing work related data structures as the first
 	 * thing, as the request processing would get triggered internally by call
 	 * of some of the function(s) below, esp. add_disk
 	 */
-	atomic_set(&ddk_dev->under_process, 0);
-	ddk_dev->current_req = NULL;
+	INIT_LIST_HEAD(&ddk_dev->pending);
+	INIT_LIST_HEAD(&ddk_dev->free);
+	for (i = 0; i < depth; i++)
+	{
+		list_add_tail(&ddk_dev->slots[i].list, &ddk_dev->free);
+	}
 	INIT_WORK(&ddk_dev->work, ddk_transfer);
+	/* Its own, as the shared one may be held up behind others' work, & for the reclaim */
+	if ((ddk_dev->wq = alloc_ordered_workqueue("ddkb", WQ_MEM_RECLAIM)) == NULL)
+	{
+		kfree(ddk_dev);
+		return -ENOMEM;
+	}
+	if ((ret = ios_init(&ddk_dev->stats)) < 0)
+	{
+		destroy_workqueue(ddk_dev->wq);
+		kfree(ddk_dev);
+		return ret;
+	}
 
 	/* Set up our DDK Storage */
-	if ((ret = ddk_storage_init(ddk_dev->device)) < 0)
+	if ((ret = ddk_storage_init(&ddk_dev->storage)) < 0)
 	{
+		ios_cleanup(&ddk_dev->stats);
+		destroy_workqueue(ddk_dev->wq);
+		kfree(ddk_dev);
+		return ret;
+	}
+	/* Initialize with DDK memory size */
+	ddk_dev->size = ret;
+	if ((ret = ddkc_init(&ddk_dev->cache, &ddk_dev->storage, ddk_dev->wq)) < 0)
+	{
+		ddk_storage_cleanup(&ddk_dev->storage);
+		ios_cleanup(&ddk_dev->stats);
+		destroy_workqueue(ddk_dev->wq);
 		kfree(ddk_dev);
 		return ret;
 	}
-	/* TODO: Initialize with DDK memory size */
-	ddk_dev->size = 
 
 	/* Get Registered */
 	ddk_dev->major = register_blkdev(0, "ddk");
 	if (ddk_dev->major <= 0)
 	{
 		printk(KERN_ERR "ddkb: Unable to get Major Number\n");
-		ddk_storage_cleanup(ddk_dev->device);
+		ddkc_cleanup(&ddk_dev->cache);
+		ddk_storage_cleanup(&ddk_dev->storage);
+		ios_cleanup(&ddk_dev->stats);
+		destroy_workqueue(ddk_dev->wq);
 		kfree(ddk_dev);
 		return -EBUSY;
 	}
@@ -325,10 +368,19 @@ int block_register_dev(struct usb_interface *interface)
 	{
 		printk(KERN_ERR "ddkb: blk_init_queue failure\n");
 		unregister_blkdev(ddk_dev->major, "ddk");
-		ddk_storage_cleanup(ddk_dev->device);
+		ddkc_cleanup(&ddk_dev->cache);
+		ddk_storage_cleanup(&ddk_dev->storage);
+		ios_cleanup(&ddk_dev->stats);
+		destroy_workqueue(ddk_dev->wq);
 		kfree(ddk_dev);
 		return -ENOMEM;
 	}
+	ddk_dev->queue->queuedata = ddk_dev;
+	/* W/ the cache, flushes & FUA have to be passed on to it */
+	if (ddkc_on(&ddk_dev->cache))
+	{
+		blk_queue_write_cache(ddk_dev->queue, true, true);
+	}
 	
 	/*
 	 * Add the gendisk structure
@@ -342,21 +394,24 @@ int block_register_dev(struct usb_interface *interface)
 		printk(KERN_ERR "ddkb: alloc_disk failure\n");
 		blk_cleanup_queue(ddk_dev->queue);
 		unregister_blkdev(ddk_dev->major, "ddk");
-		ddk_storage_cleanup(ddk_dev->device);
+		ddkc_cleanup(&ddk_dev->cache);
+		ddk_storage_cleanup(&ddk_dev->storage);
+		ios_cleanup(&ddk_dev->stats);
+		destroy_workqueue(ddk_dev->wq);
 		kfree(ddk_dev);
 		return -ENOMEM;
 	}
 
- 	/* TODO: Setting the major number */
-	ddk_dev->disk->major = 0;
+ 	/* Setting the major number */
+	ddk_dev->disk->major = ddk_dev->major;
   	/* Setting the first minor number */
 	ddk_dev->disk->first_minor = DDK_FIRST_MINOR;
  	/* Setting the block device operations */
 	ddk_dev->disk->fops = &ddk_fops;
  	/* Driver-specific own internal data */
 	ddk_dev->disk->private_data = &ddk_dev;
- 	/* TODO: Setting up the request queue */
-	ddk_dev->disk->queue = NULL;
+ 	/* Setting up the request queue */
+	ddk_dev->disk->queue = ddk_dev->queue;
 	/*
 	 * You do not want partition information to show up in 
 	 * cat /proc/partitions set this flags
@@ -375,6 +430,7 @@ int block_register_dev(struct usb_interface *interface)
 	ddk_dev->disk->private_data = ddk_dev;
 	/* Adding the disk to the system. Now the disk is "live" */
 	add_disk(ddk_dev->disk);
+	ios_register(&ddk_dev->stats, ddk_dev->disk, KBUILD_MODNAME);
 	printk(KERN_INFO "ddkb: DDK Block driver initialised (%d sectors; %d bytes)\n",
 		ddk_dev->size, ddk_dev->size * DDK_SECTOR_SIZE);
 	usb_set_intfdata(interface, ddk_dev);
@@ -389,11 +445,16 @@ void block_deregister_dev(struct usb_interface *interface)
 {
 	struct ddk_device *ddk_dev = (struct ddk_device *)(usb_get_intfdata(interface));
 
-	cancel_work_sync(&ddk_dev->work); // In case, any work is already scheduled
+	ios_unregister(&ddk_dev->stats);
 	del_gendisk(ddk_dev->disk);
 	put_disk(ddk_dev->disk);
+	/* Drains the requests in flight, through the work; so only then, it goes */
 	blk_cleanup_queue(ddk_dev->queue);
+	/* Writes back what is left, before the workqueue goes */
+	ddkc_cleanup(&ddk_dev->cache);
+	destroy_workqueue(ddk_dev->wq);
 	unregister_blkdev(ddk_dev->major, "ddk");
-	ddk_storage_cleanup(ddk_dev->device);
+	ddk_storage_cleanup(&ddk_dev->storage);
+	ios_cleanup(&ddk_dev->stats);
 	kfree(ddk_dev);
 }
@@ -4,7 +4,9 @@
 #ifdef __KERNEL__
 #include <linux/usb.h>
 
-int block_register_dev(struct usb_interface *interface);
+#include "ddk_storage.h"
+
+int block_register_dev(struct usb_interface *interface, struct ddk_storage *st);
 void block_deregister_dev(struct usb_interface *interface);
 #endif
 
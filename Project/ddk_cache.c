@@ -0,0 +1,330 @@
+/*
+ * Write-back cache of the DDK block driver: writes are absorbed in memory,
+ * overlapping ones overwriting in place, & the dirty sectors written out in
+ * coalesced runs, after a while, on a flush or FUA request, when the cache
+ * is full, or under memory pressure. Reads are served from it, where it has
+ * all their sectors; else, from the device, w/ its sectors laid over. And,
+ * the readahead of sequential reads, w/ a window growing along the stream
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/bitops.h>
+#include <linux/jiffies.h>
+
+#include "ddk_cache.h"
+
+#define DDKC_UNIT_SECTORS_SHIFT 3
+#define DDKC_UNIT_SECTORS (1 << DDKC_UNIT_SECTORS_SHIFT)
+#define DDKC_UNIT_SIZE (DDKC_UNIT_SECTORS * DDK_SECTOR_SIZE)
+#define DDKC_RUN_SECTORS 64 /* At most written at a time, while flushing */
+#define DDKC_BATCH 16 /* Units looked up at a time */
+#define DDKC_RA_MIN 8 /* Sectors, of the first readahead window */
+
+static unsigned int ddk_wb_size = 0;
+module_param(ddk_wb_size, uint, 0444);
+MODULE_PARM_DESC(ddk_wb_size, "Write-back cache per device, in KiB; 0 for none (default 0)");
+static unsigned int ddk_wb_interval = 1000;
+module_param(ddk_wb_interval, uint, 0644);
+MODULE_PARM_DESC(ddk_wb_interval, "Delay (in ms) of writing back the cached writes (default 1000)");
+static unsigned int ddk_ra_size = 32;
+module_param(ddk_ra_size, uint, 0444);
+MODULE_PARM_DESC(ddk_ra_size, "Max readahead of sequential reads, w/ the read, in KiB; 0 for none (default 32)");
+
+struct ddkc_unit
+{
+	unsigned long index;
+	unsigned long dirty; /* Its sectors in the cache */
+	u8 *data;
+};
+
+static void ddkc_free_units(struct ddk_cache *c)
+{
+	struct ddkc_unit *units[DDKC_BATCH];
+	unsigned long idx = 0;
+	int i, cnt;
+
+	while ((cnt = radix_tree_gang_lookup(&c->units, (void **)units, idx, DDKC_BATCH)) > 0)
+	{
+		for (i = 0; i < cnt; i++)
+		{
+			idx = units[i]->index;
+			radix_tree_delete(&c->units, idx);
+			kfree(units[i]->data);
+			kfree(units[i]);
+		}
+		idx++;
+	}
+	atomic_set(&c->unit_cnt, 0);
+}
+
+static int ddkc_write_run(struct ddk_cache *c, sector_t sector_off, unsigned int sectors)
+{
+	int ret;
+
+	if ((ret = ddk_storage_write(c->st, sector_off, c->run_buf, sectors)) < 0)
+		return ret;
+	return (ret < (int)(sectors * DDK_SECTOR_SIZE)) ? -EIO : 0;
+}
+/*
+ * Writes out the dirty sectors, as runs of consecutive ones, & then drops
+ * them all. On a failure, keeps them all, to be retried. Also, drops the
+ * readahead window, as that may have been read from under them
+ */
+int ddkc_flush(struct ddk_cache *c)
+{
+	struct ddkc_unit *units[DDKC_BATCH];
+	unsigned long idx = 0;
+	sector_t sector, run_start = 0;
+	unsigned int run = 0;
+	int i, s, cnt;
+	int ret;
+
+	if (!ddkc_on(c))
+		return 0;
+	c->ra_len = 0;
+	while ((cnt = radix_tree_gang_lookup(&c->units, (void **)units, idx, DDKC_BATCH)) > 0)
+	{
+		for (i = 0; i < cnt; i++)
+		{
+			for (s = 0; s < DDKC_UNIT_SECTORS; s++)
+			{
+				if (!test_bit(s, &units[i]->dirty))
+					continue;
+				sector = ((sector_t)(units[i]->index) << DDKC_UNIT_SECTORS_SHIFT) + s;
+				/* Write out the run, if this sector doesn't extend it, or it is full */
+				if (run && ((sector != run_start + run) || (run == DDKC_RUN_SECTORS)))
+				{
+					if ((ret = ddkc_write_run(c, run_start, run)) < 0)
+						goto failed;
+					run = 0;
+				}
+				if (!run)
+					run_start = sector;
+				memcpy(c->run_buf + run * DDK_SECTOR_SIZE, units[i]->data + s * DDK_SECTOR_SIZE, DDK_SECTOR_SIZE);
+				run++;
+			}
+		}
+		idx = units[cnt - 1]->index + 1;
+	}
+	if (run && ((ret = ddkc_write_run(c, run_start, run)) < 0))
+		goto failed;
+	ddkc_free_units(c);
+	return 0;
+
+failed:
+	printk(KERN_ERR "ddkb: Write back of the cache failed (%d)\n", ret);
+	return ret;
+}
+static void ddkc_flush_work(struct work_struct *work)
+{
+	struct ddk_cache *c = container_of(to_delayed_work(work), struct ddk_cache, flush_work);
+
+	if (ddkc_flush(c) < 0)
+		queue_delayed_work(c->wq, &c->flush_work, msecs_to_jiffies(ddk_wb_interval));
+}
+
+/* The unit of idx; a new one, if none & alloc is set, w/ the cache flushed first, if full */
+static struct ddkc_unit *ddkc_get_unit(struct ddk_cache *c, unsigned long idx, int alloc, int *ret)
+{
+	struct ddkc_unit *u;
+
+	*ret = 0;
+	if ((u = radix_tree_lookup(&c->units, idx)) || !alloc)
+		return u;
+	if ((atomic_read(&c->unit_cnt) >= c->max_units) && ((*ret = ddkc_flush(c)) < 0))
+		return NULL;
+	if ((u = kmalloc(sizeof(struct ddkc_unit), GFP_NOIO)) == NULL)
+		goto nomem;
+	if ((u->data = kmalloc(DDKC_UNIT_SIZE, GFP_NOIO)) == NULL)
+		goto free_unit;
+	u->index = idx;
+	u->dirty = 0;
+	if (radix_tree_insert(&c->units, idx, u) < 0)
+		goto free_data;
+	atomic_inc(&c->unit_cnt);
+	return u;
+
+free_data:
+	kfree(u->data);
+free_unit:
+	kfree(u);
+nomem:
+	*ret = -ENOMEM;
+	return NULL;
+}
+
+/*
+ * Reads through the readahead window: served from it, if in it; else, for a
+ * sequential read, read along w/ the window beyond it, in one transfer, the
+ * window doubling each time, up to ra_max; or else, read as is, w/ the
+ * window collapsed
+ */
+static int ddkc_ra_read(struct ddk_cache *c, sector_t sector_off, u8 *buffer, unsigned int sectors)
+{
+	unsigned int total;
+	int ret;
+
+	if ((sector_off >= c->ra_start) && (sector_off + sectors <= c->ra_start + c->ra_len))
+	{
+		memcpy(buffer, c->ra_buf + (sector_off - c->ra_start) * DDK_SECTOR_SIZE, sectors * DDK_SECTOR_SIZE);
+		c->ra_next = sector_off + sectors;
+		return sectors * DDK_SECTOR_SIZE;
+	}
+	if (sector_off != c->ra_next)
+	{
+		c->ra_window = 0;
+	}
+	else
+	{
+		c->ra_window = c->ra_window ? (c->ra_window * 2) : max_t(unsigned int, sectors, DDKC_RA_MIN);
+		c->ra_window = min(c->ra_window, c->ra_max);
+	}
+	c->ra_next = sector_off + sectors;
+	total = min(sectors + c->ra_window, c->ra_max);
+	total = min_t(sector_t, total, c->st->size - min_t(sector_t, sector_off, c->st->size));
+	if (!c->ra_window || (total <= sectors))
+		return ddk_storage_read(c->st, sector_off, buffer, sectors);
+
+	c->ra_len = 0;
+	if ((ret = ddk_storage_read(c->st, sector_off, c->ra_buf, total)) < 0)
+		return ret;
+	c->ra_start = sector_off;
+	c->ra_len = ret / DDK_SECTOR_SIZE;
+	ret = min(ret, (int)(sectors * DDK_SECTOR_SIZE));
+	memcpy(buffer, c->ra_buf, ret);
+	return ret;
+}
+/* Drops the readahead window, if it has any of the sectors */
+static void ddkc_ra_drop(struct ddk_cache *c, sector_t sector_off, unsigned int sectors)
+{
+	if ((sector_off < c->ra_start + c->ra_len) && (c->ra_start < sector_off + sectors))
+		c->ra_len = 0;
+}
+
+int ddkc_write(struct ddk_cache *c, sector_t sector_off, u8 *buffer, unsigned int sectors)
+{
+	struct ddkc_unit *u;
+	unsigned int i, s;
+	int ret;
+
+	if (c->ra_max)
+		ddkc_ra_drop(c, sector_off, sectors);
+	if (!ddkc_on(c))
+		return ddk_storage_write(c->st, sector_off, buffer, sectors);
+	for (i = 0; i < sectors; i++)
+	{
+		if ((u = ddkc_get_unit(c, (sector_off + i) >> DDKC_UNIT_SECTORS_SHIFT, 1, &ret)) == NULL)
+			return ret;
+		s = (sector_off + i) & (DDKC_UNIT_SECTORS - 1);
+		memcpy(u->data + s * DDK_SECTOR_SIZE, buffer + i * DDK_SECTOR_SIZE, DDK_SECTOR_SIZE);
+		__set_bit(s, &u->dirty);
+	}
+	/* Starts the timer, unless already on */
+	queue_delayed_work(c->wq, &c->flush_work, msecs_to_jiffies(ddk_wb_interval));
+	return sectors * DDK_SECTOR_SIZE;
+}
+int ddkc_read(struct ddk_cache *c, sector_t sector_off, u8 *buffer, unsigned int sectors)
+{
+	struct ddkc_unit *u;
+	unsigned int i, s, cached = 0;
+	int ret;
+
+	for (i = 0; ddkc_on(c) && (i < sectors); i++)
+	{
+		u = ddkc_get_unit(c, (sector_off + i) >> DDKC_UNIT_SECTORS_SHIFT, 0, &ret);
+		s = (sector_off + i) & (DDKC_UNIT_SECTORS - 1);
+		if (u && test_bit(s, &u->dirty))
+			cached++;
+	}
+	if (cached < sectors)
+	{
+		if (c->ra_max)
+			ret = ddkc_ra_read(c, sector_off, buffer, sectors);
+		else
+			ret = ddk_storage_read(c->st, sector_off, buffer, sectors);
+		if ((ret < 0) || !cached)
+			return ret;
+	}
+	/* Lay the cached sectors over, being the latest */
+	for (i = 0; i < sectors; i++)
+	{
+		u = ddkc_get_unit(c, (sector_off + i) >> DDKC_UNIT_SECTORS_SHIFT, 0, &ret);
+		s = (sector_off + i) & (DDKC_UNIT_SECTORS - 1);
+		if (u && test_bit(s, &u->dirty))
+			memcpy(buffer + i * DDK_SECTOR_SIZE, u->data + s * DDK_SECTOR_SIZE, DDK_SECTOR_SIZE);
+	}
+	return sectors * DDK_SECTOR_SIZE;
+}
+
+static unsigned long ddkc_shrink_count(struct shrinker *s, struct shrink_control *sc)
+{
+	return atomic_read(&container_of(s, struct ddk_cache, shrinker)->unit_cnt);
+}
+/* The device can't be written to from reclaim; so just get the flush work on it, right away */
+static unsigned long ddkc_shrink_scan(struct shrinker *s, struct shrink_control *sc)
+{
+	struct ddk_cache *c = container_of(s, struct ddk_cache, shrinker);
+
+	mod_delayed_work(c->wq, &c->flush_work, 0);
+	return SHRINK_STOP;
+}
+
+int ddkc_init(struct ddk_cache *c, struct ddk_storage *st, struct workqueue_struct *wq)
+{
+	memset(c, 0, sizeof(struct ddk_cache));
+	c->st = st;
+	c->wq = wq;
+	c->max_units = DIV_ROUND_UP(ddk_wb_size * 1024, DDKC_UNIT_SIZE);
+	INIT_RADIX_TREE(&c->units, GFP_NOIO);
+	atomic_set(&c->unit_cnt, 0);
+	INIT_DELAYED_WORK(&c->flush_work, ddkc_flush_work);
+	c->ra_max = ddk_ra_size * 1024 / DDK_SECTOR_SIZE;
+	c->ra_next = (sector_t)-1;
+	if (c->ra_max && ((c->ra_buf = kmalloc(c->ra_max * DDK_SECTOR_SIZE, GFP_KERNEL)) == NULL))
+	{
+		printk(KERN_WARNING "ddkb: No readahead, w/o memory for it\n");
+		c->ra_max = 0;
+	}
+	if (!ddkc_on(c))
+		return 0;
+	if ((c->run_buf = kmalloc(DDKC_RUN_SECTORS * DDK_SECTOR_SIZE, GFP_KERNEL)) == NULL)
+	{
+		kfree(c->ra_buf);
+		c->ra_buf = NULL;
+		return -ENOMEM;
+	}
+
+	c->shrinker.count_objects = ddkc_shrink_count;
+	c->shrinker.scan_objects = ddkc_shrink_scan;
+	c->shrinker.seeks = DEFAULT_SEEKS;
+	if (register_shrinker(&c->shrinker) < 0) // Just the size limit then
+		printk(KERN_WARNING "ddkb: Write-back cache not flushed under memory pressure\n");
+	else
+		c->shrinker_on = 1;
+	printk(KERN_INFO "ddkb: Write-back cache of %d KiB\n", c->max_units * DDKC_UNIT_SIZE / 1024);
+	return 0;
+}
+/* After the last transfer; so, w/ the flush work off the workqueue, nothing else touches it */
+void ddkc_cleanup(struct ddk_cache *c)
+{
+	kfree(c->ra_buf);
+	c->ra_buf = NULL;
+	c->ra_max = 0;
+	if (!ddkc_on(c))
+		return;
+	if (c->shrinker_on)
+	{
+		unregister_shrinker(&c->shrinker);
+		c->shrinker_on = 0;
+	}
+	cancel_delayed_work_sync(&c->flush_work);
+	if (ddkc_flush(c) < 0)
+		printk(KERN_ERR "ddkb: Cached writes lost\n");
+	ddkc_free_units(c);
+	kfree(c->run_buf);
+	c->run_buf = NULL;
+}
@@ -0,0 +1,51 @@
+#ifndef DDK_CACHE_H
+#define DDK_CACHE_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/radix-tree.h>
+#include <linux/workqueue.h>
+#include <linux/shrinker.h>
+
+#include "ddk_storage.h"
+
+/*
+ * Write-back cache of a DDK device, in units of DDKC_UNIT_SECTORS, w/ its
+ * dirty sectors flushed as runs; & its readahead window. Used only from the
+ * device's ordered workqueue, i.e. from its transfers & its flush work, so
+ * w/o any lock
+ */
+struct ddk_cache
+{
+	struct ddk_storage *st;
+	struct workqueue_struct *wq;
+	unsigned int max_units; /* 0, if off */
+	struct radix_tree_root units;
+	atomic_t unit_cnt;
+	u8 *run_buf; /* For a run, while flushing */
+	struct delayed_work flush_work;
+	struct shrinker shrinker;
+	int shrinker_on;
+	/* Readahead: ra_len sectors from ra_start in ra_buf, of ra_max; off, if 0 */
+	unsigned int ra_max;
+	u8 *ra_buf;
+	sector_t ra_start;
+	unsigned int ra_len;
+	unsigned int ra_window; /* Sectors read beyond a request; 0, till sequential */
+	sector_t ra_next; /* Where a sequential read would start */
+};
+
+static inline int ddkc_on(struct ddk_cache *c)
+{
+	return c->max_units != 0;
+}
+
+extern int ddkc_init(struct ddk_cache *c, struct ddk_storage *st, struct workqueue_struct *wq);
+extern void ddkc_cleanup(struct ddk_cache *c);
+extern int ddkc_write(struct ddk_cache *c, sector_t sector_off, u8 *buffer, unsigned int sectors);
+extern int ddkc_read(struct ddk_cache *c, sector_t sector_off, u8 *buffer, unsigned int sectors);
+extern int ddkc_flush(struct ddk_cache *c);
+#endif
+
+#endif
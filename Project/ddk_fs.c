@@ -8,10 +8,27 @@
 #include <linux/buffer_head.h> /* map_bh, block_write_begin, block_write_full_page, generic_write_end, ... */
 #include <linux/mpage.h> /* mpage_readpage, ... */
 #include <linux/statfs.h> /* struct kstatfs, ... */
+#include <linux/workqueue.h> /* For delayed work, ... */
+#include <linux/debugfs.h> /* For debugfs_create_dir, ... */
+#include <linux/seq_file.h> /* For seq_printf, single_open, ... */
+#include <linux/string.h> /* For strsep, ... */
+#include <linux/uaccess.h> /* For copy_to_user, copy_from_user, ... */
+#include <linux/dax.h> /* For fs_dax_get_by_bdev, dax_direct_access, ... */
+#include <linux/pfn_t.h> /* For pfn_t */
 
 #include "ddk_fs_ds.h" /* For DDK FS related defines, data structures, ... */
 #include "ddk_fs_ops.h" /* For DDK FS related operations */
 
+#define CREATE_TRACE_POINTS
+#include "ddk_fs_trace.h" /* For the trace_ddkfs_*() tracepoints */
+
+#define DFS_LAZY_INIT_STEP 64 /* Entry table blocks zeroed in one go, in background */
+#define DFS_LAZY_INIT_DELAY (HZ / 10) /* Gap between the steps, to go easy on the foreground I/O */
+
+#if IS_ENABLED(CONFIG_FS_DAX)
+#define DFS_DAX /* Over the dax_device of the block device, e.g. rb */
+#endif
+
 /*
  * Data declarations
  */
@@ -22,6 +39,7 @@ static struct file_operations dfs_fops;
 static struct address_space_operations dfs_aops;
 
 static struct inode *dfs_root_inode;
+static struct dentry *dfs_debugfs_root; /* ddkfs/ in debugfs, w/ a directory per mount */
 
 /*
  * File Operations
@@ -31,136 +49,321 @@ static int dfs_file_release(struct inode *inode, struct file *file)
 	//printk(KERN_INFO "ddkfs: dfs_file_release\n");
 	return 0;
 }
-static int dfs_readdir(struct file *file, void *dirent, filldir_t filldir)
+static int dfs_readdir(struct file *file, struct dir_context *ctx)
 {
-	int retval;
-	struct dentry *de = file->f_dentry;
-	dfs_info_t *info = de->d_inode->i_sb->s_fs_info;
+	struct inode *inode = file_inode(file);
+	dfs_info_t *info = inode->i_sb->s_fs_info;
+
+	trace_ddkfs_readdir(inode, ctx->pos);
 
-	printk(KERN_INFO "ddkfs: dfs_readdir: %Ld\n", file->f_pos);
+	if (!dir_emit_dots(file, ctx))
+		return 0;
+	return dfs_list(info, &ctx->pos, ctx, ctx->actor);
+}
+static ssize_t dfs_file_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	dfs_info_t *info = file_inode(iocb->ki_filp)->i_sb->s_fs_info;
+	ssize_t retval;
 
-	if (file->f_pos == 0)
+	if ((retval = generic_file_read_iter(iocb, to)) > 0)
 	{
-		retval = filldir(dirent, ".", 1, file->f_pos, de->d_inode->i_ino, DT_DIR);
-		if (retval)
-			return retval;
-		file->f_pos++;
+		this_cpu_add(info->stats->bytes_read, retval);
 	}
-	if (file->f_pos == 1)
+	return retval;
+}
+static ssize_t dfs_file_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	dfs_info_t *info = file_inode(iocb->ki_filp)->i_sb->s_fs_info;
+	ssize_t retval;
+
+	if ((retval = generic_file_write_iter(iocb, from)) > 0)
 	{
-		retval = filldir(dirent, "..", 2, file->f_pos, de->d_parent->d_inode->i_ino, DT_DIR);
-		if (retval)
-			return retval;
-		file->f_pos++;
+		this_cpu_add(info->stats->bytes_written, retval);
 	}
-	return 0;
-	//return dfs_list(info, file, dirent, filldir); // TODO: Ready the dfs_list to uncomment this
+	return retval;
 }
 static struct file_operations dfs_fops =
 {
 	open: generic_file_open,
 	release: dfs_file_release,
-	read: do_sync_read,
-	write: do_sync_write,
-	aio_read: generic_file_aio_read,
-	aio_write: generic_file_aio_write,
+	read_iter: dfs_file_read_iter,
+	write_iter: dfs_file_write_iter,
+	mmap: generic_file_mmap,
 	llseek:	generic_file_llseek,
-#if (LINUX_VERSION_CODE < KERNEL_VERSION(2,6,35))
-	fsync: simple_sync_file
-#else
 	fsync: noop_fsync
-#endif
 };
 static struct file_operations dfs_dops =
 {
-	//readdir: dfs_readdir // TODO: Uncomment on completing dfs_readdir's  implementation
+	iterate_shared: dfs_readdir
 };
 
-static int dfs_get_block(struct inode *inode, sector_t iblock, struct buffer_head *bh_result, int create)
+/*
+ * Maps the file block to its device block, allocating it if create is set.
+ * *phys is 0 for a hole, & *new is set for a block allocated just now
+ */
+static int dfs_map_block(struct inode *inode, sector_t iblock, int create, sector_t *phys, int *new)
 {
-	struct super_block *sb = inode->i_sb;
-	dfs_info_t *info = (dfs_info_t *)(sb->s_fs_info);
+	dfs_info_t *info = (dfs_info_t *)(inode->i_sb->s_fs_info);
 	dfs_file_entry_t fe;
-	sector_t phys;
 	int retval;
 
-	printk(KERN_INFO "ddkfs: dfs_get_block called for I: %ld, B: %lld, C: %d\n", inode->i_ino, iblock, create);
-
+	*new = 0;
 	if (iblock >= DDK_FS_DATA_BLOCK_CNT)
 	{
 		return -ENOSPC;
 	}
+	/* The allocation is a read-modify-write of the entry, as is write_inode's update */
+	mutex_lock(&info->entry_lock);
 	if ((retval = dfs_read_file_entry(info, inode->i_ino, &fe)) < 0)
 	{
+		mutex_unlock(&info->entry_lock);
 		return retval;
 	}
-	if (!fe.blocks[iblock])
+	if (!fe.blocks[iblock] && create)
 	{
-		if (!create)
+		if ((retval = dfs_get_data_block(info)) == INV_BLOCK)
 		{
-			return -EIO;
+			mutex_unlock(&info->entry_lock);
+			return -ENOSPC;
 		}
-		else
+		fe.blocks[iblock] = retval;
+		if ((retval = dfs_write_file_entry(info, inode->i_ino, &fe)) < 0)
 		{
-			/*
-			 * TODO: Get a free data block for fe.blocks[iblock]
-			 * If it is INV_BLOCK then return -ENOSPC, other proceed further
-			 * to dfs_write_file_entry
-			 *
-			 * Add your code here and delete the return
-			 */
-			return -EIO;
-
-			if ((retval = dfs_write_file_entry(info, inode->i_ino, &fe)) < 0)
-			{
-				return retval;
-			}
+			dfs_put_data_block(info, fe.blocks[iblock]);
+			mutex_unlock(&info->entry_lock);
+			return retval;
 		}
+		*new = 1;
+	}
+	mutex_unlock(&info->entry_lock);
+	*phys = fe.blocks[iblock];
+	return 0;
+}
+static int dfs_get_block(struct inode *inode, sector_t iblock, struct buffer_head *bh_result, int create)
+{
+	dfs_info_t *info = (dfs_info_t *)(inode->i_sb->s_fs_info);
+	sector_t phys;
+	int new;
+	int retval;
+
+	trace_ddkfs_get_block(inode, iblock, create);
+	this_cpu_inc(info->stats->get_block_calls);
+
+	if ((retval = dfs_map_block(inode, iblock, create, &phys, &new)) < 0)
+	{
+		return retval;
+	}
+	if (!phys)
+	{
+		return -EIO;
+	}
+	if (new)
+	{
+		set_buffer_new(bh_result);
 	}
-	phys = fe.blocks[iblock];
-	map_bh(bh_result, sb, phys);
+	map_bh(bh_result, inode->i_sb, phys);
 
 	return 0;
 }
 static int dfs_readpage(struct file *file, struct page *page)
 {
-	printk(KERN_INFO "ddkfs: dfs_readpage\n");
+	trace_ddkfs_readpage(page->mapping->host, page->index);
 	return mpage_readpage(page, dfs_get_block);
 }
 static int dfs_write_begin(struct file *file, struct address_space *mapping,
 	loff_t pos, unsigned len, unsigned flags, struct page **pagep, void **fsdata)
 {
-	printk(KERN_INFO "ddkfs: dfs_write_begin\n");
+	trace_ddkfs_write_begin(mapping->host, pos, len);
 	*pagep = NULL;
-#if (LINUX_VERSION_CODE < KERNEL_VERSION(2,6,36))
-	return block_write_begin(file, mapping, pos, len, flags, pagep, fsdata,
-		dfs_get_block);
-#else
 	return block_write_begin(mapping, pos, len, flags, pagep, dfs_get_block);
-#endif
 }
 static int dfs_writepage(struct page *page, struct writeback_control *wbc)
 {
-	printk(KERN_INFO "ddkfs: dfs_writepage\n");
+	trace_ddkfs_writepage(page->mapping->host, page->index);
 	return block_write_full_page(page, dfs_get_block, wbc);
 }
 static struct address_space_operations dfs_aops =
 {
-	// TODO: Uncomment below once dfs_get_block's implementation is complete
-	//.readpage = dfs_readpage,
-	//.write_begin = dfs_write_begin,
-	//.writepage = dfs_writepage,
-	//.write_end = generic_write_end
+	.readpage = dfs_readpage,
+	.write_begin = dfs_write_begin,
+	.writepage = dfs_writepage,
+	.write_end = generic_write_end
+};
+
+#ifdef DFS_DAX
+/*
+ * Maps the device sector (of the partition) through the dax_device, into
+ * *kaddr, valid till the end of its device page. Under dax_read_lock
+ */
+static int dfs_dax_map(dfs_info_t *info, sector_t sector, void **kaddr)
+{
+	sector_t dev_sector = get_start_sect(info->vfs_sb->s_bdev) + sector;
+	pfn_t pfn;
+	long avail;
+
+	avail = dax_direct_access(info->dax_dev, dev_sector >> (PAGE_SHIFT - 9), 1, kaddr, &pfn);
+	if (avail < 0)
+		return avail;
+	*kaddr += (dev_sector & ((PAGE_SIZE >> 9) - 1)) << 9;
+	return 0;
+}
+/* The device should map, right from its first sector; or else, no DAX */
+static int dfs_dax_probe(dfs_info_t *info)
+{
+	void *kaddr;
+	int id;
+	int retval;
+
+	if (!(info->dax_dev = fs_dax_get_by_bdev(info->vfs_sb->s_bdev)))
+		return -EOPNOTSUPP;
+	id = dax_read_lock();
+	retval = dfs_dax_map(info, 0, &kaddr);
+	dax_read_unlock(id);
+	if (retval < 0)
+	{
+		fs_put_dax(info->dax_dev);
+		info->dax_dev = NULL;
+	}
+	return retval;
+}
+/*
+ * DAX mode: file data copied straight between the user buffer & the device
+ * memory, bypassing the page cache. Except for mmap, which stays on the page
+ * cache: so, as w/ O_DIRECT, its dirty pages are written out before, & the
+ * ones written over are dropped after
+ */
+static ssize_t dfs_dax_rw(struct file *file, char __user *buf, size_t len, loff_t *ppos, int write)
+{
+	struct inode *inode = file_inode(file);
+	struct address_space *mapping = inode->i_mapping;
+	dfs_info_t *info = (dfs_info_t *)(inode->i_sb->s_fs_info);
+	byte4_t block_size = info->sb.block_size;
+	loff_t pos = *ppos, end;
+	sector_t phys;
+	unsigned int offset, chunk;
+	void *kaddr;
+	int new;
+	ssize_t done = 0;
+	int id;
+	int retval = 0;
+
+	if (write)
+	{
+		inode_lock(inode);
+		if (file->f_flags & O_APPEND)
+			pos = i_size_read(inode);
+		end = (loff_t)DDK_FS_DATA_BLOCK_CNT * block_size;
+	}
+	else
+	{
+		end = i_size_read(inode);
+	}
+	if (pos >= end)
+	{
+		retval = write ? -EFBIG : 0;
+		goto out;
+	}
+	if (len > end - pos)
+		len = end - pos;
+	if ((retval = filemap_write_and_wait_range(mapping, pos, pos + len - 1)) < 0)
+		goto out;
+
+	while (len)
+	{
+		offset = pos % block_size;
+		chunk = min_t(size_t, len, block_size - offset);
+		if ((retval = dfs_map_block(inode, pos / block_size, write, &phys, &new)) < 0)
+			break;
+		if (!phys) // Hole, in a read
+		{
+			retval = clear_user(buf, chunk) ? -EFAULT : 0;
+		}
+		else
+		{
+			id = dax_read_lock();
+			/* Within one device page, as the sector is block aligned */
+			if ((retval = dfs_dax_map(info, phys * (block_size / 512), &kaddr)) < 0)
+			{
+				dax_read_unlock(id);
+				break;
+			}
+			if (write)
+			{
+				if (new && (chunk != block_size))
+					memset(kaddr, 0, block_size);
+				retval = copy_from_user(kaddr + offset, buf, chunk) ? -EFAULT : 0;
+			}
+			else
+			{
+				retval = copy_to_user(buf, kaddr + offset, chunk) ? -EFAULT : 0;
+			}
+			dax_read_unlock(id);
+		}
+		if (retval < 0)
+			break;
+		buf += chunk;
+		pos += chunk;
+		len -= chunk;
+		done += chunk;
+	}
+	if (done)
+	{
+		if (write)
+		{
+			invalidate_inode_pages2_range(mapping, *ppos >> PAGE_SHIFT, (pos - 1) >> PAGE_SHIFT);
+			if (pos > i_size_read(inode))
+				i_size_write(inode, pos);
+			inode->i_mtime = inode->i_ctime = current_time(inode);
+			mark_inode_dirty(inode);
+			this_cpu_add(info->stats->bytes_written, done);
+		}
+		else
+		{
+			this_cpu_add(info->stats->bytes_read, done);
+		}
+		*ppos = pos;
+	}
+out:
+	if (write)
+		inode_unlock(inode);
+	return done ? done : retval;
+}
+static ssize_t dfs_dax_read(struct file *file, char __user *buf, size_t len, loff_t *ppos)
+{
+	return dfs_dax_rw(file, buf, len, ppos, 0);
+}
+static ssize_t dfs_dax_write(struct file *file, const char __user *buf, size_t len, loff_t *ppos)
+{
+	return dfs_dax_rw(file, (char __user *)(buf), len, ppos, 1);
+}
+/*
+ * mmap through the page cache, as a file page spans DDK FS blocks anywhere
+ * on the device, while a direct mapping needs it in one device page
+ */
+static struct file_operations dfs_dax_fops =
+{
+	open: generic_file_open,
+	release: dfs_file_release,
+	read: dfs_dax_read,
+	write: dfs_dax_write,
+	mmap: generic_file_mmap,
+	llseek:	generic_file_llseek,
+	fsync: noop_fsync
 };
+#endif
+static struct file_operations *dfs_file_fops(dfs_info_t *info)
+{
+#ifdef DFS_DAX
+	if (info->dax_dev)
+		return &dfs_dax_fops;
+#endif
+	return &dfs_fops;
+}
 
 /*
  * Inode Operations
  */
-#if (LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0))
-static struct dentry *dfs_inode_lookup(struct inode *parent_inode, struct dentry *dentry, struct nameidata *nameidata)
-#else
 static struct dentry *dfs_inode_lookup(struct inode *parent_inode, struct dentry *dentry, unsigned int flags)
-#endif
 {
 	dfs_info_t *info = (dfs_info_t *)(parent_inode->i_sb->s_fs_info);
 	char fn[dentry->d_name.len + 1];
@@ -168,22 +371,22 @@ static struct dentry *dfs_inode_lookup(struct inode *parent_inode, struct dentry
 	dfs_file_entry_t fe;
 	struct inode *file_inode = NULL;
 
-	printk(KERN_INFO "ddkfs: dfs_inode_lookup\n");
-
 	if (parent_inode->i_ino != dfs_root_inode->i_ino)
 		return ERR_PTR(-ENOENT);
+	if (dentry->d_name.len > DDK_FS_FILENAME_LEN)
+		return ERR_PTR(-ENAMETOOLONG);
 	strncpy(fn, dentry->d_name.name, dentry->d_name.len);
 	fn[dentry->d_name.len] = 0;
-	if ((ino = dfs_lookup(info, fn, &fe)) == INV_INODE) // TODO: Fill up the dfs_lookup
+	ino = dfs_lookup(info, fn, &fe);
+	trace_ddkfs_lookup(parent_inode, fn, ino);
+	if (ino == INV_INODE)
 	  return d_splice_alias(file_inode, dentry); // Possibly create a new one
 
-	printk(KERN_INFO "ddkfs: Getting an existing inode\n");
 	file_inode = iget_locked(parent_inode->i_sb, ino);
 	if (!file_inode)
 		return ERR_PTR(-EACCES);
 	if (file_inode->i_state & I_NEW)
 	{
-		printk(KERN_INFO "ddkfs: Got new VFS inode for #%d, let's fill in\n", ino);
 		file_inode->i_size = fe.size;
 		file_inode->i_mode = S_IFREG;
 		file_inode->i_mode |= ((fe.perms & 4) ? S_IRUSR | S_IRGRP | S_IROTH : 0);
@@ -192,22 +395,14 @@ static struct dentry *dfs_inode_lookup(struct inode *parent_inode, struct dentry
 		file_inode->i_atime.tv_sec = file_inode->i_mtime.tv_sec = file_inode->i_ctime.tv_sec = fe.timestamp;
 		file_inode->i_atime.tv_nsec = file_inode->i_mtime.tv_nsec = file_inode->i_ctime.tv_nsec = 0;
 		file_inode->i_mapping->a_ops = &dfs_aops;
-		file_inode->i_fop = &dfs_fops;
+		file_inode->i_fop = dfs_file_fops(info);
 		unlock_new_inode(file_inode);
 	}
-	else
-	{
-		printk(KERN_INFO "ddkfs: Got VFS inode from inode cache\n");
-	}
 	d_add(dentry, file_inode);
 	return NULL;
 	// Above 2 lines can be replaced by 'return d_splice_alias(file_inode, dentry);'
 }
-#if (LINUX_VERSION_CODE < KERNEL_VERSION(3,6,0))
-static int dfs_inode_create(struct inode *parent_inode, struct dentry *dentry, umode_t mode, struct nameidata *nameidata)
-#else
 static int dfs_inode_create(struct inode *parent_inode, struct dentry *dentry, umode_t mode, bool excl)
-#endif
 {
 	char fn[dentry->d_name.len + 1];
 	int perms = 0;
@@ -216,7 +411,9 @@ static int dfs_inode_create(struct inode *parent_inode, struct dentry *dentry, u
 	struct inode *file_inode;
 	dfs_file_entry_t fe;
 
-	printk(KERN_INFO "ddkfs: dfs_inode_create\n");
+	pr_debug("ddkfs: dfs_inode_create\n");
+	if (dentry->d_name.len > DDK_FS_FILENAME_LEN)
+		return -ENAMETOOLONG;
 
 	strncpy(fn, dentry->d_name.name, dentry->d_name.len);
 	fn[dentry->d_name.len] = 0;
@@ -229,28 +426,28 @@ static int dfs_inode_create(struct inode *parent_inode, struct dentry *dentry, u
 	perms |= (mode & S_IRUSR) ? 4 : 0;
 	perms |= (mode & S_IWUSR) ? 2 : 0;
 	perms |= (mode & S_IXUSR) ? 1 : 0;
-	if ((ino = dfs_create(info, fn, perms, &fe)) == INV_INODE) // TODO: Fill up the dfs_create
+	if ((ino = dfs_create(info, fn, perms, &fe)) == INV_INODE)
 		return -ENOSPC;
 
 	file_inode = new_inode(parent_inode->i_sb);
 	if (!file_inode)
 	{
-		dfs_remove(info, fn); // Nothing to do, even if it fails
+		dfs_remove(info, fn, 0); // Nothing to do, even if it fails
 		return -ENOMEM;
 	}
-	printk(KERN_INFO "ddkfs: Created new VFS inode for #%d, let's fill in\n", ino);
+	pr_debug("ddkfs: Created new VFS inode for #%d, let's fill in\n", ino);
 	file_inode->i_ino = ino;
 	file_inode->i_size = fe.size;
 	file_inode->i_mode = S_IFREG | mode;
 	file_inode->i_atime.tv_sec = file_inode->i_mtime.tv_sec = file_inode->i_ctime.tv_sec = fe.timestamp;
 	file_inode->i_atime.tv_nsec = file_inode->i_mtime.tv_nsec = file_inode->i_ctime.tv_nsec = 0;
 	file_inode->i_mapping->a_ops = &dfs_aops;
-	file_inode->i_fop = &dfs_fops;
+	file_inode->i_fop = dfs_file_fops(info);
 	if (insert_inode_locked(file_inode) < 0)
 	{
 		make_bad_inode(file_inode);
 		iput(file_inode);
-		dfs_remove(info, fn); // Nothing to do, even if it fails
+		dfs_remove(info, fn, 0); // Nothing to do, even if it fails
 		return -EIO;
 	}
 	d_instantiate(dentry, file_inode);
@@ -258,7 +455,6 @@ static int dfs_inode_create(struct inode *parent_inode, struct dentry *dentry, u
 
 	return 0;
 }
-#if 0
 static int dfs_inode_unlink(struct inode *parent_inode, struct dentry *dentry)
 {
 	char fn[dentry->d_name.len + 1];
@@ -266,49 +462,114 @@ static int dfs_inode_unlink(struct inode *parent_inode, struct dentry *dentry)
 	int ino;
 	struct inode *file_inode = dentry->d_inode;
 
-	printk(KERN_INFO "ddkfs: dfs_inode_unlink\n");
+	pr_debug("ddkfs: dfs_inode_unlink\n");
 
 	strncpy(fn, dentry->d_name.name, dentry->d_name.len);
 	fn[dentry->d_name.len] = 0;
-	if ((ino = dfs_remove(info, fn)) == INV_INODE) // TODO: Fill up the dfs_remove
+	/* May still be open, mapped, or w/ dirty pages; so freed only on its eviction */
+	if ((ino = dfs_remove(info, fn, 1)) == INV_INODE)
 		return -EINVAL;
 
 	inode_dec_link_count(file_inode);
 	return 0;
 }
-static int dfs_inode_rename(struct inode *old_dir, struct dentry *old_dentry, struct inode *new_dir, struct dentry *new_dentry)
+static int dfs_inode_rename(struct inode *old_dir, struct dentry *old_dentry, struct inode *new_dir, struct dentry *new_dentry,
+	unsigned int flags)
 {
 	dfs_info_t *info = (dfs_info_t *)(old_dir->i_sb->s_fs_info);
 	char src_fn[old_dentry->d_name.len + 1];
 	char dst_fn[new_dentry->d_name.len + 1];
 
-	printk(KERN_INFO "ddkfs: dfs_inode_rename\n");
+	pr_debug("ddkfs: dfs_inode_rename\n");
+	if (flags & ~RENAME_NOREPLACE) // The VFS takes care of RENAME_NOREPLACE
+		return -EINVAL;
 	if ((old_dir != new_dir) || (old_dir->i_ino != ROOT_INODE_NUM))
 	/* Both files not at root level */
 		return -EINVAL;
+	if (new_dentry->d_name.len > DDK_FS_FILENAME_LEN)
+		return -ENAMETOOLONG;
 	strncpy(src_fn, old_dentry->d_name.name, old_dentry->d_name.len);
 	src_fn[old_dentry->d_name.len] = 0;
 	strncpy(dst_fn, new_dentry->d_name.name, new_dentry->d_name.len);
 	dst_fn[new_dentry->d_name.len] = 0;
 
-	if (dfs_rename(info, src_fn, dst_fn) == INV_INODE) // TODO: Fill up the dfs_rename
+	if (dfs_rename(info, src_fn, dst_fn) == INV_INODE)
 		return -ENOENT;
-	else
-		return 0;
+	/* The replaced one's entry & blocks go on its eviction, as w/ unlink */
+	if (d_inode(new_dentry))
+		drop_nlink(d_inode(new_dentry));
+	return 0;
 }
-#endif
 static struct inode_operations dfs_iops =
 {
-	// TODO: Uncomment below once the corresponding function's implementation is complete
-	//lookup: dfs_inode_lookup, /* TODO: Try first */
-	//create: dfs_inode_create, /* TODO: Try next */
-	//unlink: dfs_inode_unlink, /* TODO: Now try removing the files */
-	//rename: dfs_inode_rename /* TODO: Now try renaming the files */
+	lookup: dfs_inode_lookup,
+	create: dfs_inode_create,
+	unlink: dfs_inode_unlink,
+	rename: dfs_inode_rename
+};
+
+/*
+ * Per mount stats, in debugfs
+ */
+static int dfs_stats_show(struct seq_file *m, void *v)
+{
+	dfs_info_t *info = m->private;
+	dfs_stats_t stats;
+
+	dfs_get_stats(info, &stats);
+	seq_printf(m, "lookups %llu\n", stats.lookups);
+	seq_printf(m, "entry_reads %llu\n", stats.entry_reads);
+	seq_printf(m, "allocs %llu\n", stats.allocs);
+	seq_printf(m, "alloc_scan_len %llu\n", stats.alloc_scan_len);
+	seq_printf(m, "get_block_calls %llu\n", stats.get_block_calls);
+	seq_printf(m, "bytes_read %llu\n", stats.bytes_read);
+	seq_printf(m, "bytes_written %llu\n", stats.bytes_written);
+	seq_printf(m, "free_blocks %u\n", info->free_block_count);
+	seq_printf(m, "free_entries %u\n", info->free_entry_count);
+	return 0;
+}
+static int dfs_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, dfs_stats_show, inode->i_private);
+}
+static struct file_operations dfs_stats_fops =
+{
+	owner: THIS_MODULE,
+	open: dfs_stats_open,
+	read: seq_read,
+	llseek: seq_lseek,
+	release: single_release
 };
+static void dfs_debugfs_add(dfs_info_t *info)
+{
+	if (IS_ERR_OR_NULL(dfs_debugfs_root)) // No debugfs; the stats are just not exposed then
+		return;
+	info->debugfs_dir = debugfs_create_dir(info->vfs_sb->s_id, dfs_debugfs_root);
+	if (IS_ERR_OR_NULL(info->debugfs_dir))
+	{
+		info->debugfs_dir = NULL;
+		return;
+	}
+	debugfs_create_file("stats", S_IRUGO, info->debugfs_dir, info, &dfs_stats_fops);
+}
 
 /*
  * Super-Block Operations
  */
+static void dfs_lazy_init(struct work_struct *work)
+{
+	dfs_info_t *info = container_of(to_delayed_work(work), dfs_info_t, lazy_init_work);
+	int retval;
+
+	if ((retval = dfs_init_entry_table(info, DFS_LAZY_INIT_STEP)) > 0)
+	{
+		schedule_delayed_work(&info->lazy_init_work, DFS_LAZY_INIT_DELAY);
+	}
+	else if (retval < 0)
+	{
+		printk(KERN_ERR "ddkfs: Entry table initialisation failed (%d)\n", retval);
+	}
+}
 static void dfs_put_super(struct super_block *sb)
 {
 	dfs_info_t *info = (dfs_info_t *)(sb->s_fs_info);
@@ -316,49 +577,45 @@ static void dfs_put_super(struct super_block *sb)
 	printk(KERN_INFO "ddkfs: dfs_put_super\n");
 	if (info)
 	{
+		cancel_delayed_work_sync(&info->lazy_init_work);
+		debugfs_remove_recursive(info->debugfs_dir);
 		dfs_shut(info);
+		fs_put_dax(info->dax_dev);
 		kfree(info);
 		sb->s_fs_info = NULL;
 	}
 }
-#if 0
 static int dfs_statfs(struct dentry *dentry, struct kstatfs *buf)
 {
 	struct super_block *sb = dentry->d_sb;
 	dfs_info_t *info = (dfs_info_t *)(sb->s_fs_info);
 	u64 id = huge_encode_dev(sb->s_bdev->bd_dev);
 
-	printk(KERN_INFO "ddkfs: dfs_statfs\n");
 	buf->f_type = info->sb.type;
 	buf->f_bsize = info->sb.block_size;
 	buf->f_blocks = info->sb.partition_size;
-	/* TODO: Total number of free blocks */
-	buf->f_bfree = 0;
+	/* Total number of free blocks */
+	buf->f_bfree = info->free_block_count;
 	/* Total number of blocks available to unprivileged user */
 	buf->f_bavail = buf->f_bfree;
-	/* TODO: Total number of entries */
-	buf->f_files = 0;
-	/* TODO: Total number of free entries */
-	buf->f_ffree = 0;
+	/* Total number of entries */
+	buf->f_files = info->sb.entry_count;
+	/* Total number of free entries */
+	buf->f_ffree = info->free_entry_count;
 	buf->f_fsid.val[0] = (u32)id;
 	buf->f_fsid.val[1] = (u32)(id >> 32);
 	buf->f_namelen = DDK_FS_FILENAME_LEN;
 	return 0;
 }
-#endif
-#if (LINUX_VERSION_CODE < KERNEL_VERSION(2,6,34))
-static int dfs_write_inode(struct inode *inode, int do_sync)
-#else
 static int dfs_write_inode(struct inode *inode, struct writeback_control *wbc)
-#endif
 {
 	dfs_info_t *info = (dfs_info_t *)(inode->i_sb->s_fs_info);
 	int size, timestamp, perms;
 
-	printk(KERN_INFO "ddkfs: dfs_write_inode (i_ino = %ld)\n", inode->i_ino);
-
 	if (!(S_ISREG(inode->i_mode))) // DDK FS deals only with regular files
 		return 0;
+	if (!inode->i_nlink) // Removed; its entry is freed on eviction
+		return 0;
 
 	size = i_size_read(inode);
 	timestamp = inode->i_mtime.tv_sec > inode->i_ctime.tv_sec ? inode->i_mtime.tv_sec : inode->i_ctime.tv_sec;
@@ -367,17 +624,27 @@ static int dfs_write_inode(struct inode *inode, struct writeback_control *wbc)
 	perms |= (inode->i_mode & (S_IWUSR | S_IWGRP | S_IWOTH)) ? 2 : 0;
 	perms |= (inode->i_mode & (S_IXUSR | S_IXGRP | S_IXOTH)) ? 1 : 0;
 
-	printk(KERN_INFO "ddkfs: Writing inode with %d bytes @ %d secs w/ %o\n", size, timestamp, perms);
+	trace_ddkfs_write_inode(inode, size, timestamp, perms);
+
+	return dfs_update(info, inode->i_ino, &size, &timestamp, &perms);
+}
+static void dfs_evict_inode(struct inode *inode)
+{
+	dfs_info_t *info = (dfs_info_t *)(inode->i_sb->s_fs_info);
 
-	return dfs_update(info, inode->i_ino, &size, &timestamp, &perms); // TODO: Fill up the dfs_update
+	truncate_inode_pages_final(&inode->i_data);
+	clear_inode(inode);
+	/* Unlinked & now w/ no user left; so, its entry & blocks can go */
+	if (!inode->i_nlink && S_ISREG(inode->i_mode))
+		dfs_evict(info, inode->i_ino);
 }
 
 static struct super_operations dfs_sops =
 {
-	// TODO: Uncomment write_inode once dfs_write_inode's implementation is complete
 	put_super: dfs_put_super,
-	//statfs: dfs_statfs, /* used by df to show it up */ /* TODO: Now try getting the stats */
-	//write_inode: dfs_write_inode
+	statfs: dfs_statfs, /* used by df to show it up */
+	write_inode: dfs_write_inode,
+	evict_inode: dfs_evict_inode
 };
 
 /*
@@ -393,16 +660,53 @@ static int get_bit_pos(unsigned int val)
 	}   
 	return (i - 1); 
 }
+static int dfs_parse_options(dfs_info_t *info, char *options)
+{
+	char *opt;
+
+	while ((opt = strsep(&options, ",")) != NULL)
+	{
+		if (!*opt)
+			continue;
+		if (!strcmp(opt, "dax"))
+		{
+#ifdef DFS_DAX
+			if (!info->dax_dev && (dfs_dax_probe(info) < 0))
+			{
+				printk(KERN_ERR "ddkfs: Device doesn't support DAX\n");
+				return -EINVAL;
+			}
+#else
+			printk(KERN_ERR "ddkfs: DAX not supported on this kernel\n");
+			return -EINVAL;
+#endif
+		}
+		else
+		{
+			printk(KERN_ERR "ddkfs: Unknown mount option %s\n", opt);
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
 static int dfs_fill_super(struct super_block *sb, void *data, int silent)
 {
 	dfs_info_t *info;
+	int retval;
 
 	printk(KERN_INFO "ddkfs: dfs_fill_super\n");
 	if (!(info = (dfs_info_t *)(kzalloc(sizeof(dfs_info_t), GFP_KERNEL))))
 		return -ENOMEM;
 	info->vfs_sb = sb;
+	if ((retval = dfs_parse_options(info, data)) < 0)
+	{
+		fs_put_dax(info->dax_dev);
+		kfree(info);
+		return retval;
+	}
 	if (dfs_init(info) < 0)
 	{
+		fs_put_dax(info->dax_dev);
 		kfree(info);
 		return -EIO;
 	}
@@ -417,6 +721,7 @@ static int dfs_fill_super(struct super_block *sb, void *data, int silent)
 	if (!dfs_root_inode)
 	{
 		dfs_shut(info);
+		fs_put_dax(info->dax_dev);
 		kfree(info);
 		return -EACCES;
 	}
@@ -434,19 +739,24 @@ static int dfs_fill_super(struct super_block *sb, void *data, int silent)
 		printk(KERN_INFO "ddkfs: Got root's VFS inode from inode cache\n");
 	}
 
-#if (LINUX_VERSION_CODE < KERNEL_VERSION(3,4,0))
-	sb->s_root = d_alloc_root(dfs_root_inode);
-#else
 	sb->s_root = d_make_root(dfs_root_inode);
-#endif
 	if (!sb->s_root)
 	{
 		iget_failed(dfs_root_inode);
 		dfs_shut(info);
+		fs_put_dax(info->dax_dev);
 		kfree(info);
 		return -ENOMEM;
 	}
 
+	/* Zero the rest of a lazily initialised entry table, in background */
+	INIT_DELAYED_WORK(&info->lazy_init_work, dfs_lazy_init);
+	if ((info->sb.flags & DDK_FS_FLAG_LAZY_INIT) && !sb_rdonly(sb))
+	{
+		schedule_delayed_work(&info->lazy_init_work, DFS_LAZY_INIT_DELAY);
+	}
+	dfs_debugfs_add(info);
+
 	return 0;
 }
 
@@ -475,7 +785,12 @@ static int __init ddk_fs_init(void)
 	int err;
 
 	printk(KERN_INFO "ddkfs: dfs_init\n");
+	dfs_debugfs_root = debugfs_create_dir("ddkfs", NULL);
 	err = register_filesystem(&dfs);
+	if (err)
+	{
+		debugfs_remove_recursive(dfs_debugfs_root);
+	}
 	return err;
 }
 
@@ -483,6 +798,7 @@ static void __exit ddk_fs_exit(void)
 {
 	printk(KERN_INFO "ddkfs: dfs_exit\n");
 	unregister_filesystem(&dfs);
+	debugfs_remove_recursive(dfs_debugfs_root);
 }
 
 module_init(ddk_fs_init);
@@ -0,0 +1,55 @@
+#ifndef DDK_FS_COMPAT_H
+#define DDK_FS_COMPAT_H
+
+/*
+ * User space stand-ins for the few kernel facilities used by the DDK FS
+ * engine (ddk_fs_ops.c), so that the very same engine builds into libddkfs
+ * for mkfs, fsck, FUSE, benchmarks, ...
+ */
+#ifndef __KERNEL__
+#include <stdio.h> /* For fprintf */
+#include <stdlib.h> /* For malloc, free */
+#include <string.h> /* For memcpy, memset, strncpy, ... */
+#include <errno.h> /* For error codes */
+#include <time.h> /* For time */
+#include <pthread.h> /* For pthread_mutex_t, ... */
+#include <sys/types.h> /* For loff_t */
+#include <dirent.h> /* For DT_REG */
+
+#define KERN_ERR ""
+#define KERN_WARNING ""
+#define KERN_INFO ""
+#define KERN_DEBUG ""
+#define printk(...) fprintf(stderr, __VA_ARGS__)
+
+#define vmalloc(size) malloc(size)
+#define vfree(ptr) free(ptr)
+
+#define get_seconds() ((unsigned long)(time(NULL)))
+
+/* A mutex, as user space threads may get preempted while holding it */
+typedef pthread_mutex_t spinlock_t;
+#define spin_lock_init(l) pthread_mutex_init(l, NULL)
+#define spin_lock(l) pthread_mutex_lock(l)
+#define spin_unlock(l) pthread_mutex_unlock(l)
+
+struct mutex
+{
+	pthread_mutex_t m;
+};
+#define mutex_init(l) pthread_mutex_init(&(l)->m, NULL)
+#define mutex_lock(l) pthread_mutex_lock(&(l)->m)
+#define mutex_unlock(l) pthread_mutex_unlock(&(l)->m)
+
+/* Only one "CPU" in user space, w/ atomic updates */
+#define alloc_percpu(type) ((type *)(calloc(1, sizeof(type))))
+#define free_percpu(ptr) free(ptr)
+#define per_cpu_ptr(ptr, cpu) (ptr)
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < 1; (cpu)++)
+#define this_cpu_add(var, n) __atomic_fetch_add(&(var), (n), __ATOMIC_RELAXED)
+#define this_cpu_inc(var) this_cpu_add(var, 1)
+
+typedef int (*filldir_t)(void *dirent, const char *name, int namlen, loff_t offset, unsigned long long ino, unsigned int d_type);
+#endif
+
+#endif
@@ -4,6 +4,10 @@
 #include <linux/fs.h>
 #ifdef __KERNEL__
 #include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#else
+#include "ddk_fs_compat.h"
 #endif
 
 #define DDK_FS_TYPE 0x13090D15 /* Magic Number for our file system */
@@ -13,6 +17,9 @@
 #define DDK_FS_FILENAME_LEN 15
 #define DDK_FS_DATA_BLOCK_CNT ((DDK_FS_ENTRY_SIZE - ((DDK_FS_FILENAME_LEN + 1) + 3 * 4)) / 4)
 
+/* Super block flags */
+#define DDK_FS_FLAG_LAZY_INIT 0x1 /* Entry table beyond entry_table_init_size yet to be zeroed */
+
 typedef unsigned char byte1_t;
 typedef unsigned int byte4_t;
 typedef unsigned long long byte8_t;
@@ -27,7 +34,9 @@ typedef struct dfs_super_block
 	byte4_t entry_table_block_start; /* in blocks */
 	byte4_t entry_count; /* Total entries in the file system */
 	byte4_t data_block_start; /* in blocks */
-	byte4_t reserved[DDK_FS_BLOCK_SIZE / 4 - 8];
+	byte4_t flags; /* DDK_FS_FLAG_* */
+	byte4_t entry_table_init_size; /* in blocks; Valid only w/ DDK_FS_FLAG_LAZY_INIT */
+	byte4_t reserved[DDK_FS_BLOCK_SIZE / 4 - 10];
 } dfs_super_block_t; /* Making it of DDK_FS_BLOCK_SIZE */
 
 typedef struct dfs_file_entry
@@ -39,16 +48,40 @@ typedef struct dfs_file_entry
 	byte4_t blocks[DDK_FS_DATA_BLOCK_CNT];
 } dfs_file_entry_t;
 
-#ifdef __KERNEL__
+typedef struct dfs_stats
+{
+	byte8_t lookups; /* Name lookups */
+	byte8_t entry_reads; /* Entries read from the entry table */
+	byte8_t allocs; /* Data block allocations */
+	byte8_t alloc_scan_len; /* Blocks scanned for those allocations */
+	byte8_t get_block_calls; /* Block mappings asked for */
+	byte8_t bytes_read;
+	byte8_t bytes_written;
+} dfs_stats_t;
+
 typedef struct dfs_info
 {
+#ifdef __KERNEL__
 	struct super_block *vfs_sb; /* Super block structure from VFS for this fs */
+#else
+	int dev_fd; /* Image file or device holding this fs */
+	byte1_t *dev_map; /* Its shared mapping, if opened w/ DFS_UIO_MMAP */
+	byte8_t dev_size; /* in bytes */
+#endif
 	dfs_super_block_t sb; /* Our fs super block */
 	byte1_t *used_blocks; /* Used blocks tracker */
+	byte1_t *orphans; /* Entries removed while in use: free on the fs, but kept till evicted */
 	byte4_t free_block_count; /* Count of free blocks */
 	byte4_t free_entry_count; /* Count of free entries */
 	spinlock_t lock; /* Used for protecting access of used_blocks, ... */
-} dfs_info_t;
+	dfs_stats_t *stats; /* Per CPU, w/ the sum being the stats of this mount */
+	struct mutex init_lock; /* Serialises the lazy zeroing of the entry table */
+	struct mutex entry_lock; /* Serialises the read-modify-writes of the entries */
+#ifdef __KERNEL__
+	struct delayed_work lazy_init_work; /* Zeroes the entry table in background */
+	struct dentry *debugfs_dir; /* Of this mount, w/ its stats */
+	struct dax_device *dax_dev; /* Mounted w/ -o dax: file data accessed directly in device memory */
 #endif
+} dfs_info_t;
 
 #endif
@@ -0,0 +1,721 @@
+/* DDK File System over FUSE, for mounting ddkfs images w/o ddkfs.ko */
+#define FUSE_USE_VERSION 26
+
+#include <fuse.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+#include "ddk_fs_ds.h"
+#include "ddk_fs_ops.h"
+#include "ddk_fs_io.h"
+
+#define DFS_FUSE_MAX_IO (128 * 1024) /* Largest read / write request asked for */
+
+/*
+ * In-memory index of the whole entry table, so that no metadata operation
+ * has to scan the table on the image. Entries are hashed on their names,
+ * w/ chaining through the next[] array. All entry changes are written
+ * through to the image immediately. The data of a file is copied in & out
+ * under just its own lock, w/ the index lock held only around the entry
+ * accesses; taken in that order
+ */
+static struct dfs_index
+{
+	dfs_info_t info;
+	dfs_file_entry_t *entries;
+	int *head; /* Hash bucket heads; -1 for empty */
+	int *next; /* Chain links, indexed by the DDK FS inode number */
+	unsigned int bucket_cnt; /* Power of 2 */
+	int *open_cnt; /* Per entry: its open handles, w/ an unlinked one freed on the last release */
+	pthread_rwlock_t lock; /* Protects all of the above */
+	pthread_rwlock_t *file_lock; /* Per entry: its blocks' data, & them not going away */
+} idx;
+
+static unsigned int name_hash(const char *fn)
+{
+	unsigned int h = 2166136261U; /* FNV-1a */
+	int i;
+
+	for (i = 0; (i < DDK_FS_FILENAME_LEN) && fn[i]; i++)
+	{
+		h = (h ^ (unsigned char)(fn[i])) * 16777619U;
+	}
+	return h & (idx.bucket_cnt - 1);
+}
+static void index_add(int ino)
+{
+	unsigned int b = name_hash(idx.entries[ino].name);
+
+	idx.next[ino] = idx.head[b];
+	idx.head[b] = ino;
+}
+static void index_del(int ino)
+{
+	int *p = &idx.head[name_hash(idx.entries[ino].name)];
+
+	while (*p != -1)
+	{
+		if (*p == ino)
+		{
+			*p = idx.next[ino];
+			return;
+		}
+		p = &idx.next[*p];
+	}
+}
+static int index_find(const char *fn)
+{
+	int ino;
+
+	for (ino = idx.head[name_hash(fn)]; ino != -1; ino = idx.next[ino])
+	{
+		if (strncmp(idx.entries[ino].name, fn, DDK_FS_FILENAME_LEN) == 0)
+			return ino;
+	}
+	return -1;
+}
+static int index_init(void)
+{
+	dfs_super_block_t *sb = &idx.info.sb;
+	byte4_t ino;
+	int retval;
+
+	idx.entries = malloc(sb->entry_count * sizeof(dfs_file_entry_t));
+	idx.next = malloc(sb->entry_count * sizeof(int));
+	for (idx.bucket_cnt = 1; idx.bucket_cnt < sb->entry_count; idx.bucket_cnt <<= 1);
+	idx.head = malloc(idx.bucket_cnt * sizeof(int));
+	idx.file_lock = malloc(sb->entry_count * sizeof(pthread_rwlock_t));
+	idx.open_cnt = calloc(sb->entry_count, sizeof(int));
+	if (!idx.entries || !idx.next || !idx.head || !idx.file_lock || !idx.open_cnt)
+	{
+		return -ENOMEM;
+	}
+	for (ino = 0; ino < sb->entry_count; ino++)
+	{
+		if (pthread_rwlock_init(&idx.file_lock[ino], NULL))
+			return -ENOMEM;
+	}
+	memset(idx.head, 0xFF, idx.bucket_cnt * sizeof(int));
+	/* The whole entry table in one go */
+	if ((retval = dfs_uio_read_run(&idx.info, sb->entry_table_block_start, 0, idx.entries,
+		sb->entry_count * sizeof(dfs_file_entry_t))) < 0)
+	{
+		return retval;
+	}
+	/* Not yet zeroed part of a lazily initialised table has no entries */
+	if ((sb->flags & DDK_FS_FLAG_LAZY_INIT) &&
+		(sb->entry_table_init_size * (sb->block_size / sb->entry_size) < sb->entry_count))
+	{
+		ino = sb->entry_table_init_size * (sb->block_size / sb->entry_size);
+		memset(&idx.entries[ino], 0, (sb->entry_count - ino) * sizeof(dfs_file_entry_t));
+	}
+	for (ino = 0; ino < sb->entry_count; ino++)
+	{
+		if (idx.entries[ino].name[0])
+			index_add(ino);
+	}
+	return pthread_rwlock_init(&idx.lock, NULL) ? -ENOMEM : 0;
+}
+static int entry_sync(int ino)
+{
+	return dfs_write_file_entry(&idx.info, S2V_INODE_NUM(ino), &idx.entries[ino]);
+}
+
+/* Returns the DDK FS inode number of the path or a -ve error */
+static int path_to_ino(const char *path)
+{
+	int ino;
+
+	if (*path++ != '/')
+		return -ENOENT;
+	if (strchr(path, '/'))
+		return -ENOENT;
+	if (strlen(path) > DDK_FS_FILENAME_LEN)
+		return -ENAMETOOLONG;
+	return ((ino = index_find(path)) == -1) ? -ENOENT : ino;
+}
+/*
+ * Write locks the file of the path, & then the index. Returns its DDK FS
+ * inode number, w/ both locked; or a -ve error, w/ neither
+ */
+static int path_lock(const char *path)
+{
+	int ino;
+
+	for (;;)
+	{
+		pthread_rwlock_rdlock(&idx.lock);
+		ino = path_to_ino(path);
+		pthread_rwlock_unlock(&idx.lock);
+		if (ino < 0)
+			return ino;
+		pthread_rwlock_wrlock(&idx.file_lock[ino]);
+		pthread_rwlock_wrlock(&idx.lock);
+		if (path_to_ino(path) == ino)
+			return ino;
+		/* Renamed or removed in between */
+		pthread_rwlock_unlock(&idx.lock);
+		pthread_rwlock_unlock(&idx.file_lock[ino]);
+	}
+}
+static void path_unlock(int ino)
+{
+	pthread_rwlock_unlock(&idx.lock);
+	pthread_rwlock_unlock(&idx.file_lock[ino]);
+}
+static mode_t perms_to_mode(byte4_t perms)
+{
+	mode_t mode = 0;
+
+	mode |= ((perms & 4) ? S_IRUSR | S_IRGRP | S_IROTH : 0);
+	mode |= ((perms & 2) ? S_IWUSR | S_IWGRP | S_IWOTH : 0);
+	mode |= ((perms & 1) ? S_IXUSR | S_IXGRP | S_IXOTH : 0);
+	return mode;
+}
+static byte4_t mode_to_perms(mode_t mode)
+{
+	byte4_t perms = 0;
+
+	perms |= (mode & (S_IRUSR | S_IRGRP | S_IROTH)) ? 4 : 0;
+	perms |= (mode & (S_IWUSR | S_IWGRP | S_IWOTH)) ? 2 : 0;
+	perms |= (mode & (S_IXUSR | S_IXGRP | S_IXOTH)) ? 1 : 0;
+	return perms;
+}
+static void fill_stat(int ino, struct stat *st)
+{
+	dfs_file_entry_t *fe = &idx.entries[ino];
+
+	memset(st, 0, sizeof(struct stat));
+	st->st_ino = S2V_INODE_NUM(ino);
+	st->st_mode = S_IFREG | perms_to_mode(fe->perms);
+	st->st_nlink = fe->name[0] ? 1 : 0; // Unlinked, but still open
+	st->st_uid = getuid();
+	st->st_gid = getgid();
+	st->st_size = fe->size;
+	st->st_blksize = idx.info.sb.block_size;
+	st->st_blocks = (fe->size + 511) / 512;
+	st->st_atime = st->st_mtime = st->st_ctime = fe->timestamp;
+}
+/* Frees the blocks beyond size & sets the size; with the file & the index write locked */
+static int entry_truncate(int ino, off_t size)
+{
+	dfs_file_entry_t *fe = &idx.entries[ino];
+	byte4_t block_size = idx.info.sb.block_size;
+	int i;
+
+	if (size > DDK_FS_DATA_BLOCK_CNT * block_size)
+		return -EFBIG;
+	for (i = (size + block_size - 1) / block_size; i < DDK_FS_DATA_BLOCK_CNT; i++)
+	{
+		if (fe->blocks[i])
+		{
+			dfs_put_data_block(&idx.info, fe->blocks[i]);
+			fe->blocks[i] = 0;
+		}
+	}
+	fe->size = size;
+	fe->timestamp = time(NULL);
+	return entry_sync(ino);
+}
+
+static int dfs_fuse_getattr(const char *path, struct stat *st)
+{
+	int ino;
+
+	if (strcmp(path, "/") == 0)
+	{
+		memset(st, 0, sizeof(struct stat));
+		st->st_ino = ROOT_INODE_NUM;
+		st->st_mode = S_IFDIR | S_IRWXU | S_IRWXG | S_IRWXO;
+		st->st_nlink = 2;
+		st->st_uid = getuid();
+		st->st_gid = getgid();
+		return 0;
+	}
+	pthread_rwlock_rdlock(&idx.lock);
+	if ((ino = path_to_ino(path)) >= 0)
+		fill_stat(ino, st);
+	pthread_rwlock_unlock(&idx.lock);
+	return (ino < 0) ? ino : 0;
+}
+/* Through the handle, as for an unlinked, but open file */
+static int dfs_fuse_fgetattr(const char *path, struct stat *st, struct fuse_file_info *fi)
+{
+	pthread_rwlock_rdlock(&idx.lock);
+	fill_stat(fi->fh, st);
+	pthread_rwlock_unlock(&idx.lock);
+	return 0;
+}
+static int dfs_fuse_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t off,
+	struct fuse_file_info *fi)
+{
+	char fn[DDK_FS_FILENAME_LEN + 1];
+	struct stat st;
+	byte4_t ino;
+
+	if (strcmp(path, "/") != 0)
+		return -ENOTDIR;
+	/* Offsets: 1 for ., 2 for .., & the inode number + 3 for an entry; so a later call resumes after off */
+	if ((off < 1) && filler(buf, ".", NULL, 1))
+		return 0;
+	if ((off < 2) && filler(buf, "..", NULL, 2))
+		return 0;
+	pthread_rwlock_rdlock(&idx.lock);
+	for (ino = (off > 2) ? off - 2 : 0; ino < idx.info.sb.entry_count; ino++)
+	{
+		if (!idx.entries[ino].name[0])
+			continue;
+		memcpy(fn, idx.entries[ino].name, DDK_FS_FILENAME_LEN);
+		fn[DDK_FS_FILENAME_LEN] = 0;
+		fill_stat(ino, &st);
+		if (filler(buf, fn, &st, ino + 3))
+			break;
+	}
+	pthread_rwlock_unlock(&idx.lock);
+	return 0;
+}
+static int dfs_fuse_open(const char *path, struct fuse_file_info *fi)
+{
+	int ino;
+
+	if (fi->flags & O_TRUNC)
+	{
+		if ((ino = path_lock(path)) < 0)
+			return ino;
+		if (entry_truncate(ino, 0) < 0)
+		{
+			path_unlock(ino);
+			return -EIO;
+		}
+		idx.open_cnt[ino]++;
+		path_unlock(ino);
+	}
+	else
+	{
+		pthread_rwlock_wrlock(&idx.lock);
+		if ((ino = path_to_ino(path)) >= 0)
+			idx.open_cnt[ino]++;
+		pthread_rwlock_unlock(&idx.lock);
+		if (ino < 0)
+			return ino;
+	}
+	fi->fh = ino;
+	return 0;
+}
+static int dfs_fuse_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+	dfs_file_entry_t *fe;
+	byte4_t ino;
+	int retval;
+
+	if (strchr(path + 1, '/'))
+		return -ENOENT;
+	if (strlen(path + 1) > DDK_FS_FILENAME_LEN)
+		return -ENAMETOOLONG;
+	pthread_rwlock_wrlock(&idx.lock);
+	if ((retval = path_to_ino(path)) >= 0)
+	{
+		pthread_rwlock_unlock(&idx.lock);
+		return -EEXIST;
+	}
+	/* Not an unlinked one still open, as its handles still refer to it */
+	for (ino = 0; ino < idx.info.sb.entry_count; ino++)
+	{
+		if (!idx.entries[ino].name[0] && !idx.info.orphans[ino])
+			break;
+	}
+	if (ino == idx.info.sb.entry_count)
+	{
+		pthread_rwlock_unlock(&idx.lock);
+		return -ENOSPC;
+	}
+	fe = &idx.entries[ino];
+	memset(fe, 0, sizeof(dfs_file_entry_t));
+	strncpy(fe->name, path + 1, DDK_FS_FILENAME_LEN);
+	fe->timestamp = time(NULL);
+	fe->perms = mode_to_perms(mode);
+	if ((retval = entry_sync(ino)) < 0)
+	{
+		memset(fe, 0, sizeof(dfs_file_entry_t));
+		pthread_rwlock_unlock(&idx.lock);
+		return retval;
+	}
+	index_add(ino);
+	idx.open_cnt[ino]++;
+	spin_lock(&idx.info.lock);
+	idx.info.free_entry_count--;
+	spin_unlock(&idx.info.lock);
+	pthread_rwlock_unlock(&idx.lock);
+	fi->fh = ino;
+	return 0;
+}
+static int dfs_fuse_read(const char *path, char *buf, size_t size, off_t off, struct fuse_file_info *fi)
+{
+	int ino = fi->fh;
+	dfs_file_entry_t *fe = &idx.entries[ino];
+	byte4_t block_size = idx.info.sb.block_size;
+	byte4_t blocks[DDK_FS_DATA_BLOCK_CNT];
+	byte4_t fsize;
+	byte4_t bi, boff, len, run;
+	size_t done;
+	int retval = 0;
+
+	pthread_rwlock_rdlock(&idx.file_lock[ino]);
+	pthread_rwlock_rdlock(&idx.lock);
+	fsize = fe->size;
+	memcpy(blocks, fe->blocks, sizeof(blocks));
+	pthread_rwlock_unlock(&idx.lock);
+	if (off >= fsize)
+	{
+		pthread_rwlock_unlock(&idx.file_lock[ino]);
+		return 0;
+	}
+	if (off + size > fsize)
+		size = fsize - off;
+	/* Coalesce the physically consecutive blocks into one transfer */
+	for (done = 0; (done < size) && (retval == 0); done += len)
+	{
+		bi = (off + done) / block_size;
+		boff = (off + done) % block_size;
+		len = block_size - boff;
+		for (run = 1; (bi + run < DDK_FS_DATA_BLOCK_CNT) && blocks[bi] &&
+			(blocks[bi + run] == blocks[bi] + run); run++)
+			len += block_size;
+		if (len > size - done)
+			len = size - done;
+		if (blocks[bi])
+			retval = dfs_uio_read_run(&idx.info, blocks[bi], boff, buf + done, len);
+		else /* Hole */
+		{
+			len = block_size - boff < size - done ? block_size - boff : size - done;
+			memset(buf + done, 0, len);
+		}
+	}
+	pthread_rwlock_unlock(&idx.file_lock[ino]);
+	return (retval < 0) ? retval : size;
+}
+static int dfs_fuse_write(const char *path, const char *buf, size_t size, off_t off,
+	struct fuse_file_info *fi)
+{
+	static const byte1_t zeroes[DDK_FS_BLOCK_SIZE];
+	int ino = fi->fh;
+	dfs_file_entry_t *fe = &idx.entries[ino];
+	byte4_t block_size = idx.info.sb.block_size;
+	byte4_t blocks[DDK_FS_DATA_BLOCK_CNT];
+	int fresh[DDK_FS_DATA_BLOCK_CNT] = { 0 }; /* Allocated by this write */
+	byte4_t bi, boff, len, run;
+	int block;
+	size_t done;
+	int retval = 0;
+
+	if (off + size > DDK_FS_DATA_BLOCK_CNT * block_size)
+		return -EFBIG;
+	if (size == 0)
+		return 0;
+	pthread_rwlock_wrlock(&idx.file_lock[ino]);
+	/* Allocate any missing blocks first, under the index lock just for that */
+	pthread_rwlock_wrlock(&idx.lock);
+	for (bi = off / block_size; bi <= (off + size - 1) / block_size; bi++)
+	{
+		if (fe->blocks[bi])
+			continue;
+		if ((block = dfs_get_data_block(&idx.info)) == INV_BLOCK)
+		{
+			/* A short write, up to the blocks there are; if any */
+			if (bi * block_size <= off)
+				retval = -ENOSPC;
+			else
+				size = bi * block_size - off;
+			break;
+		}
+		fe->blocks[bi] = block;
+		fresh[bi] = 1;
+	}
+	memcpy(blocks, fe->blocks, sizeof(blocks));
+	pthread_rwlock_unlock(&idx.lock);
+
+	/* Zero the fresh ones partially written */
+	for (bi = off / block_size; (retval == 0) && (bi <= (off + size - 1) / block_size); bi++)
+	{
+		if (fresh[bi] && ((bi * block_size < off) || ((bi + 1) * block_size > off + size)))
+			retval = dfs_uio_write_run(&idx.info, blocks[bi], 0, zeroes, block_size);
+	}
+	for (done = 0; (done < size) && (retval == 0); done += len)
+	{
+		bi = (off + done) / block_size;
+		boff = (off + done) % block_size;
+		len = block_size - boff;
+		for (run = 1; (bi + run < DDK_FS_DATA_BLOCK_CNT) &&
+			(blocks[bi + run] == blocks[bi] + run); run++)
+			len += block_size;
+		if (len > size - done)
+			len = size - done;
+		retval = dfs_uio_write_run(&idx.info, blocks[bi], boff, buf + done, len);
+	}
+
+	pthread_rwlock_wrlock(&idx.lock);
+	if (retval == 0)
+	{
+		if (off + size > fe->size)
+			fe->size = off + size;
+		fe->timestamp = time(NULL);
+	}
+	else
+	{
+		/* Back to holes, rather than blocks w/ part of the data, or beyond the size */
+		for (bi = 0; bi < DDK_FS_DATA_BLOCK_CNT; bi++)
+		{
+			if (fresh[bi])
+			{
+				dfs_put_data_block(&idx.info, fe->blocks[bi]);
+				fe->blocks[bi] = 0;
+			}
+		}
+	}
+	if (entry_sync(ino) < 0 && retval == 0)
+		retval = -EIO;
+	pthread_rwlock_unlock(&idx.lock);
+	pthread_rwlock_unlock(&idx.file_lock[ino]);
+	return (retval < 0) ? retval : size;
+}
+static int dfs_fuse_truncate(const char *path, off_t size)
+{
+	int ino;
+	int retval;
+
+	if ((ino = path_lock(path)) < 0)
+		return ino;
+	retval = entry_truncate(ino, size);
+	path_unlock(ino);
+	return retval;
+}
+static int dfs_fuse_ftruncate(const char *path, off_t size, struct fuse_file_info *fi)
+{
+	int retval;
+
+	pthread_rwlock_wrlock(&idx.file_lock[fi->fh]);
+	pthread_rwlock_wrlock(&idx.lock);
+	retval = entry_truncate(fi->fh, size);
+	path_unlock(fi->fh);
+	return retval;
+}
+/* Frees the entry & its blocks; w/ the file & the index write locked */
+static int free_entry(int ino)
+{
+	int retval;
+
+	entry_truncate(ino, 0);
+	memset(&idx.entries[ino], 0, sizeof(dfs_file_entry_t));
+	if ((retval = entry_sync(ino)) < 0)
+		return retval;
+	spin_lock(&idx.info.lock);
+	idx.info.free_entry_count++;
+	spin_unlock(&idx.info.lock);
+	return 0;
+}
+/*
+ * W/ the file & the index write locked. An open one just loses its name,
+ * w/ the entry & its blocks left to its last release (as mounted w/
+ * hard_remove); a nameless entry is a free one for the next mount, anyway
+ */
+static int remove_entry(int ino)
+{
+	index_del(ino);
+	if (!idx.open_cnt[ino])
+		return free_entry(ino);
+	idx.info.orphans[ino] = 1;
+	memset(idx.entries[ino].name, 0, sizeof(idx.entries[ino].name));
+	return entry_sync(ino);
+}
+static int dfs_fuse_release(const char *path, struct fuse_file_info *fi)
+{
+	int ino = fi->fh;
+
+	pthread_rwlock_wrlock(&idx.file_lock[ino]);
+	pthread_rwlock_wrlock(&idx.lock);
+	if (!--idx.open_cnt[ino] && idx.info.orphans[ino])
+	{
+		idx.info.orphans[ino] = 0;
+		free_entry(ino); // Nothing to do, even if it fails; free for the next mount
+	}
+	path_unlock(ino);
+	return 0;
+}
+static int dfs_fuse_unlink(const char *path)
+{
+	int ino;
+	int retval;
+
+	if ((ino = path_lock(path)) < 0)
+		return ino;
+	retval = remove_entry(ino);
+	path_unlock(ino);
+	return retval;
+}
+static int dfs_fuse_rename(const char *from, const char *to)
+{
+	int src, dst;
+	int retval;
+
+	if (strchr(to + 1, '/'))
+		return -EINVAL;
+	if (strlen(to + 1) > DDK_FS_FILENAME_LEN)
+		return -ENAMETOOLONG;
+	/* The file replaced, if any, locked as to be removed; else, just the index */
+	for (;;)
+	{
+		if ((dst = path_lock(to)) >= 0)
+			break;
+		if (dst != -ENOENT)
+			return dst;
+		pthread_rwlock_wrlock(&idx.lock);
+		if (path_to_ino(to) == -ENOENT)
+			break;
+		pthread_rwlock_unlock(&idx.lock); // Created in between
+	}
+	if ((src = path_to_ino(from)) < 0)
+	{
+		retval = src;
+		goto out;
+	}
+	/* Renaming over an existing file replaces it */
+	if ((dst >= 0) && (dst != src) && ((retval = remove_entry(dst)) < 0))
+		goto out;
+	index_del(src);
+	strncpy(idx.entries[src].name, to + 1, DDK_FS_FILENAME_LEN);
+	index_add(src);
+	retval = entry_sync(src);
+out:
+	if (dst >= 0)
+		path_unlock(dst);
+	else
+		pthread_rwlock_unlock(&idx.lock);
+	return retval;
+}
+static int dfs_fuse_chmod(const char *path, mode_t mode)
+{
+	int ino;
+
+	pthread_rwlock_wrlock(&idx.lock);
+	if ((ino = path_to_ino(path)) >= 0)
+	{
+		idx.entries[ino].perms = mode_to_perms(mode);
+		ino = entry_sync(ino);
+	}
+	pthread_rwlock_unlock(&idx.lock);
+	return (ino < 0) ? ino : 0;
+}
+static int dfs_fuse_utimens(const char *path, const struct timespec tv[2])
+{
+	int ino;
+
+	pthread_rwlock_wrlock(&idx.lock);
+	if ((ino = path_to_ino(path)) >= 0)
+	{
+		idx.entries[ino].timestamp = tv ? tv[1].tv_sec : time(NULL);
+		ino = entry_sync(ino);
+	}
+	pthread_rwlock_unlock(&idx.lock);
+	return (ino < 0) ? ino : 0;
+}
+static int dfs_fuse_statfs(const char *path, struct statvfs *buf)
+{
+	memset(buf, 0, sizeof(struct statvfs));
+	buf->f_bsize = buf->f_frsize = idx.info.sb.block_size;
+	buf->f_blocks = idx.info.sb.partition_size;
+	buf->f_bfree = buf->f_bavail = idx.info.free_block_count;
+	buf->f_files = idx.info.sb.entry_count;
+	buf->f_ffree = buf->f_favail = idx.info.free_entry_count;
+	buf->f_namemax = DDK_FS_FILENAME_LEN;
+	return 0;
+}
+static int dfs_fuse_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	return dfs_uio_sync(&idx.info);
+}
+static void *dfs_fuse_init(struct fuse_conn_info *conn)
+{
+	conn->max_write = DFS_FUSE_MAX_IO;
+	conn->max_readahead = DFS_FUSE_MAX_IO;
+	conn->want |= FUSE_CAP_BIG_WRITES;
+	return NULL;
+}
+static void dfs_fuse_destroy(void *private_data)
+{
+	dfs_uio_sync(&idx.info);
+	dfs_shut(&idx.info);
+	dfs_uio_close(&idx.info);
+}
+
+static struct fuse_operations dfs_fuse_ops =
+{
+	.getattr = dfs_fuse_getattr,
+	.fgetattr = dfs_fuse_fgetattr,
+	.readdir = dfs_fuse_readdir,
+	.open = dfs_fuse_open,
+	.create = dfs_fuse_create,
+	.read = dfs_fuse_read,
+	.write = dfs_fuse_write,
+	.release = dfs_fuse_release,
+	.truncate = dfs_fuse_truncate,
+	.ftruncate = dfs_fuse_ftruncate,
+	.unlink = dfs_fuse_unlink,
+	.rename = dfs_fuse_rename,
+	.chmod = dfs_fuse_chmod,
+	.utimens = dfs_fuse_utimens,
+	.statfs = dfs_fuse_statfs,
+	.fsync = dfs_fuse_fsync,
+	.init = dfs_fuse_init,
+	.destroy = dfs_fuse_destroy,
+};
+
+int main(int argc, char *argv[])
+{
+	struct fuse_args args;
+	int retval;
+
+	if (argc < 3)
+	{
+		fprintf(stderr, "Usage: %s <ddkfs image or device> <mount point> [fuse options]\n", argv[0]);
+		return 1;
+	}
+	if ((retval = dfs_uio_open(&idx.info, argv[1], DFS_UIO_MMAP)) < 0)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", argv[1], strerror(-retval));
+		return 2;
+	}
+	if ((retval = dfs_init(&idx.info)) < 0)
+	{
+		fprintf(stderr, "Error loading DDK FS from %s: %s\n", argv[1], strerror(-retval));
+		dfs_uio_close(&idx.info);
+		return 3;
+	}
+	if ((retval = index_init()) < 0)
+	{
+		fprintf(stderr, "Error indexing the entries of %s: %s\n", argv[1], strerror(-retval));
+		dfs_shut(&idx.info);
+		dfs_uio_close(&idx.info);
+		return 3;
+	}
+
+	/*
+	 * Image is consumed; rest goes to FUSE. Not passing -s keeps FUSE in its
+	 * multithreaded loop, and large requests are passed through as is. W/
+	 * hard_remove, an unlinked open file isn't renamed to a hidden name (too
+	 * long for an entry), but is freed here on its last release
+	 */
+	argv[1] = argv[0];
+	args = (struct fuse_args)FUSE_ARGS_INIT(argc - 1, argv + 1);
+	fuse_opt_add_arg(&args, "-ouse_ino,hard_remove,big_writes,max_read=131072,max_write=131072,fsname=ddkfs");
+	retval = fuse_main(args.argc, args.argv, &dfs_fuse_ops, NULL);
+	fuse_opt_free_args(&args);
+	return retval;
+}
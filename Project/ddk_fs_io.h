@@ -0,0 +1,30 @@
+#ifndef DDK_FS_IO_H
+#define DDK_FS_IO_H
+
+#include "ddk_fs_ds.h"
+
+/*
+ * Block I/O shim underneath the DDK FS engine. Implemented over the buffer
+ * cache in kernel (ddk_fs_kio.c) & over an image file or device in user
+ * space (ddk_fs_uio.c).
+ * block & offset are in terms of the DDK FS blocks, and the (offset, len)
+ * pair must not cross a block boundary.
+ */
+int dfs_io_read(dfs_info_t *info, byte4_t block, byte4_t offset, void *buf, byte4_t len);
+int dfs_io_write(dfs_info_t *info, byte4_t block, byte4_t offset, void *buf, byte4_t len);
+/* Zeroes count whole blocks, w/o reading them in */
+int dfs_io_zero(dfs_info_t *info, byte4_t block, byte4_t count);
+
+#ifndef __KERNEL__
+#define DFS_UIO_RDONLY (1 << 0) /* Open the image read only */
+#define DFS_UIO_MMAP (1 << 1) /* Access the image through a shared mapping */
+
+int dfs_uio_open(dfs_info_t *info, const char *path, int flags);
+/* Like dfs_io_*, but len may span across the consecutive blocks */
+int dfs_uio_read_run(dfs_info_t *info, byte4_t block, byte4_t offset, void *buf, byte4_t len);
+int dfs_uio_write_run(dfs_info_t *info, byte4_t block, byte4_t offset, const void *buf, byte4_t len);
+int dfs_uio_sync(dfs_info_t *info);
+void dfs_uio_close(dfs_info_t *info);
+#endif
+
+#endif
@@ -0,0 +1,96 @@
+#include <linux/kernel.h> /* For min_t */
+#include <linux/fs.h> /* For struct super_block */
+#include <linux/errno.h> /* For error codes */
+#include <linux/buffer_head.h> /* struct buffer_head, sb_bread, ... */
+#include <linux/string.h> /* For memcpy */
+#include <asm/div64.h> /* For do_div */
+
+#include "ddk_fs_ds.h"
+#include "ddk_fs_io.h"
+
+int dfs_io_read(dfs_info_t *info, byte4_t block, byte4_t offset, void *buf, byte4_t len)
+{
+	byte4_t block_size = info->sb.block_size;
+	byte4_t bd_block_size = info->vfs_sb->s_bdev->bd_block_size;
+	byte4_t abs;
+	struct buffer_head *bh;
+
+	// Translating the DDK FS block numbering to underlying block device block numbering, for sb_bread()
+	abs = block * block_size + offset;
+	block = abs / bd_block_size;
+	offset = abs % bd_block_size;
+	if (offset + len > bd_block_size) // Should never happen
+	{
+		return -EINVAL;
+	}
+	if (!(bh = sb_bread(info->vfs_sb, block)))
+	{
+		return -EIO;
+	}
+	memcpy(buf, bh->b_data + offset, len);
+	brelse(bh);
+	return 0;
+}
+int dfs_io_write(dfs_info_t *info, byte4_t block, byte4_t offset, void *buf, byte4_t len)
+{
+	byte4_t block_size = info->sb.block_size;
+	byte4_t bd_block_size = info->vfs_sb->s_bdev->bd_block_size;
+	byte4_t abs;
+	struct buffer_head *bh;
+
+	// Translating the DDK FS block numbering to underlying block device block numbering, for sb_bread()
+	abs = block * block_size + offset;
+	block = abs / bd_block_size;
+	offset = abs % bd_block_size;
+	if (offset + len > bd_block_size) // Should never happen
+	{
+		return -EINVAL;
+	}
+	if (!(bh = sb_bread(info->vfs_sb, block)))
+	{
+		return -EIO;
+	}
+	memcpy(bh->b_data + offset, buf, len);
+	mark_buffer_dirty(bh);
+	brelse(bh);
+	return 0;
+}
+int dfs_io_zero(dfs_info_t *info, byte4_t block, byte4_t count)
+{
+	byte4_t block_size = info->sb.block_size;
+	byte4_t bd_block_size = info->vfs_sb->s_bdev->bd_block_size;
+	u64 abs, end;
+	byte4_t offset, len;
+	struct buffer_head *bh;
+
+	abs = (u64)block * block_size;
+	end = abs + (u64)count * block_size;
+	while (abs < end)
+	{
+		offset = do_div(abs, bd_block_size); // abs is now the underlying block number
+		len = min_t(u64, bd_block_size - offset, end - (abs * bd_block_size + offset));
+		if (len == bd_block_size) // Being overwritten whole, so no need to read it in
+		{
+			if (!(bh = sb_getblk(info->vfs_sb, abs)))
+			{
+				return -EIO;
+			}
+			lock_buffer(bh);
+			memset(bh->b_data, 0, len);
+			set_buffer_uptodate(bh);
+			unlock_buffer(bh);
+		}
+		else
+		{
+			if (!(bh = sb_bread(info->vfs_sb, abs)))
+			{
+				return -EIO;
+			}
+			memset(bh->b_data + offset, 0, len);
+		}
+		mark_buffer_dirty(bh);
+		brelse(bh);
+		abs = abs * bd_block_size + offset + len;
+	}
+	return 0;
+}
@@ -1,82 +1,94 @@
+#ifdef __KERNEL__
 #include <linux/fs.h> /* For struct super_block */
 #include <linux/errno.h> /* For error codes */
-#include <linux/buffer_head.h> /* struct buffer_head, sb_bread, ... */
 #include <linux/slab.h> /* For kzalloc, ... */
 #include <linux/string.h> /* For memcpy */
 #include <linux/vmalloc.h> /* For vmalloc, ... */
 #include <linux/time.h> /* For get_seconds, ... */
+#include <linux/percpu.h> /* For alloc_percpu, this_cpu_add, ... */
+#else
+#include "ddk_fs_compat.h" /* For the kernel look-alikes in user space */
+#endif
 
 #include "ddk_fs_ds.h"
 #include "ddk_fs_ops.h"
+#include "ddk_fs_io.h"
 
 static int read_sb_from_ddk_fs(dfs_info_t *info, dfs_super_block_t *sb)
 {
-	struct buffer_head *bh;
-
-	if (!(bh = sb_bread(info->vfs_sb, 0 /* Super block is the 0th block */)))
-	{
-		return -EIO;
-	}
-	memcpy(sb, bh->b_data, DDK_FS_BLOCK_SIZE);
-	brelse(bh);
-	return 0;
+	/* Super block is the 0th block */
+	return dfs_io_read(info, 0, 0, sb, DDK_FS_BLOCK_SIZE);
+}
+static int write_sb_to_ddk_fs(dfs_info_t *info, dfs_super_block_t *sb)
+{
+	return dfs_io_write(info, 0, 0, sb, DDK_FS_BLOCK_SIZE);
 }
 static int read_from_ddk_fs(dfs_info_t *info, byte4_t block, byte4_t offset, void *buf, byte4_t len)
 {
-	byte4_t block_size = info->sb.block_size;
-	byte4_t bd_block_size = info->vfs_sb->s_bdev->bd_block_size;
-	byte4_t abs;
-	struct buffer_head *bh;
-
-	// Translating the DDK FS block numbering to underlying block device block numbering, for sb_bread()
-	abs = block * block_size + offset;
-	block = abs / bd_block_size;
-	offset = abs % bd_block_size;
-	if (offset + len > bd_block_size) // Should never happen
-	{
-		return -EINVAL;
-	}
-	if (!(bh = sb_bread(info->vfs_sb, block)))
-	{
-		return -EIO;
-	}
-	memcpy(buf, bh->b_data + offset, len);
-	brelse(bh);
-	return 0;
+	return dfs_io_read(info, block, offset, buf, len);
 }
 static int write_to_ddk_fs(dfs_info_t *info, byte4_t block, byte4_t offset, void *buf, byte4_t len)
 {
-	byte4_t block_size = info->sb.block_size;
-	byte4_t bd_block_size = info->vfs_sb->s_bdev->bd_block_size;
-	byte4_t abs;
-	struct buffer_head *bh;
+	return dfs_io_write(info, block, offset, buf, len);
+}
+/*
+ * With DDK_FS_FLAG_LAZY_INIT, entry table blocks from entry_table_init_size
+ * onwards are yet to be zeroed, and so hold no valid entries
+ */
+static int entry_block_inited(dfs_info_t *info, byte4_t block)
+{
+	return !(info->sb.flags & DDK_FS_FLAG_LAZY_INIT) || (block < info->sb.entry_table_init_size);
+}
+/* Zeroes the entry table till (excluding) block upto; w/ init_lock held */
+static int init_entry_table_till(dfs_info_t *info, byte4_t upto)
+{
+	int retval;
 
-	// Translating the DDK FS block numbering to underlying block device block numbering, for sb_bread()
-	abs = block * block_size + offset;
-	block = abs / bd_block_size;
-	offset = abs % bd_block_size;
-	if (offset + len > bd_block_size) // Should never happen
+	if (upto > info->sb.entry_table_size)
+		upto = info->sb.entry_table_size;
+	if (upto <= info->sb.entry_table_init_size)
+		return 0;
+	if ((retval = dfs_io_zero(info, info->sb.entry_table_block_start + info->sb.entry_table_init_size,
+		upto - info->sb.entry_table_init_size)) < 0)
 	{
-		return -EINVAL;
+		return retval;
 	}
-	if (!(bh = sb_bread(info->vfs_sb, block)))
+	info->sb.entry_table_init_size = upto;
+	if (upto == info->sb.entry_table_size)
 	{
-		return -EIO;
+		info->sb.flags &= ~DDK_FS_FLAG_LAZY_INIT;
 	}
-	memcpy(bh->b_data + offset, buf, len);
-	mark_buffer_dirty(bh);
-	brelse(bh);
-	return 0;
+	return write_sb_to_ddk_fs(info, &info->sb);
 }
 static int read_entry_from_ddk_fs(dfs_info_t *info, int ino, dfs_file_entry_t *fe)
 {
-	return 0;
-	//return read_from_ddk_fs(info, /* TODO: Populate all the other parameters */ );
+	byte4_t abs = ino * info->sb.entry_size;
+
+	if (!entry_block_inited(info, abs / info->sb.block_size))
+	{
+		memset(fe, 0, sizeof(dfs_file_entry_t));
+		return 0;
+	}
+	this_cpu_inc(info->stats->entry_reads);
+	return read_from_ddk_fs(info, info->sb.entry_table_block_start + abs / info->sb.block_size,
+		abs % info->sb.block_size, fe, sizeof(dfs_file_entry_t));
 }
 static int write_entry_to_ddk_fs(dfs_info_t *info, int ino, dfs_file_entry_t *fe)
 {
-	return 0;
-	//return write_to_ddk_fs(info,  /* TODO: Populate all the other parameters */ );
+	byte4_t abs = ino * info->sb.entry_size;
+	int retval;
+
+	if (!entry_block_inited(info, abs / info->sb.block_size))
+	{
+		/* Background zeroing not there yet; so do it till here, right away */
+		mutex_lock(&info->init_lock);
+		retval = init_entry_table_till(info, abs / info->sb.block_size + 1);
+		mutex_unlock(&info->init_lock);
+		if (retval < 0)
+			return retval;
+	}
+	return write_to_ddk_fs(info, info->sb.entry_table_block_start + abs / info->sb.block_size,
+		abs % info->sb.block_size, fe, sizeof(dfs_file_entry_t));
 }
 
 int dfs_init(dfs_info_t *info)
@@ -96,11 +108,27 @@ int dfs_init(dfs_info_t *info)
 		printk(KERN_ERR "Invalid DDK FS detected. Giving up.\n");
 		return -EINVAL;
 	}
+	if ((info->sb.flags & DDK_FS_FLAG_LAZY_INIT) && (info->sb.entry_table_init_size > info->sb.entry_table_size))
+	{
+		printk(KERN_ERR "Invalid DDK FS entry table initialisation. Giving up.\n");
+		return -EINVAL;
+	}
+	if (info->sb.data_block_start > info->sb.partition_size)
+	{
+		printk(KERN_ERR "Invalid DDK FS data block start. Giving up.\n");
+		return -EINVAL;
+	}
+
+	if (!(info->stats = alloc_percpu(dfs_stats_t)))
+	{
+		return -ENOMEM;
+	}
 
 	/* Mark used blocks */
 	used_blocks = (byte1_t *)(vmalloc(info->sb.partition_size));
 	if (!used_blocks)
 	{
+		free_percpu(info->stats);
 		return -ENOMEM;
 	}
 	free_block_count = 0;
@@ -115,38 +143,103 @@ int dfs_init(dfs_info_t *info)
 		free_block_count++;
 	}
 
-	/* TODO: Uncomment once read_entry_from_ddk_fs is implemented
 	for (i = 0; i < info->sb.entry_count; i++)
 	{
 		if ((retval = read_entry_from_ddk_fs(info, i, &fe)) < 0)
 		{
 			vfree(used_blocks);
+			free_percpu(info->stats);
 			return retval;
 		}
 
-		// TODO: Update the free_entry_count appropriately here
-
+		if (!fe.name[0])
+		{
+			free_entry_count++;
+			continue;
+		}
 
 		for (j = 0; j < DDK_FS_DATA_BLOCK_CNT; j++)
 		{
-			if (fe.blocks[j] == 0) break;
-			used_blocks[fe.blocks[j]] = 1;
-			free_block_count--;
+			if (fe.blocks[j] == 0) continue; /* Hole */
+			if ((fe.blocks[j] < info->sb.data_block_start) || (fe.blocks[j] >= info->sb.partition_size))
+			{
+				printk(KERN_WARNING "Entry %d has invalid block %u. Ignoring it.\n", i, fe.blocks[j]);
+				continue;
+			}
+			if (!used_blocks[fe.blocks[j]])
+			{
+				used_blocks[fe.blocks[j]] = 1;
+				free_block_count--;
+			}
 		}
 	}
-	*/
+
+	if (!(info->orphans = (byte1_t *)(vmalloc(info->sb.entry_count))))
+	{
+		vfree(used_blocks);
+		free_percpu(info->stats);
+		return -ENOMEM;
+	}
+	memset(info->orphans, 0, info->sb.entry_count);
 
 	info->used_blocks = used_blocks;
 	info->free_block_count = free_block_count;
 	info->free_entry_count = free_entry_count;
+#ifdef __KERNEL__
 	info->vfs_sb->s_fs_info = info;
+#endif
 	spin_lock_init(&info->lock);
+	mutex_init(&info->init_lock);
+	mutex_init(&info->entry_lock);
 	return 0;
 }
 void dfs_shut(dfs_info_t *info)
 {
 	if (info->used_blocks)
 		vfree(info->used_blocks);
+	if (info->orphans)
+		vfree(info->orphans);
+	if (info->stats)
+		free_percpu(info->stats);
+}
+void dfs_get_stats(dfs_info_t *info, dfs_stats_t *stats)
+{
+	dfs_stats_t *s;
+	int cpu;
+
+	memset(stats, 0, sizeof(dfs_stats_t));
+	for_each_possible_cpu(cpu)
+	{
+		s = per_cpu_ptr(info->stats, cpu);
+		stats->lookups += s->lookups;
+		stats->entry_reads += s->entry_reads;
+		stats->allocs += s->allocs;
+		stats->alloc_scan_len += s->alloc_scan_len;
+		stats->get_block_calls += s->get_block_calls;
+		stats->bytes_read += s->bytes_read;
+		stats->bytes_written += s->bytes_written;
+	}
+}
+
+int dfs_init_entry_table(dfs_info_t *info, int count)
+{
+	int retval;
+
+	mutex_lock(&info->init_lock);
+	if (info->sb.flags & DDK_FS_FLAG_LAZY_INIT)
+	{
+		retval = init_entry_table_till(info, info->sb.entry_table_init_size + count);
+	}
+	else
+	{
+		retval = 0;
+	}
+	if ((retval == 0) && (info->sb.flags & DDK_FS_FLAG_LAZY_INIT))
+	{
+		retval = info->sb.entry_table_size - info->sb.entry_table_init_size;
+	}
+	mutex_unlock(&info->init_lock);
+	return retval;
 }
 
 int dfs_get_data_block(dfs_info_t *info)
@@ -161,21 +254,27 @@ int dfs_get_data_block(dfs_info_t *info)
 			info->used_blocks[i] = 1;
 			info->free_block_count--;
 			spin_unlock(&info->lock);
+			this_cpu_inc(info->stats->allocs);
+			this_cpu_add(info->stats->alloc_scan_len, i - info->sb.data_block_start + 1);
 			return i;
 		}
 	}
 	spin_unlock(&info->lock);
+	this_cpu_add(info->stats->alloc_scan_len, info->sb.partition_size - info->sb.data_block_start);
 	return INV_BLOCK;
 }
 void dfs_put_data_block(dfs_info_t *info, int i)
 {
+	/* As from an entry, w/ an invalid block ignored by dfs_init */
+	if (((byte4_t)(i) < info->sb.data_block_start) || ((byte4_t)(i) >= info->sb.partition_size))
+		return;
 	spin_lock(&info->lock); // To prevent racing on used_blocks, ... access
 	info->used_blocks[i] = 0;
 	info->free_block_count++;
 	spin_unlock(&info->lock);
 }
 
-int dfs_list(dfs_info_t *info, struct file *file, void *dirent, filldir_t filldir)
+int dfs_list(dfs_info_t *info, loff_t *f_pos, void *dirent, filldir_t filldir)
 {
 	loff_t pos;
 	int ino;
@@ -189,23 +288,32 @@ int dfs_list(dfs_info_t *info, struct file *file, void *dirent, filldir_t filldi
 			return retval;
 		if (!fe.name[0]) continue;
 		pos++; /* Position of this file */
-		if (file->f_pos == pos)
+		if (*f_pos == pos)
 		{
-			retval = filldir(dirent, /* TODO: filename */"", /* TODO: filename length */0, file->f_pos, S2V_INODE_NUM(ino), DT_REG);
-			if (retval)
+			if (filldir(dirent, fe.name, strlen(fe.name), *f_pos, S2V_INODE_NUM(ino), DT_REG))
 			{
-				return retval;
+				return 0; // Full; the rest, in the next call
 			}
-			file->f_pos++;
+			(*f_pos)++;
 		}
 	}
 	return 0;
 }
 int dfs_lookup(dfs_info_t *info, char *fn, dfs_file_entry_t *fe)
 {
-	//int ino;
+	int ino;
 
-	/* TODO: If found, return S2V_INODE_NUM(ino) else INV_INODE */
+	this_cpu_inc(info->stats->lookups);
+	for (ino = 0; ino < info->sb.entry_count; ino++)
+	{
+		if (read_entry_from_ddk_fs(info, ino, fe) < 0)
+			return INV_INODE;
+		/* W/ the terminator, so that a longer name doesn't match on its first DDK_FS_FILENAME_LEN */
+		if (fe->name[0] && (strncmp(fe->name, fn, DDK_FS_FILENAME_LEN + 1) == 0))
+		{
+			return S2V_INODE_NUM(ino);
+		}
+	}
 
 	return INV_INODE;
 }
@@ -214,12 +322,16 @@ int dfs_create(dfs_info_t *info, char *fn, int perms, dfs_file_entry_t *fe)
 {
 	int ino, free_ino, i;
 
+	if (strlen(fn) > DDK_FS_FILENAME_LEN)
+	{
+		return INV_INODE;
+	}
 	free_ino = INV_INODE;
 	for (ino = 0; ino < info->sb.entry_count; ino++)
 	{
 		if (read_entry_from_ddk_fs(info, ino, fe) < 0)
 			return INV_INODE;
-		if (!fe->name[0])
+		if (!fe->name[0] && !info->orphans[ino])
 		{
 			free_ino = ino;
 			break;
@@ -231,10 +343,8 @@ int dfs_create(dfs_info_t *info, char *fn, int perms, dfs_file_entry_t *fe)
 		return INV_INODE;
 	}
 
-	/*
-	 * TODO: Fill up the fe->name with filename fn.
-	 * NB Take care of no buffer overflow.
-	 */
+	strncpy(fe->name, fn, DDK_FS_FILENAME_LEN);
+	fe->name[DDK_FS_FILENAME_LEN] = 0;
 
 	fe->size = 0;
 	fe->timestamp = get_seconds();
@@ -253,44 +363,125 @@ int dfs_create(dfs_info_t *info, char *fn, int perms, dfs_file_entry_t *fe)
 
 	return S2V_INODE_NUM(free_ino);
 }
-int dfs_remove(dfs_info_t *info, char *fn)
+/* Frees the entry & its blocks; w/ the entry_lock held */
+static int free_entry(dfs_info_t *info, int vfs_ino)
 {
-	int vfs_ino;
 	dfs_file_entry_t fe;
+	byte4_t blocks[DDK_FS_DATA_BLOCK_CNT];
+	int i;
 
-	if ((vfs_ino = dfs_lookup(info, fn, &fe)) == INV_INODE)
-	{
-		printk(KERN_ERR "File %s doesn't exist\n", fn);
+	/* Afresh, w/ any block allocated since the lookup */
+	if (dfs_read_file_entry(info, vfs_ino, &fe) < 0)
 		return INV_INODE;
-	}
-
-	/* TODO: Free up all allocated blocks, if any */
-
+	memcpy(blocks, fe.blocks, sizeof(blocks));
 
 	memset(&fe, 0, sizeof(dfs_file_entry_t));
 
+	/* Entry gone first, so that its blocks are never free & still in use */
 	if (write_entry_to_ddk_fs(info, V2S_INODE_NUM(vfs_ino), &fe) < 0)
 		return INV_INODE;
 
+	for (i = 0; i < DDK_FS_DATA_BLOCK_CNT; i++)
+	{
+		if (blocks[i])
+		{
+			dfs_put_data_block(info, blocks[i]);
+		}
+	}
+
 	spin_lock(&info->lock); // To prevent racing on free_entry_count access
 	info->free_entry_count++;
 	spin_unlock(&info->lock);
 
 	return vfs_ino;
 }
-int dfs_rename(dfs_info_t *info, char *src_fn, char *dst_fn)
+int dfs_remove(dfs_info_t *info, char *fn, int in_use)
 {
 	int vfs_ino;
 	dfs_file_entry_t fe;
 
-	/* TODO: Get the inode & its number of the src_fn */
+	if ((vfs_ino = dfs_lookup(info, fn, &fe)) == INV_INODE)
+	{
+		printk(KERN_ERR "File %s doesn't exist\n", fn);
+		return INV_INODE;
+	}
+	mutex_lock(&info->entry_lock);
+	if (!in_use)
+	{
+		vfs_ino = free_entry(info, vfs_ino);
+		mutex_unlock(&info->entry_lock);
+		return vfs_ino;
+	}
+	/*
+	 * Just the name goes, w/ the entry kept out of dfs_create's reach, &
+	 * its blocks mapped, till dfs_evict. Being nameless, it is free for
+	 * the next mount, in case of a crash meanwhile
+	 */
+	info->orphans[V2S_INODE_NUM(vfs_ino)] = 1;
+	if (dfs_read_file_entry(info, vfs_ino, &fe) < 0)
+	{
+		info->orphans[V2S_INODE_NUM(vfs_ino)] = 0;
+		mutex_unlock(&info->entry_lock);
+		return INV_INODE;
+	}
+	memset(fe.name, 0, sizeof(fe.name));
+	if (write_entry_to_ddk_fs(info, V2S_INODE_NUM(vfs_ino), &fe) < 0)
+	{
+		info->orphans[V2S_INODE_NUM(vfs_ino)] = 0;
+		mutex_unlock(&info->entry_lock);
+		return INV_INODE;
+	}
+	mutex_unlock(&info->entry_lock);
+	return vfs_ino;
+}
+void dfs_evict(dfs_info_t *info, int vfs_ino)
+{
+	mutex_lock(&info->entry_lock);
+	if (info->orphans[V2S_INODE_NUM(vfs_ino)])
+	{
+		if (free_entry(info, vfs_ino) == INV_INODE)
+		{
+			printk(KERN_ERR "Entry %d couldn't be freed; left for the next mount\n", V2S_INODE_NUM(vfs_ino));
+		}
+		info->orphans[V2S_INODE_NUM(vfs_ino)] = 0;
+	}
+	mutex_unlock(&info->entry_lock);
+}
+int dfs_rename(dfs_info_t *info, char *src_fn, char *dst_fn)
+{
+	int vfs_ino;
+	dfs_file_entry_t fe;
 
+	if (strlen(dst_fn) > DDK_FS_FILENAME_LEN)
+	{
+		return INV_INODE;
+	}
+	if ((vfs_ino = dfs_lookup(info, src_fn, &fe)) == INV_INODE)
+	{
+		return INV_INODE;
+	}
 
-	/* TODO: Implement the rename logic */
+	/* Renaming over an existing file replaces it; w/ it freed on its dfs_evict */
+	if ((dfs_lookup(info, dst_fn, &fe) != INV_INODE) && (dfs_remove(info, dst_fn, 1) == INV_INODE))
+	{
+		return INV_INODE;
+	}
+	mutex_lock(&info->entry_lock);
+	if (dfs_read_file_entry(info, vfs_ino, &fe) < 0)
+	{
+		mutex_unlock(&info->entry_lock);
+		return INV_INODE;
+	}
+	strncpy(fe.name, dst_fn, DDK_FS_FILENAME_LEN);
+	fe.name[DDK_FS_FILENAME_LEN] = 0;
 
 	/* Write the inode back */
 	if (write_entry_to_ddk_fs(info, V2S_INODE_NUM(vfs_ino), &fe) < 0)
+	{
+		mutex_unlock(&info->entry_lock);
 		return INV_INODE;
+	}
+	mutex_unlock(&info->entry_lock);
 
 	return vfs_ino;
 }
@@ -309,12 +500,17 @@ int dfs_update(dfs_info_t *info, int vfs_ino, int *size, int *timestamp, int *pe
 	int i;
 	int retval;
 
+	/* W/ the entry_lock, not to write back over a block mapped in meanwhile */
+	mutex_lock(&info->entry_lock);
 	if ((retval = dfs_read_file_entry(info, vfs_ino, &fe)) < 0)
 	{
+		mutex_unlock(&info->entry_lock);
 		return retval;
 	}
 
-	/* TODO: Update the file entry */
+	if (size) fe.size = *size;
+	if (timestamp) fe.timestamp = *timestamp;
+	if (perms) fe.perms = *perms;
 
 	for (i = (fe.size + info->sb.block_size - 1) / info->sb.block_size; i < DDK_FS_DATA_BLOCK_CNT; i++)
 	{
@@ -325,5 +521,7 @@ int dfs_update(dfs_info_t *info, int vfs_ino, int *size, int *timestamp, int *pe
 		}
 	}
 
-	return dfs_write_file_entry(info, vfs_ino, &fe);
+	retval = dfs_write_file_entry(info, vfs_ino, &fe);
+	mutex_unlock(&info->entry_lock);
+	return retval;
 }
@@ -19,20 +19,28 @@
 
 int dfs_init(dfs_info_t *info);
 void dfs_shut(dfs_info_t *info);
+void dfs_get_stats(dfs_info_t *info, dfs_stats_t *stats); // Sums up the per CPU stats
+/*
+ * Zeroes the next count blocks of a lazily initialised entry table.
+ * Returns the count of blocks still left, or a -ve error
+ */
+int dfs_init_entry_table(dfs_info_t *info, int count);
 
 int dfs_get_data_block(dfs_info_t *info); // Returns block number or INV_BLOCK
 void dfs_put_data_block(dfs_info_t *info, int i);
 
-int dfs_list(dfs_info_t *info, struct file *file, void *dirent, filldir_t filldir);
+int dfs_list(dfs_info_t *info, loff_t *f_pos, void *dirent, filldir_t filldir);
 
 /* The following 4 APIs returns VFS inode number or INV_INODE */
 int dfs_lookup(dfs_info_t *info, char *fn, dfs_file_entry_t *fe);
 int dfs_create(dfs_info_t *info, char *fn, int perms, dfs_file_entry_t *fe);
-int dfs_remove(dfs_info_t *info, char *fn);
+/* W/ in_use, the entry & its blocks are freed only by dfs_evict */
+int dfs_remove(dfs_info_t *info, char *fn, int in_use);
 int dfs_rename(dfs_info_t *info, char *src_fn, char *dst_fn);
 
 int dfs_read_file_entry(dfs_info_t *info, int vfs_ino, dfs_file_entry_t *fe);
 int dfs_write_file_entry(dfs_info_t *info, int vfs_ino, dfs_file_entry_t *fe);
 int dfs_update(dfs_info_t *info, int vfs_ino, int *size, int *timestamp, int *perms);
+void dfs_evict(dfs_info_t *info, int vfs_ino); // Frees the entry removed while in use, if so
 
 #endif
@@ -0,0 +1,137 @@
+/* DDK FS Tracepoints, replacing the printks on its hot paths */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM ddkfs
+
+#if !defined(DDK_FS_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define DDK_FS_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(ddkfs_get_block,
+	TP_PROTO(struct inode *inode, sector_t iblock, int create),
+	TP_ARGS(inode, iblock, create),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(sector_t, iblock)
+		__field(int, create)
+	),
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->iblock = iblock;
+		__entry->create = create;
+	),
+	TP_printk("dev %d,%d ino %lu iblock %llu create %d",
+		MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		(unsigned long long)__entry->iblock, __entry->create)
+);
+
+DECLARE_EVENT_CLASS(ddkfs_page,
+	TP_PROTO(struct inode *inode, pgoff_t index),
+	TP_ARGS(inode, index),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(pgoff_t, index)
+	),
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->index = index;
+	),
+	TP_printk("dev %d,%d ino %lu index %lu",
+		MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		(unsigned long)__entry->index)
+);
+DEFINE_EVENT(ddkfs_page, ddkfs_readpage,
+	TP_PROTO(struct inode *inode, pgoff_t index),
+	TP_ARGS(inode, index)
+);
+DEFINE_EVENT(ddkfs_page, ddkfs_writepage,
+	TP_PROTO(struct inode *inode, pgoff_t index),
+	TP_ARGS(inode, index)
+);
+
+TRACE_EVENT(ddkfs_write_begin,
+	TP_PROTO(struct inode *inode, loff_t pos, unsigned int len),
+	TP_ARGS(inode, pos, len),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(loff_t, pos)
+		__field(unsigned int, len)
+	),
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->pos = pos;
+		__entry->len = len;
+	),
+	TP_printk("dev %d,%d ino %lu pos %lld len %u",
+		MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		__entry->pos, __entry->len)
+);
+
+TRACE_EVENT(ddkfs_readdir,
+	TP_PROTO(struct inode *inode, loff_t pos),
+	TP_ARGS(inode, pos),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(loff_t, pos)
+	),
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->pos = pos;
+	),
+	TP_printk("dev %d,%d pos %lld",
+		MAJOR(__entry->dev), MINOR(__entry->dev), __entry->pos)
+);
+
+TRACE_EVENT(ddkfs_lookup,
+	TP_PROTO(struct inode *dir, const char *name, int ino),
+	TP_ARGS(dir, name, ino),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__array(char, name, DDK_FS_FILENAME_LEN + 1)
+		__field(int, ino)
+	),
+	TP_fast_assign(
+		__entry->dev = dir->i_sb->s_dev;
+		strlcpy(__entry->name, name, DDK_FS_FILENAME_LEN + 1);
+		__entry->ino = ino;
+	),
+	TP_printk("dev %d,%d name %s ino %d",
+		MAJOR(__entry->dev), MINOR(__entry->dev), __entry->name, __entry->ino)
+);
+
+TRACE_EVENT(ddkfs_write_inode,
+	TP_PROTO(struct inode *inode, int size, int timestamp, int perms),
+	TP_ARGS(inode, size, timestamp, perms),
+	TP_STRUCT__entry(
+		__field(dev_t, dev)
+		__field(unsigned long, ino)
+		__field(int, size)
+		__field(int, timestamp)
+		__field(int, perms)
+	),
+	TP_fast_assign(
+		__entry->dev = inode->i_sb->s_dev;
+		__entry->ino = inode->i_ino;
+		__entry->size = size;
+		__entry->timestamp = timestamp;
+		__entry->perms = perms;
+	),
+	TP_printk("dev %d,%d ino %lu size %d timestamp %d perms %o",
+		MAJOR(__entry->dev), MINOR(__entry->dev), __entry->ino,
+		__entry->size, __entry->timestamp, __entry->perms)
+);
+
+#endif
+
+/* Outside the include guard, as define_trace.h re-includes this file */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ddk_fs_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,182 @@
+/* User space block I/O for the DDK FS engine, over an image file or device */
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h> /* For mmap, msync, ... */
+#include <sys/ioctl.h> /* For ioctl() */
+#include <fcntl.h>
+#include <unistd.h> /* For pread, pwrite, ... */
+#include <errno.h> /* For errno */
+#include <string.h> /* For memcpy */
+#include <linux/fs.h> /* For BLKGETSIZE64 */
+
+#include "ddk_fs_ds.h"
+#include "ddk_fs_io.h"
+
+static int dfs_uio_check(dfs_info_t *info, byte4_t block, byte4_t offset, byte8_t len, byte8_t *abs)
+{
+	/* Super block is read before info->sb is valid, but then block is 0 */
+	*abs = (byte8_t)block * info->sb.block_size + offset;
+	if (*abs + len > info->dev_size)
+	{
+		return -EIO;
+	}
+	return 0;
+}
+
+int dfs_uio_read_run(dfs_info_t *info, byte4_t block, byte4_t offset, void *buf, byte4_t len)
+{
+	byte8_t abs;
+	int retval;
+
+	if ((retval = dfs_uio_check(info, block, offset, len, &abs)) < 0)
+	{
+		return retval;
+	}
+	if (info->dev_map)
+	{
+		memcpy(buf, info->dev_map + abs, len);
+		return 0;
+	}
+	if (pread(info->dev_fd, buf, len, abs) != len)
+	{
+		return -EIO;
+	}
+	return 0;
+}
+int dfs_uio_write_run(dfs_info_t *info, byte4_t block, byte4_t offset, const void *buf, byte4_t len)
+{
+	byte8_t abs;
+	int retval;
+
+	if ((retval = dfs_uio_check(info, block, offset, len, &abs)) < 0)
+	{
+		return retval;
+	}
+	if (info->dev_map)
+	{
+		memcpy(info->dev_map + abs, buf, len);
+		return 0;
+	}
+	if (pwrite(info->dev_fd, buf, len, abs) != len)
+	{
+		return -EIO;
+	}
+	return 0;
+}
+
+int dfs_io_read(dfs_info_t *info, byte4_t block, byte4_t offset, void *buf, byte4_t len)
+{
+	if (offset + len > DDK_FS_BLOCK_SIZE) // Should never happen
+	{
+		return -EINVAL;
+	}
+	return dfs_uio_read_run(info, block, offset, buf, len);
+}
+int dfs_io_write(dfs_info_t *info, byte4_t block, byte4_t offset, void *buf, byte4_t len)
+{
+	if (offset + len > DDK_FS_BLOCK_SIZE) // Should never happen
+	{
+		return -EINVAL;
+	}
+	return dfs_uio_write_run(info, block, offset, buf, len);
+}
+
+int dfs_io_zero(dfs_info_t *info, byte4_t block, byte4_t count)
+{
+	static const byte1_t zeroes[64 * 1024];
+	byte8_t abs, len, chunk;
+	int retval;
+
+	len = (byte8_t)count * info->sb.block_size;
+	if ((retval = dfs_uio_check(info, block, 0, len, &abs)) < 0)
+	{
+		return retval;
+	}
+	if (info->dev_map)
+	{
+		memset(info->dev_map + abs, 0, len);
+		return 0;
+	}
+	for (; len; abs += chunk, len -= chunk)
+	{
+		chunk = (len < sizeof(zeroes)) ? len : sizeof(zeroes);
+		if (pwrite(info->dev_fd, zeroes, chunk, abs) != chunk)
+		{
+			return -EIO;
+		}
+	}
+	return 0;
+}
+
+int dfs_uio_open(dfs_info_t *info, const char *path, int flags)
+{
+	struct stat st;
+	byte8_t size;
+	int prot;
+	int retval;
+
+	info->dev_map = NULL;
+	if ((info->dev_fd = open(path, (flags & DFS_UIO_RDONLY) ? O_RDONLY : O_RDWR)) == -1)
+	{
+		return -errno;
+	}
+	if (fstat(info->dev_fd, &st) == -1)
+	{
+		retval = -errno;
+		dfs_uio_close(info);
+		return retval;
+	}
+	if (S_ISBLK(st.st_mode))
+	{
+		if (ioctl(info->dev_fd, BLKGETSIZE64, &size) == -1)
+		{
+			retval = -errno;
+			dfs_uio_close(info);
+			return retval;
+		}
+	}
+	else
+	{
+		size = st.st_size;
+	}
+	info->dev_size = size;
+	if ((flags & DFS_UIO_MMAP) && size)
+	{
+		prot = PROT_READ | ((flags & DFS_UIO_RDONLY) ? 0 : PROT_WRITE);
+		info->dev_map = mmap(NULL, size, prot, MAP_SHARED, info->dev_fd, 0);
+		if (info->dev_map == MAP_FAILED)
+		{
+			retval = -errno;
+			info->dev_map = NULL;
+			dfs_uio_close(info);
+			return retval;
+		}
+	}
+	return 0;
+}
+int dfs_uio_sync(dfs_info_t *info)
+{
+	if (info->dev_map && (msync(info->dev_map, info->dev_size, MS_SYNC) == -1))
+	{
+		return -errno;
+	}
+	if (fsync(info->dev_fd) == -1)
+	{
+		return -errno;
+	}
+	return 0;
+}
+void dfs_uio_close(dfs_info_t *info)
+{
+	if (info->dev_map)
+	{
+		munmap(info->dev_map, info->dev_size);
+		info->dev_map = NULL;
+	}
+	if (info->dev_fd != -1)
+	{
+		close(info->dev_fd);
+		info->dev_fd = -1;
+	}
+}
@@ -2,6 +2,9 @@
 #include <linux/kernel.h>
 #include <linux/usb.h>
 #include <linux/errno.h>
+#include <linux/atomic.h>
+#include <linux/delay.h> // For msleep, usleep_range
+#include <linux/jiffies.h>
 
 #include "ddk_storage.h"
 #include "ddk_block.h"
@@ -17,10 +20,16 @@
 #define CUSTOM_RQ_SET_MEM_TYPE      8
 #define CUSTOM_RQ_GET_MEM_TYPE      9
 
+/* The data path of the older firmware, if the descriptors don't say otherwise */
 #define MEM_EP_IN (USB_DIR_IN | 0x01)
 #define MEM_EP_OUT 0x01
 
 #define MAX_PKT_SIZE 8
+#define DDK_BULK_URB_SIZE (16 * DDK_SECTOR_SIZE) /* Bytes per bulk URB, split into packets by the host */
+#define DDK_URB_BATCH 64 /* URBs in flight at a time */
+#define DDK_XFER_TIMEOUT 5000 /* ms, per batch */
+#define DDK_READY_TIMEOUT 1000 /* ms, for the device to take in a write */
+#define DDK_READY_FALLBACK 100 /* ms, w/o its write offset to poll */
 
 enum
 {
@@ -62,11 +71,10 @@ static int get_size(struct usb_device *dev)
 	}
 }
 
-#if 0
 static int get_off(struct usb_device *dev, int dir)
 {
 	int retval;
-	short val;
+	unsigned short val;
 
 	/* Control IN */
 	retval = usb_control_msg(dev, usb_rcvctrlpipe(dev, 0),
@@ -83,7 +91,6 @@ static int get_off(struct usb_device *dev, int dir)
 		return (retval < 0) ? retval : -EINVAL;
 	}
 }
-#endif
 static int set_off(struct usb_device *dev, int dir, int offset)
 {
 	/* Control OUT */
@@ -93,90 +100,270 @@ static int set_off(struct usb_device *dev, int dir, int offset)
 			offset, 0, NULL, 0, USB_CTRL_SET_TIMEOUT);
 }
 
-int ddk_storage_init(struct usb_device *dev)
+/*
+ * Moves the device's offset for dir to offset, unless it is there already,
+ * as left by the previous transfer (e.g. in a sequential stream)
+ */
+static int seek_off(struct ddk_storage *st, int dir, int offset)
 {
 	int retval;
-	
-	if ((retval = set_mem(dev)) < 0) // Setting memory type to flash
+
+	if (st->off[dir] == offset)
+		return 0;
+	if ((retval = set_off(st->dev, dir, offset)) < 0)
 	{
+		st->off[dir] = -1;
+		printk(KERN_ERR "ddkb: Set Off Error: %d\n", retval);
 		return retval;
 	}
+	st->off[dir] = offset;
+	return 0;
+}
+
+/* Progress of a batch of URBs, updated by their completions */
+struct ddk_xfer
+{
+	atomic_t actual; /* Bytes transferred */
+	atomic_t status; /* First error, if any */
+	atomic_t short_pkt; /* Device had no more */
+};
+
+static void ddk_urb_done(struct urb *urb)
+{
+	struct ddk_xfer *x = (struct ddk_xfer *)(urb->context);
+
+	atomic_add(urb->actual_length, &x->actual);
+	if (urb->status)
+		atomic_cmpxchg(&x->status, 0, urb->status);
+	else if (urb->actual_length < urb->transfer_buffer_length)
+		atomic_set(&x->short_pkt, 1);
+}
+/*
+ * Transfers cnt bytes through the data endpoint, as batches of anchored
+ * URBs (a packet each on interrupt endpoints; many on bulk ones), all of a
+ * batch queued on the endpoint at once, instead of a round trip per packet.
+ * An endpoint completes its URBs in order; so the bytes transferred are the
+ * leading ones. Returns their count, or < 0
+ */
+static int ddk_xfer(struct ddk_storage *st, int dir, u8 *buffer, int cnt)
+{
+	struct usb_device *dev = st->dev;
+	unsigned int pipe;
+	int urb_size = st->bulk ? DDK_BULK_URB_SIZE : st->pkt_size;
+	struct usb_anchor anchor;
+	struct ddk_xfer x;
+	struct urb *urb;
+	int done = 0, off, len, n;
+	int retval;
+
+	if (st->bulk)
+		pipe = (dir == e_read) ? usb_rcvbulkpipe(dev, st->ep_in) : usb_sndbulkpipe(dev, st->ep_out);
 	else
+		pipe = (dir == e_read) ? usb_rcvintpipe(dev, st->ep_in) : usb_sndintpipe(dev, st->ep_out);
+	init_usb_anchor(&anchor);
+	while (done < cnt)
 	{
-		if ((retval = get_size(dev)) < 0)
+		atomic_set(&x.actual, 0);
+		atomic_set(&x.status, 0);
+		atomic_set(&x.short_pkt, 0);
+		retval = 0;
+		for (n = 0, off = done; (n < DDK_URB_BATCH) && (off < cnt); n++, off += len)
+		{
+			len = min(cnt - off, urb_size);
+			if ((urb = usb_alloc_urb(0, GFP_NOIO)) == NULL)
+			{
+				retval = -ENOMEM;
+				break;
+			}
+			if (st->bulk)
+				usb_fill_bulk_urb(urb, dev, pipe, buffer + off, len, ddk_urb_done, &x);
+			else
+				usb_fill_int_urb(urb, dev, pipe, buffer + off, len, ddk_urb_done, &x, st->interval);
+			usb_anchor_urb(urb, &anchor);
+			if ((retval = usb_submit_urb(urb, GFP_NOIO)) < 0)
+			{
+				usb_unanchor_urb(urb);
+			}
+			usb_free_urb(urb); // The anchor holds it till done
+			if (retval < 0)
+				break;
+		}
+		/* Wait for the batch (or for what of it got submitted) */
+		if (!usb_wait_anchor_empty_timeout(&anchor, DDK_XFER_TIMEOUT))
+		{
+			usb_kill_anchored_urbs(&anchor);
+			if (!retval)
+				retval = -ETIMEDOUT;
+		}
+		if (!retval)
+			retval = atomic_read(&x.status);
+		if (retval < 0)
+		{
+			printk(KERN_ERR "ddkb: URB transfer returned %d\n", retval);
 			return retval;
-		else
-			return retval / DDK_SECTOR_SIZE;
+		}
+		done += atomic_read(&x.actual);
+		if (atomic_read(&x.short_pkt))
+			break;
 	}
+	return done;
 }
-void ddk_storage_cleanup(struct usb_device *dev)
+/*
+ * Waits for the device to have taken in a write ending at the end offset, as
+ * shown by its write offset; or, for older firmware w/o it, just a while
+ */
+static int ddk_wait_ready(struct ddk_storage *st, int end)
 {
+	unsigned long timeout = jiffies + msecs_to_jiffies(DDK_READY_TIMEOUT);
+	int off;
+
+	if (!st->wr_off)
+	{
+		msleep(DDK_READY_FALLBACK);
+		return 0;
+	}
+	do
+	{
+		if ((off = get_off(st->dev, e_write)) < 0)
+		{
+			printk(KERN_ERR "ddkb: Get Off Error: %d\n", off);
+			return off;
+		}
+		if ((unsigned short)off == (unsigned short)end)
+			return 0;
+		usleep_range(500, 1000);
+	}
+	while (time_before(jiffies, timeout));
+	printk(KERN_ERR "ddkb: Device not ready, at %d of %d\n", off, end);
+	return -ETIMEDOUT;
 }
-int ddk_storage_write(struct usb_device *dev, sector_t sector_off, u8 *buffer, unsigned int sectors)
+
+/*
+ * Picks the data path from the interface's descriptors: a bulk endpoint
+ * pair, if the firmware has one; else, an interrupt one; else, the fixed
+ * interrupt endpoints of the older firmware
+ */
+static void ddk_find_endpoints(struct usb_interface *interface, struct ddk_storage *st)
+{
+	struct usb_host_interface *alt = interface->cur_altsetting;
+	struct usb_endpoint_descriptor *ep, *bulk_in = NULL, *bulk_out = NULL, *int_in = NULL, *int_out = NULL;
+	int i;
+
+	for (i = 0; i < alt->desc.bNumEndpoints; i++)
+	{
+		ep = &alt->endpoint[i].desc;
+		if (!bulk_in && usb_endpoint_is_bulk_in(ep))
+			bulk_in = ep;
+		else if (!bulk_out && usb_endpoint_is_bulk_out(ep))
+			bulk_out = ep;
+		else if (!int_in && usb_endpoint_is_int_in(ep))
+			int_in = ep;
+		else if (!int_out && usb_endpoint_is_int_out(ep))
+			int_out = ep;
+	}
+
+	st->dev = interface_to_usbdev(interface);
+	if (bulk_in && bulk_out)
+	{
+		st->bulk = 1;
+		st->ep_in = bulk_in->bEndpointAddress;
+		st->ep_out = bulk_out->bEndpointAddress;
+		st->pkt_size = min(usb_endpoint_maxp(bulk_in), usb_endpoint_maxp(bulk_out));
+		st->interval = 0;
+	}
+	else if (int_in && int_out)
+	{
+		st->bulk = 0;
+		st->ep_in = int_in->bEndpointAddress;
+		st->ep_out = int_out->bEndpointAddress;
+		st->pkt_size = min(usb_endpoint_maxp(int_in), usb_endpoint_maxp(int_out));
+		st->interval = min(int_in->bInterval, int_out->bInterval);
+	}
+	else
+	{
+		st->bulk = 0;
+		st->ep_in = MEM_EP_IN;
+		st->ep_out = MEM_EP_OUT;
+		st->pkt_size = 0;
+		st->interval = 1;
+	}
+	if (!st->pkt_size)
+	{
+		st->pkt_size = MAX_PKT_SIZE;
+	}
+	printk(KERN_INFO "ddkb: %s endpoints 0x%02x / 0x%02x, w/ %d byte packets\n",
+		st->bulk ? "Bulk" : "Interrupt", st->ep_in, st->ep_out, st->pkt_size);
+}
+
+int ddk_storage_init(struct ddk_storage *st)
+{
+	int retval;
+	
+	/* Not known, till set */
+	st->off[e_read] = st->off[e_write] = -1;
+	if ((retval = set_mem(st->dev)) < 0) // Setting memory type to flash
+	{
+		return retval;
+	}
+	/* Once, rather than a failing control transfer per write, on the older firmware */
+	st->wr_off = (get_off(st->dev, e_write) >= 0);
+	if (!st->wr_off)
+	{
+		printk(KERN_INFO "ddkb: No write offset from the firmware; waiting %d ms per write\n", DDK_READY_FALLBACK);
+	}
+	if ((retval = get_size(st->dev)) < 0)
+		return retval;
+	else
+		return (st->size = retval / DDK_SECTOR_SIZE);
+}
+void ddk_storage_cleanup(struct ddk_storage *st)
+{
+}
+int ddk_storage_write(struct ddk_storage *st, sector_t sector_off, u8 *buffer, unsigned int sectors)
 {
 	int offset = sector_off * DDK_SECTOR_SIZE;
 	int cnt = sectors * DDK_SECTOR_SIZE;
-	int wrote_cnt, wrote_size;
+	int wrote_cnt;
 	int retval;
 
-	//printk(KERN_DEBUG "ddkb: Wr:S:C:O - %Ld:%d:%d\n", sector_off, sectors, get_off(dev, e_write));
-	if ((retval = set_off(dev, e_write, offset)) < 0)
+	//printk(KERN_DEBUG "ddkb: Wr:S:C:O - %Ld:%d:%d\n", sector_off, sectors, get_off(st->dev, e_write));
+	if ((retval = seek_off(st, e_write, offset)) < 0)
 	{
-		printk(KERN_ERR "ddkb: Set Off Error: %d\n", retval);
 		return retval;
 	}
-	wrote_cnt = 0;
-	while (wrote_cnt < cnt)
+	if ((wrote_cnt = ddk_xfer(st, e_write, buffer, cnt)) < 0)
 	{
-		/* Send the data out the int endpoint */
-		retval = usb_interrupt_msg(dev, usb_sndintpipe(dev, MEM_EP_OUT),
-			buffer + wrote_cnt, MAX_PKT_SIZE, &wrote_size, 0);
-		if (retval)
-		{
-			printk(KERN_ERR "ddkb: Interrupt message returned %d\n", retval);
-			return retval;
-		}
-		if (wrote_size == 0)
-		{
-			break;
-		}
-		wrote_cnt += wrote_size;
+		st->off[e_write] = -1; // Moved by an unknown count
+		return wrote_cnt;
 	}
 	printk(KERN_INFO "ddkb: Wrote %d bytes\n", wrote_cnt);
-	msleep(100);
+	if ((retval = ddk_wait_ready(st, offset + wrote_cnt)) < 0)
+	{
+		st->off[e_write] = -1;
+		return retval;
+	}
+	st->off[e_write] = offset + wrote_cnt;
 
 	return wrote_cnt;
 }
-int ddk_storage_read(struct usb_device *dev, sector_t sector_off, u8 *buffer, unsigned int sectors)
+int ddk_storage_read(struct ddk_storage *st, sector_t sector_off, u8 *buffer, unsigned int sectors)
 {
 	int offset = sector_off * DDK_SECTOR_SIZE;
 	int cnt = sectors * DDK_SECTOR_SIZE;
-	int read_cnt, read_size;
+	int read_cnt;
 	int retval;
 
-	//printk(KERN_DEBUG "ddkb: Rd:S:C:O - %Ld:%d:%d\n", sector_off, sectors, get_off(dev, e_read));
-	if ((retval = set_off(dev, e_read, offset)) < 0)
+	//printk(KERN_DEBUG "ddkb: Rd:S:C:O - %Ld:%d:%d\n", sector_off, sectors, get_off(st->dev, e_read));
+	if ((retval = seek_off(st, e_read, offset)) < 0)
 	{
-		printk(KERN_ERR "ddkb: Set Off Error: %d\n", retval);
 		return retval;
 	}
-	read_cnt = 0;
-	while (read_cnt < cnt)
+	if ((read_cnt = ddk_xfer(st, e_read, buffer, cnt)) < 0)
 	{
-		/* Read the data in the int endpoint */
-		retval = usb_interrupt_msg(dev, usb_rcvintpipe(dev, MEM_EP_IN),
-			buffer + read_cnt, MAX_PKT_SIZE, &read_size, 0);
-		if (retval)
-		{
-			printk(KERN_ERR "ddkb: Interrupt message returned %d\n", retval);
-			return retval;
-		}
-		if (read_size == 0)
-		{
-			break;
-		}
-		read_cnt += read_size;
+		st->off[e_read] = -1; // Moved by an unknown count
+		return read_cnt;
 	}
+	st->off[e_read] = offset + read_cnt;
 	printk(KERN_INFO "ddkb: Read %d bytes\n", read_cnt);
 
 	return read_cnt;
@@ -184,7 +371,10 @@ int ddk_storage_read(struct usb_device *dev, sector_t sector_off, u8 *buffer, un
 
 static int ddk_probe(struct usb_interface *interface, const struct usb_device_id *id)
 {
-	return block_register_dev(interface);
+	struct ddk_storage st;
+
+	ddk_find_endpoints(interface, &st);
+	return block_register_dev(interface, &st);
 }
 
 static void ddk_disconnect(struct usb_interface *interface)
@@ -6,10 +6,23 @@
 
 #define DDK_SECTOR_SIZE 512
 
-extern int ddk_storage_init(struct usb_device *dev);
-extern void ddk_storage_cleanup(struct usb_device *dev);
-extern int ddk_storage_write(struct usb_device *dev, sector_t sector_off, u8 *buffer, unsigned int sectors);
-extern int ddk_storage_read(struct usb_device *dev, sector_t sector_off, u8 *buffer, unsigned int sectors);
+/* The board's data path, as negotiated in ddk_probe */
+struct ddk_storage
+{
+	struct usb_device *dev;
+	int bulk; /* Bulk endpoints; else, interrupt ones */
+	u8 ep_in, ep_out; /* Endpoint addresses */
+	u16 pkt_size; /* wMaxPacketSize, of the smaller one */
+	int interval; /* For the interrupt ones */
+	int off[2]; /* Device's read & write offsets, as left by the last transfers; -1 if not known */
+	int wr_off; /* Firmware reports its write offset, to poll for a write to be taken in */
+	unsigned int size; /* In sectors */
+};
+
+extern int ddk_storage_init(struct ddk_storage *st);
+extern void ddk_storage_cleanup(struct ddk_storage *st);
+extern int ddk_storage_write(struct ddk_storage *st, sector_t sector_off, u8 *buffer, unsigned int sectors);
+extern int ddk_storage_read(struct ddk_storage *st, sector_t sector_off, u8 *buffer, unsigned int sectors);
 #endif
 
 #endif
@@ -0,0 +1,378 @@
+/* Metadata & data path benchmarks for a mounted ddkfs (or any other fs) */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h> /* For statvfs() */
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h> /* For opendir(), ... */
+#include <errno.h> /* For errno */
+#include <string.h> /* For strerror() */
+#include <time.h> /* For clock_gettime() */
+#include <limits.h> /* For PATH_MAX */
+
+#include "ddk_fs_ds.h" /* For DDK_FS_* limits */
+
+#define DEF_FILE_CNT 100
+#define DEF_FILE_SIZE 4096 /* Nearly the largest a ddkfs file can be */
+#define DEF_IO_SIZE DDK_FS_BLOCK_SIZE
+#define DEF_RAND_OPS 10000
+#define DEF_READDIR_OPS 10
+#define MAX_FILE_SIZE (DDK_FS_DATA_BLOCK_CNT * DDK_FS_BLOCK_SIZE)
+
+typedef unsigned long long nsec_t;
+
+static struct
+{
+	char *dir;
+	char *label;
+	int file_cnt;
+	int file_size;
+	int io_size;
+	int rand_ops;
+	int readdir_ops;
+	int drop_caches;
+	char *buf;
+	nsec_t *lat; /* Latency of each op of the current test */
+	int first; /* For the JSON separators */
+} b;
+
+static nsec_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (nsec_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+static void file_name(int i, char *fn, size_t len)
+{
+	snprintf(fn, len, "%s/b%07d", b.dir, i);
+}
+static void drop_caches(void)
+{
+	int fd;
+
+	if (!b.drop_caches)
+		return;
+	sync();
+	if ((fd = open("/proc/sys/vm/drop_caches", O_WRONLY)) != -1)
+	{
+		if (write(fd, "3", 1) != 1)
+			fprintf(stderr, "Unable to drop caches: %s\n", strerror(errno));
+		close(fd);
+	}
+}
+static int cmp_nsec(const void *a, const void *c)
+{
+	nsec_t x = *(const nsec_t *)(a), y = *(const nsec_t *)(c);
+
+	return (x > y) - (x < y);
+}
+/* Percentile p (0-100) of the sorted latencies, in ns */
+static nsec_t pct(int ops, double p)
+{
+	int i = (int)(p * ops / 100);
+
+	return b.lat[(i >= ops) ? ops - 1 : i];
+}
+static void report(const char *name, int ops, nsec_t total, long long bytes)
+{
+	if (ops <= 0)
+		return;
+	qsort(b.lat, ops, sizeof(nsec_t), cmp_nsec);
+	printf("%s\n\t\t\"%s\": {\"ops\": %d, \"ops_per_sec\": %.1f", b.first ? "" : ",", name, ops,
+		ops * 1e9 / (total ? total : 1));
+	if (bytes)
+		printf(", \"mib_per_sec\": %.2f", bytes * 1e9 / (total ? total : 1) / (1024 * 1024));
+	printf(", \"lat_ns\": {\"min\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}}",
+		b.lat[0], pct(ops, 50), pct(ops, 90), pct(ops, 99), pct(ops, 99.9), b.lat[ops - 1]);
+	b.first = 0;
+}
+static int fail(const char *what, const char *fn)
+{
+	fprintf(stderr, "%s %s: %s\n", what, fn, strerror(errno));
+	return -1;
+}
+
+static int bench_create(void)
+{
+	char fn[PATH_MAX];
+	nsec_t start, t;
+	int i, fd;
+
+	start = now();
+	for (i = 0; i < b.file_cnt; i++)
+	{
+		file_name(i, fn, sizeof(fn));
+		t = now();
+		if ((fd = open(fn, O_CREAT | O_EXCL | O_WRONLY, 0644)) == -1)
+			return fail("Creating", fn);
+		close(fd);
+		b.lat[i] = now() - t;
+	}
+	report("create", b.file_cnt, now() - start, 0);
+	return 0;
+}
+static int bench_lookup(void)
+{
+	char fn[PATH_MAX];
+	struct stat st;
+	nsec_t start, t;
+	int i;
+
+	drop_caches();
+	start = now();
+	for (i = 0; i < b.file_cnt; i++)
+	{
+		/* Random order, so that no lookup order gets favoured */
+		file_name(rand() % b.file_cnt, fn, sizeof(fn));
+		t = now();
+		if (stat(fn, &st) == -1)
+			return fail("Looking up", fn);
+		b.lat[i] = now() - t;
+	}
+	report("lookup", b.file_cnt, now() - start, 0);
+	return 0;
+}
+static int bench_readdir(void)
+{
+	DIR *d;
+	nsec_t start, t;
+	int i, cnt;
+
+	start = now();
+	for (i = 0; i < b.readdir_ops; i++)
+	{
+		t = now();
+		if (!(d = opendir(b.dir)))
+			return fail("Opening", b.dir);
+		for (cnt = 0; readdir(d); cnt++);
+		closedir(d);
+		b.lat[i] = now() - t;
+		if (cnt < b.file_cnt)
+		{
+			fprintf(stderr, "Listed only %d of %d files\n", cnt, b.file_cnt);
+			return -1;
+		}
+	}
+	report("readdir", b.readdir_ops, now() - start, 0);
+	return 0;
+}
+static int bench_seq(int write_op)
+{
+	char fn[PATH_MAX];
+	nsec_t start, t;
+	int i, fd, off, len, ops = 0;
+
+	if (!write_op)
+		drop_caches();
+	start = now();
+	for (i = 0; i < b.file_cnt; i++)
+	{
+		file_name(i, fn, sizeof(fn));
+		if ((fd = open(fn, write_op ? O_WRONLY : O_RDONLY)) == -1)
+			return fail("Opening", fn);
+		for (off = 0; off < b.file_size; off += len)
+		{
+			len = (b.file_size - off < b.io_size) ? b.file_size - off : b.io_size;
+			t = now();
+			if ((write_op ? write(fd, b.buf, len) : read(fd, b.buf, len)) != len)
+			{
+				close(fd);
+				return fail(write_op ? "Writing" : "Reading", fn);
+			}
+			b.lat[ops++] = now() - t;
+		}
+		close(fd);
+	}
+	if (write_op)
+		sync(); /* Writeback is part of the cost */
+	report(write_op ? "seq_write" : "seq_read", ops, now() - start, (long long)ops * b.io_size);
+	return 0;
+}
+static int bench_rand(int write_op)
+{
+	char fn[PATH_MAX];
+	int *fds;
+	nsec_t start, t;
+	int i, slots = b.file_size / b.io_size;
+	int retval = 0;
+
+	if (!slots)
+		return 0;
+	if (!(fds = malloc(b.file_cnt * sizeof(int))))
+		return -1;
+	for (i = 0; i < b.file_cnt; i++)
+	{
+		file_name(i, fn, sizeof(fn));
+		if ((fds[i] = open(fn, O_RDWR)) == -1)
+		{
+			while (i--) close(fds[i]);
+			free(fds);
+			return fail("Opening", fn);
+		}
+	}
+	if (!write_op)
+		drop_caches();
+	start = now();
+	for (i = 0; i < b.rand_ops; i++)
+	{
+		int f = rand() % b.file_cnt;
+		off_t off = (off_t)(rand() % slots) * b.io_size;
+
+		t = now();
+		if ((write_op ? pwrite(fds[f], b.buf, b.io_size, off) : pread(fds[f], b.buf, b.io_size, off)) != b.io_size)
+		{
+			fprintf(stderr, "%s file #%d: %s\n", write_op ? "Writing" : "Reading", f, strerror(errno));
+			retval = -1;
+			break;
+		}
+		b.lat[i] = now() - t;
+	}
+	if (write_op)
+		sync();
+	report(write_op ? "rand_write" : "rand_read", i, now() - start, (long long)i * b.io_size);
+	for (i = 0; i < b.file_cnt; i++)
+		close(fds[i]);
+	free(fds);
+	return retval;
+}
+static int bench_fsync(void)
+{
+	char fn[PATH_MAX];
+	nsec_t start, t;
+	int i, fd;
+
+	start = now();
+	for (i = 0; i < b.file_cnt; i++)
+	{
+		file_name(i, fn, sizeof(fn));
+		t = now();
+		if ((fd = open(fn, O_WRONLY)) == -1)
+			return fail("Opening", fn);
+		if ((pwrite(fd, b.buf, b.io_size, 0) != b.io_size) || (fsync(fd) == -1))
+		{
+			close(fd);
+			return fail("Syncing", fn);
+		}
+		close(fd);
+		b.lat[i] = now() - t;
+	}
+	report("write_fsync", b.file_cnt, now() - start, (long long)b.file_cnt * b.io_size);
+	return 0;
+}
+static int bench_unlink(void)
+{
+	char fn[PATH_MAX];
+	nsec_t start, t;
+	int i;
+
+	start = now();
+	for (i = 0; i < b.file_cnt; i++)
+	{
+		file_name(i, fn, sizeof(fn));
+		t = now();
+		if (unlink(fn) == -1)
+			return fail("Removing", fn);
+		b.lat[i] = now() - t;
+	}
+	report("unlink", b.file_cnt, now() - start, 0);
+	return 0;
+}
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <mounted directory>\n", prog);
+	fprintf(stderr, "\t-n <files>: Files to work on (default %d)\n", DEF_FILE_CNT);
+	fprintf(stderr, "\t-s <bytes>: Size of each file (default %d; at most %d)\n", DEF_FILE_SIZE, MAX_FILE_SIZE);
+	fprintf(stderr, "\t-b <bytes>: Size of each read / write (default %d)\n", DEF_IO_SIZE);
+	fprintf(stderr, "\t-r <ops>: Random reads & writes (default %d)\n", DEF_RAND_OPS);
+	fprintf(stderr, "\t-l <label>: Free form label, e.g. device & size, for the report\n");
+	fprintf(stderr, "\t-D: Drop the page cache before the read tests (needs root)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct statvfs vfs;
+	int opt, max;
+	int retval = 0;
+
+	b.file_cnt = DEF_FILE_CNT;
+	b.file_size = DEF_FILE_SIZE;
+	b.io_size = DEF_IO_SIZE;
+	b.rand_ops = DEF_RAND_OPS;
+	b.readdir_ops = DEF_READDIR_OPS;
+	b.label = "";
+	while ((opt = getopt(argc, argv, "n:s:b:r:l:D")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n': b.file_cnt = atoi(optarg); break;
+			case 's': b.file_size = atoi(optarg); break;
+			case 'b': b.io_size = atoi(optarg); break;
+			case 'r': b.rand_ops = atoi(optarg); break;
+			case 'l': b.label = optarg; break;
+			case 'D': b.drop_caches = 1; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	if ((optind != argc - 1) || (b.file_cnt <= 0) || (b.io_size <= 0) ||
+		(b.file_size <= 0) || (b.file_size > MAX_FILE_SIZE))
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	b.dir = argv[optind];
+	if (statvfs(b.dir, &vfs) == -1)
+	{
+		fprintf(stderr, "Error accessing %s: %s\n", b.dir, strerror(errno));
+		return 2;
+	}
+	/* Fit into what the partition can take */
+	if (vfs.f_ffree && (b.file_cnt > vfs.f_ffree))
+	{
+		fprintf(stderr, "Only %lu free entries; Using those many files\n", vfs.f_ffree);
+		b.file_cnt = vfs.f_ffree;
+	}
+	max = (vfs.f_bfree * vfs.f_frsize) / ((b.file_size + DDK_FS_BLOCK_SIZE - 1) / DDK_FS_BLOCK_SIZE * DDK_FS_BLOCK_SIZE);
+	if (b.file_cnt > max)
+	{
+		fprintf(stderr, "Only %d files fit in the free space; Using those many\n", max);
+		b.file_cnt = max;
+	}
+	max = b.file_cnt * ((b.file_size + b.io_size - 1) / b.io_size);
+	max = (max > b.rand_ops) ? max : b.rand_ops;
+	max = (max > b.readdir_ops) ? max : b.readdir_ops;
+	b.lat = malloc(max * sizeof(nsec_t));
+	b.buf = malloc(b.io_size);
+	if (!b.lat || !b.buf)
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 2;
+	}
+	memset(b.buf, 0xA5, b.io_size);
+	srand(1); /* Same sequence every run, for comparable results */
+
+	printf("{\n\t\"label\": \"%s\",\n\t\"dir\": \"%s\",\n", b.label, b.dir);
+	printf("\t\"partition_blocks\": %lu,\n\t\"block_size\": %lu,\n", vfs.f_blocks, vfs.f_frsize);
+	printf("\t\"files\": %d,\n\t\"file_size\": %d,\n\t\"io_size\": %d,\n", b.file_cnt, b.file_size, b.io_size);
+	printf("\t\"results\": {");
+	b.first = 1;
+	if ((bench_create() < 0) || (bench_lookup() < 0) || (bench_readdir() < 0) ||
+		(bench_seq(1) < 0) || (bench_seq(0) < 0) || (bench_rand(1) < 0) ||
+		(bench_rand(0) < 0) || (bench_fsync() < 0))
+	{
+		retval = 3;
+	}
+	if (bench_unlink() < 0)
+	{
+		retval = 3;
+	}
+	printf("\n\t}\n}\n");
+
+	free(b.buf);
+	free(b.lat);
+	return retval;
+}
@@ -0,0 +1,68 @@
+#!/bin/sh
+# Runs ddkfs_bench over the rb RAM disk & over loop mounted ddkfs images of
+# various sizes, at various file counts, printing a JSON array of the results.
+# Needs root, and the dor.ko & ddkfs.ko built in this directory.
+#
+# Tunables (environment):
+#	RB_SECTORS - rb size in sectors, if dor.ko is loaded here (default 65536,
+#		i.e. 32 MiB, w/ the partitions of ~6 MiB each; as of rb_sectors)
+#	RB_PART - rb partition to format (default /dev/rb3)
+#	RB_FILES - File counts on rb (default "100 1000")
+#	RB_FILE_SIZE - File size on rb (default 4096)
+#	IMG_SIZES - Image sizes, as for truncate (default "16M 64M 256M")
+#	IMG_FILES - File counts on images (default "100 1000 10000")
+#	IMG_DIR - Where to create the images (default /tmp)
+#	BENCH_OPTS - Additional options to ddkfs_bench, e.g. -D
+
+RB_SECTORS=${RB_SECTORS:-65536}
+RB_PART=${RB_PART:-/dev/rb3}
+RB_FILES=${RB_FILES:-"100 1000"}
+RB_FILE_SIZE=${RB_FILE_SIZE:-4096}
+IMG_SIZES=${IMG_SIZES:-"16M 64M 256M"}
+IMG_FILES=${IMG_FILES:-"100 1000 10000"}
+IMG_DIR=${IMG_DIR:-/tmp}
+
+DIR=$(cd $(dirname $0) && pwd)
+MNT=$(mktemp -d)
+SEP=""
+
+# run <label> <files> [ddkfs_bench options]
+run()
+{
+	label=$1; files=$2; shift 2
+	# Exactly one object per run: a failed one may have printed its own, partway
+	out=$(${DIR}/ddkfs_bench -n ${files} -l "${label}" ${BENCH_OPTS} "$@" ${MNT}) || out="{}"
+	printf "%s%s\n" "${SEP}" "${out}"
+	SEP=","
+}
+
+grep -q "^dor " /proc/modules || insmod ${DIR}/dor.ko rb_sectors=${RB_SECTORS} || exit 1
+grep -q "^ddkfs " /proc/modules || insmod ${DIR}/ddkfs.ko || exit 1
+
+echo "["
+# Over the RAM disk
+for files in ${RB_FILES}
+do
+	${DIR}/mkfs.ddkfs ${RB_PART} > /dev/null || exit 1
+	mount -t ddkfs ${RB_PART} ${MNT} || exit 1
+	run "rb:${RB_PART}" ${files} -s ${RB_FILE_SIZE}
+	umount ${MNT}
+done
+# Over the loop mounted images
+for size in ${IMG_SIZES}
+do
+	img=${IMG_DIR}/ddkfs_bench_${size}.img
+	for files in ${IMG_FILES}
+	do
+		rm -f ${img}
+		truncate -s ${size} ${img} || exit 1
+		${DIR}/mkfs.ddkfs ${img} > /dev/null || exit 1
+		mount -t ddkfs -o loop ${img} ${MNT} || exit 1
+		run "loop:${size}" ${files}
+		umount ${MNT}
+	done
+	rm -f ${img}
+done
+echo "]"
+
+rmdir ${MNT}
@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h> /* For errno */
+#include <string.h> /* For strerror() */
+#include <pthread.h> /* For pthread_create(), ... */
+
+#include "ddk_fs_ds.h"
+#include "ddk_fs_ops.h"
+#include "ddk_fs_io.h"
+
+/* Exit codes, as per fsck(8) */
+#define FSCK_OK 0
+#define FSCK_NONDESTRUCT 1 /* Errors corrected */
+#define FSCK_UNCORRECTED 4 /* Errors left uncorrected */
+#define FSCK_ERROR 8 /* Operational error */
+#define FSCK_USAGE 16
+
+#define MAX_THREADS 64
+
+typedef unsigned long bitmap_t;
+#define BITS_PER_WORD (8 * sizeof(bitmap_t))
+
+/*
+ * The image is opened mapped through libddkfs & the entry table is scanned
+ * in as many chunks as there are threads, w/ the entries read & written
+ * back through the engine. Each data block reference is claimed in a shared
+ * bitmap using an atomic fetch-or, so a block claimed a second time is
+ * caught w/o any lock, and noted in the dup bitmap for a second (serial &
+ * rare) pass deciding which entry keeps it.
+ */
+static struct
+{
+	dfs_info_t info;
+	bitmap_t *claimed;
+	bitmap_t *dup;
+	int repair;
+	int verbose;
+} ck;
+
+typedef struct
+{
+	byte4_t start, end; /* Entry range of this thread */
+	byte4_t used_entries;
+	byte4_t bad_names, bad_blocks, bad_sizes, dup_blocks;
+	byte4_t io_errors;
+} chunk_t;
+
+static int test_and_set(bitmap_t *map, byte4_t bit)
+{
+	bitmap_t mask = 1UL << (bit % BITS_PER_WORD);
+
+	return !!(__atomic_fetch_or(&map[bit / BITS_PER_WORD], mask, __ATOMIC_RELAXED) & mask);
+}
+static int test_bit(bitmap_t *map, byte4_t bit)
+{
+	return !!(map[bit / BITS_PER_WORD] & (1UL << (bit % BITS_PER_WORD)));
+}
+
+/* Size must not go past the last block the entry still has */
+static int fix_size(dfs_file_entry_t *fe)
+{
+	int i;
+	byte4_t max_size;
+
+	for (i = DDK_FS_DATA_BLOCK_CNT; i > 0; i--)
+	{
+		if (fe->blocks[i - 1]) break;
+	}
+	max_size = i * ck.info.sb.block_size;
+	if (fe->size <= max_size)
+		return 0;
+	if (ck.repair)
+		fe->size = max_size;
+	return 1;
+}
+
+static void *scan_chunk(void *arg)
+{
+	chunk_t *c = (chunk_t *)(arg);
+	dfs_file_entry_t entry, *fe = &entry;
+	byte4_t ino, b;
+	int i, fixed;
+
+	for (ino = c->start; ino < c->end; ino++)
+	{
+		if (dfs_read_file_entry(&ck.info, S2V_INODE_NUM(ino), fe) < 0)
+		{
+			fprintf(stderr, "Entry %u: Read error\n", ino);
+			c->io_errors++;
+			continue;
+		}
+		if (!fe->name[0]) continue;
+		c->used_entries++;
+		fixed = 0;
+		if (fe->name[DDK_FS_FILENAME_LEN])
+		{
+			if (ck.verbose)
+				printf("Entry %u: Unterminated file name\n", ino);
+			c->bad_names++;
+			if (ck.repair)
+			{
+				fe->name[DDK_FS_FILENAME_LEN] = 0;
+				fixed = 1;
+			}
+		}
+		for (i = 0; i < DDK_FS_DATA_BLOCK_CNT; i++)
+		{
+			if (!(b = fe->blocks[i])) continue;
+			if ((b < ck.info.sb.data_block_start) || (b >= ck.info.sb.partition_size))
+			{
+				if (ck.verbose)
+					printf("Entry %u (%.15s): Block %u outside %u..%u\n",
+						ino, fe->name, b, ck.info.sb.data_block_start, ck.info.sb.partition_size - 1);
+				c->bad_blocks++;
+				if (ck.repair)
+				{
+					fe->blocks[i] = 0;
+					fixed = 1;
+				}
+			}
+			else if (test_and_set(ck.claimed, b))
+			{
+				test_and_set(ck.dup, b);
+				c->dup_blocks++;
+			}
+		}
+		if (fix_size(fe))
+		{
+			if (ck.verbose)
+				printf("Entry %u (%.15s): Size %u beyond its blocks\n", ino, fe->name, fe->size);
+			c->bad_sizes++;
+			fixed = ck.repair;
+		}
+		if (fixed && (dfs_write_file_entry(&ck.info, S2V_INODE_NUM(ino), fe) < 0))
+		{
+			fprintf(stderr, "Entry %u: Write error\n", ino);
+			c->io_errors++;
+		}
+	}
+	return NULL;
+}
+
+/* Keeps each multiply claimed block w/ its lowest numbered entry; Returns < 0 on I/O errors */
+static int resolve_dups(void)
+{
+	bitmap_t *seen;
+	dfs_file_entry_t entry, *fe = &entry;
+	byte4_t ino, b;
+	int i, cleared;
+	int retval = 0;
+
+	seen = calloc(ck.info.sb.partition_size / BITS_PER_WORD + 1, sizeof(bitmap_t));
+	if (!seen)
+	{
+		fprintf(stderr, "Out of memory resolving duplicate blocks\n");
+		return -ENOMEM;
+	}
+	for (ino = 0; ino < ck.info.sb.entry_count; ino++)
+	{
+		if (dfs_read_file_entry(&ck.info, S2V_INODE_NUM(ino), fe) < 0)
+		{
+			retval = -EIO;
+			continue;
+		}
+		if (!fe->name[0]) continue;
+		cleared = 0;
+		for (i = 0; i < DDK_FS_DATA_BLOCK_CNT; i++)
+		{
+			b = fe->blocks[i];
+			if (!b || (b >= ck.info.sb.partition_size) || !test_bit(ck.dup, b)) continue;
+			if (test_and_set(seen, b))
+			{
+				printf("Entry %u (%.15s): Block %u already claimed by another entry%s\n",
+					ino, fe->name, b, ck.repair ? "; Cleared" : "");
+				if (ck.repair)
+				{
+					fe->blocks[i] = 0;
+					cleared = 1;
+				}
+			}
+		}
+		if (cleared)
+		{
+			fix_size(fe);
+			if (dfs_write_file_entry(&ck.info, S2V_INODE_NUM(ino), fe) < 0)
+				retval = -EIO;
+		}
+	}
+	free(seen);
+	return retval;
+}
+
+/* Returns 0 if fine, 1 if fixed / fixable, -1 if unusable */
+static int check_super_block(byte8_t dev_blocks)
+{
+	dfs_super_block_t *sb = &ck.info.sb;
+	byte4_t capacity;
+	int problems = 0;
+
+	if (sb->type != DDK_FS_TYPE)
+	{
+		fprintf(stderr, "Not a DDK FS (magic 0x%08X)\n", sb->type);
+		return -1;
+	}
+	if ((sb->block_size != DDK_FS_BLOCK_SIZE) || (sb->entry_size != DDK_FS_ENTRY_SIZE))
+	{
+		fprintf(stderr, "Unsupported block size (%u) or entry size (%u)\n", sb->block_size, sb->entry_size);
+		return -1;
+	}
+	if (sb->partition_size > dev_blocks)
+	{
+		printf("Partition size %u beyond the device's %Lu blocks%s\n", sb->partition_size, dev_blocks,
+			ck.repair ? "; Shrunk" : "");
+		if (ck.repair)
+			sb->partition_size = dev_blocks;
+		problems = 1;
+	}
+	if ((sb->entry_table_block_start == 0) ||
+		(sb->entry_table_block_start + sb->entry_table_size > sb->partition_size) ||
+		(sb->entry_table_block_start + sb->entry_table_size > dev_blocks))
+	{
+		fprintf(stderr, "Entry table (%u+%u) outside the partition\n", sb->entry_table_block_start,
+			sb->entry_table_size);
+		return -1;
+	}
+	if (sb->data_block_start < sb->entry_table_block_start + sb->entry_table_size)
+	{
+		printf("Data block start %u inside the entry table%s\n", sb->data_block_start,
+			ck.repair ? "; Moved past it" : "");
+		if (ck.repair)
+			sb->data_block_start = sb->entry_table_block_start + sb->entry_table_size;
+		problems = 1;
+	}
+	if (sb->data_block_start > sb->partition_size)
+	{
+		fprintf(stderr, "Data block start %u beyond the partition's %u blocks\n", sb->data_block_start,
+			sb->partition_size);
+		return -1;
+	}
+	if ((sb->flags & DDK_FS_FLAG_LAZY_INIT) && (sb->entry_table_init_size > sb->entry_table_size))
+	{
+		printf("Initialised entry table size %u beyond the entry table's %u%s\n", sb->entry_table_init_size,
+			sb->entry_table_size, ck.repair ? "; Fixed" : "");
+		if (ck.repair)
+			sb->entry_table_init_size = sb->entry_table_size;
+		problems = 1;
+	}
+	capacity = sb->entry_table_size * (sb->block_size / sb->entry_size);
+	if (sb->entry_count > capacity)
+	{
+		printf("Entry count %u beyond the entry table's %u%s\n", sb->entry_count, capacity,
+			ck.repair ? "; Fixed" : "");
+		if (ck.repair)
+			sb->entry_count = capacity;
+		problems = 1;
+	}
+	return problems;
+}
+
+static byte4_t count_claimed(void)
+{
+	byte4_t i, cnt = 0;
+
+	for (i = 0; i < ck.info.sb.partition_size / BITS_PER_WORD + 1; i++)
+	{
+		cnt += __builtin_popcountl(ck.claimed[i]);
+	}
+	return cnt;
+}
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "Usage: %s [-n | -y] [-v] [-j <threads>] <partition's device file or image>\n", prog);
+	fprintf(stderr, "\t-n: Only check (default)\n\t-y: Repair\n\t-v: Report each problem\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, threads = sysconf(_SC_NPROCESSORS_ONLN);
+	pthread_t tid[MAX_THREADS];
+	chunk_t chunks[MAX_THREADS], total;
+	byte4_t per_chunk, data_blocks, used_blocks;
+	int i, sb_state, retval;
+
+	while ((opt = getopt(argc, argv, "nyapvj:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n':
+				ck.repair = 0;
+				break;
+			case 'y':
+			case 'a': /* As passed by fsck(8) */
+			case 'p':
+				ck.repair = 1;
+				break;
+			case 'v':
+				ck.verbose = 1;
+				break;
+			case 'j':
+				threads = atoi(optarg);
+				break;
+			default:
+				usage(argv[0]);
+				return FSCK_USAGE;
+		}
+	}
+	if (optind != argc - 1)
+	{
+		usage(argv[0]);
+		return FSCK_USAGE;
+	}
+	if (threads < 1) threads = 1;
+	if (threads > MAX_THREADS) threads = MAX_THREADS;
+
+	if ((retval = dfs_uio_open(&ck.info, argv[optind], DFS_UIO_MMAP | (ck.repair ? 0 : DFS_UIO_RDONLY))) < 0)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", argv[optind], strerror(-retval));
+		return FSCK_ERROR;
+	}
+	if (ck.info.dev_size < DDK_FS_BLOCK_SIZE)
+	{
+		fprintf(stderr, "%s is too small for a DDK FS\n", argv[optind]);
+		dfs_uio_close(&ck.info);
+		return FSCK_ERROR;
+	}
+
+	/* Super block; checked & repaired ahead of the engine taking it up */
+	if ((retval = dfs_uio_read_run(&ck.info, 0, 0, &ck.info.sb, DDK_FS_BLOCK_SIZE)) < 0)
+	{
+		fprintf(stderr, "Error reading the super block: %s\n", strerror(-retval));
+		dfs_uio_close(&ck.info);
+		return FSCK_ERROR;
+	}
+	if ((sb_state = check_super_block(ck.info.dev_size / DDK_FS_BLOCK_SIZE)) < 0)
+	{
+		dfs_uio_close(&ck.info);
+		return FSCK_UNCORRECTED;
+	}
+	if (sb_state && ck.repair &&
+		((retval = dfs_uio_write_run(&ck.info, 0, 0, &ck.info.sb, DDK_FS_BLOCK_SIZE)) < 0))
+	{
+		fprintf(stderr, "Error writing the super block: %s\n", strerror(-retval));
+		dfs_uio_close(&ck.info);
+		return FSCK_ERROR;
+	}
+	if ((retval = dfs_init(&ck.info)) < 0)
+	{
+		fprintf(stderr, "Error loading the DDK FS: %s\n", strerror(-retval));
+		dfs_uio_close(&ck.info);
+		return sb_state ? FSCK_UNCORRECTED : FSCK_ERROR;
+	}
+	ck.claimed = calloc(ck.info.sb.partition_size / BITS_PER_WORD + 1, sizeof(bitmap_t));
+	ck.dup = calloc(ck.info.sb.partition_size / BITS_PER_WORD + 1, sizeof(bitmap_t));
+	if (!ck.claimed || !ck.dup)
+	{
+		fprintf(stderr, "Out of memory for the block bitmaps\n");
+		return FSCK_ERROR;
+	}
+
+	/* Entry table, in parallel chunks; The engine reads the not yet zeroed part of it as empty */
+	per_chunk = (ck.info.sb.entry_count + threads - 1) / threads;
+	for (i = 0; i < threads; i++)
+	{
+		memset(&chunks[i], 0, sizeof(chunk_t));
+		chunks[i].start = i * per_chunk;
+		chunks[i].end = (i + 1) * per_chunk;
+		if (chunks[i].start > ck.info.sb.entry_count) chunks[i].start = ck.info.sb.entry_count;
+		if (chunks[i].end > ck.info.sb.entry_count) chunks[i].end = ck.info.sb.entry_count;
+		if ((retval = pthread_create(&tid[i], NULL, scan_chunk, &chunks[i])) != 0)
+		{
+			fprintf(stderr, "Error creating scanner thread: %s\n", strerror(retval));
+			return FSCK_ERROR;
+		}
+	}
+	memset(&total, 0, sizeof(chunk_t));
+	for (i = 0; i < threads; i++)
+	{
+		pthread_join(tid[i], NULL);
+		total.used_entries += chunks[i].used_entries;
+		total.bad_names += chunks[i].bad_names;
+		total.bad_blocks += chunks[i].bad_blocks;
+		total.bad_sizes += chunks[i].bad_sizes;
+		total.dup_blocks += chunks[i].dup_blocks;
+		total.io_errors += chunks[i].io_errors;
+	}
+	if (total.dup_blocks && (resolve_dups() < 0))
+	{
+		total.io_errors++;
+	}
+
+	/* Free map, as the mount would build it */
+	data_blocks = ck.info.sb.partition_size - ck.info.sb.data_block_start;
+	used_blocks = count_claimed();
+
+	if (total.bad_names) printf("%u unterminated file name(s)\n", total.bad_names);
+	if (total.bad_blocks) printf("%u out of range block reference(s)\n", total.bad_blocks);
+	if (total.dup_blocks) printf("%u multiply claimed block reference(s)\n", total.dup_blocks);
+	if (total.bad_sizes) printf("%u file size(s) beyond the allocated blocks\n", total.bad_sizes);
+	printf("%s: %u/%u entries, %u/%u data blocks\n", argv[optind],
+		total.used_entries, ck.info.sb.entry_count, used_blocks, data_blocks);
+
+	if (ck.repair && ((retval = dfs_uio_sync(&ck.info)) < 0))
+	{
+		fprintf(stderr, "Error writing back %s: %s\n", argv[optind], strerror(-retval));
+		return FSCK_ERROR;
+	}
+	dfs_shut(&ck.info);
+	dfs_uio_close(&ck.info);
+
+	if (total.io_errors)
+		return FSCK_ERROR;
+	if (!sb_state && !total.bad_names && !total.bad_blocks && !total.dup_blocks && !total.bad_sizes)
+		return FSCK_OK;
+	return ck.repair ? FSCK_NONDESTRUCT : FSCK_UNCORRECTED;
+}
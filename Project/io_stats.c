@@ -0,0 +1,317 @@
+/*
+ * Per device I/O stats of the block drivers: linked into each of them, w/
+ * its debugfs directory named after the module, as passed in by it
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/log2.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/kobject.h>
+#include <linux/sysfs.h>
+#include <linux/seq_file.h>
+#include <linux/debugfs.h>
+#include <linux/fs.h>
+#include <linux/genhd.h>
+
+#include "io_stats.h"
+
+static DEFINE_MUTEX(ios_root_lock);
+static struct dentry *ios_root; /* <module>/ in debugfs, w/ a directory per disk */
+static int ios_root_users;
+
+static inline int ios_lat_bucket(u64 ns)
+{
+	return ns ? min_t(int, ilog2(ns), IOS_LAT_BUCKETS - 1) : 0;
+}
+static inline int ios_size_bucket(unsigned int bytes)
+{
+	unsigned int sectors = bytes >> 9;
+
+	return sectors ? min_t(int, ilog2(sectors), IOS_SIZE_BUCKETS - 1) : 0;
+}
+
+void ios_account(struct io_stats *st, int dir, unsigned int bytes, u64 start)
+{
+	u64 lat = ios_now() - start;
+
+	dir = (dir == WRITE) ? 1 : 0;
+	this_cpu_inc(st->cpu->ops[dir]);
+	this_cpu_add(st->cpu->bytes[dir], bytes);
+	this_cpu_inc(st->cpu->lat[dir][ios_size_bucket(bytes)][ios_lat_bucket(lat)]);
+}
+/* Racing w/ the accounting in progress, if any; so a count or so may survive */
+void ios_reset(struct io_stats *st)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+	{
+		memset(per_cpu_ptr(st->cpu, cpu), 0, sizeof(struct ios_cpu));
+	}
+}
+/* Sums up the per CPU stats */
+static void ios_sum(struct io_stats *st, struct ios_cpu *sum)
+{
+	struct ios_cpu *c;
+	int cpu, d, s, l;
+
+	memset(sum, 0, sizeof(struct ios_cpu));
+	for_each_possible_cpu(cpu)
+	{
+		c = per_cpu_ptr(st->cpu, cpu);
+		for (d = 0; d < 2; d++)
+		{
+			sum->ops[d] += c->ops[d];
+			sum->bytes[d] += c->bytes[d];
+			for (s = 0; s < IOS_SIZE_BUCKETS; s++)
+				for (l = 0; l < IOS_LAT_BUCKETS; l++)
+					sum->lat[d][s][l] += c->lat[d][s][l];
+		}
+	}
+}
+
+/*
+ * sysfs: the counts, a latency histogram per direction (over all sizes), &
+ * reset
+ */
+struct ios_attr
+{
+	struct attribute attr;
+	ssize_t (*show)(struct io_stats *st, char *buf);
+	ssize_t (*store)(struct io_stats *st, const char *buf, size_t count);
+};
+
+static ssize_t ios_show_count(struct io_stats *st, char *buf, int dir, int bytes)
+{
+	struct ios_cpu *c;
+	u64 sum = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+	{
+		c = per_cpu_ptr(st->cpu, cpu);
+		sum += bytes ? c->bytes[dir] : c->ops[dir];
+	}
+	return sprintf(buf, "%llu\n", (unsigned long long)sum);
+}
+static ssize_t ios_read_ops_show(struct io_stats *st, char *buf)
+{
+	return ios_show_count(st, buf, 0, 0);
+}
+static ssize_t ios_read_bytes_show(struct io_stats *st, char *buf)
+{
+	return ios_show_count(st, buf, 0, 1);
+}
+static ssize_t ios_write_ops_show(struct io_stats *st, char *buf)
+{
+	return ios_show_count(st, buf, 1, 0);
+}
+static ssize_t ios_write_bytes_show(struct io_stats *st, char *buf)
+{
+	return ios_show_count(st, buf, 1, 1);
+}
+static ssize_t ios_show_lat(struct io_stats *st, char *buf, int dir)
+{
+	struct ios_cpu *sum;
+	u64 cnt;
+	ssize_t len = 0;
+	int s, l;
+
+	/* Too big for the stack */
+	if (!(sum = kmalloc(sizeof(struct ios_cpu), GFP_KERNEL)))
+		return -ENOMEM;
+	ios_sum(st, sum);
+	for (l = 0; l < IOS_LAT_BUCKETS; l++)
+	{
+		for (cnt = 0, s = 0; s < IOS_SIZE_BUCKETS; s++)
+			cnt += sum->lat[dir][s][l];
+		len += sprintf(buf + len, "%llu%c", (unsigned long long)cnt, (l == IOS_LAT_BUCKETS - 1) ? '\n' : ' ');
+	}
+	kfree(sum);
+	return len;
+}
+static ssize_t ios_read_latency_show(struct io_stats *st, char *buf)
+{
+	return ios_show_lat(st, buf, 0);
+}
+static ssize_t ios_write_latency_show(struct io_stats *st, char *buf)
+{
+	return ios_show_lat(st, buf, 1);
+}
+static ssize_t ios_reset_store(struct io_stats *st, const char *buf, size_t count)
+{
+	ios_reset(st);
+	return count;
+}
+
+#define IOS_ATTR_RO(_name) \
+	static struct ios_attr ios_attr_##_name = { .attr = { .name = #_name, .mode = S_IRUGO }, .show = ios_##_name##_show }
+IOS_ATTR_RO(read_ops);
+IOS_ATTR_RO(read_bytes);
+IOS_ATTR_RO(write_ops);
+IOS_ATTR_RO(write_bytes);
+IOS_ATTR_RO(read_latency);
+IOS_ATTR_RO(write_latency);
+static struct ios_attr ios_attr_reset = { .attr = { .name = "reset", .mode = S_IWUSR }, .store = ios_reset_store };
+
+static struct attribute *ios_attrs[] =
+{
+	&ios_attr_read_ops.attr,
+	&ios_attr_read_bytes.attr,
+	&ios_attr_write_ops.attr,
+	&ios_attr_write_bytes.attr,
+	&ios_attr_read_latency.attr,
+	&ios_attr_write_latency.attr,
+	&ios_attr_reset.attr,
+	NULL,
+};
+
+static ssize_t ios_attr_show(struct kobject *kobj, struct attribute *attr, char *buf)
+{
+	struct ios_attr *a = container_of(attr, struct ios_attr, attr);
+
+	if (!a->show)
+		return -EIO;
+	return a->show(container_of(kobj, struct io_stats, kobj), buf);
+}
+static ssize_t ios_attr_store(struct kobject *kobj, struct attribute *attr, const char *buf, size_t count)
+{
+	struct ios_attr *a = container_of(attr, struct ios_attr, attr);
+
+	if (!a->store)
+		return -EIO;
+	return a->store(container_of(kobj, struct io_stats, kobj), buf, count);
+}
+static const struct sysfs_ops ios_sysfs_ops =
+{
+	.show = ios_attr_show,
+	.store = ios_attr_store,
+};
+/* The io_stats lives w/ its device; so just let ios_unregister know, it is free to go */
+static void ios_kobj_release(struct kobject *kobj)
+{
+	complete(&container_of(kobj, struct io_stats, kobj)->kobj_released);
+}
+static struct kobj_type ios_ktype =
+{
+	.sysfs_ops = &ios_sysfs_ops,
+	.release = ios_kobj_release,
+	.default_attrs = ios_attrs,
+};
+
+/*
+ * debugfs: the full histograms, by direction & size; any write resets them
+ */
+static int ios_hist_show(struct seq_file *m, void *v)
+{
+	struct io_stats *st = m->private;
+	struct ios_cpu *sum;
+	int d, s, l;
+
+	if (!(sum = kmalloc(sizeof(struct ios_cpu), GFP_KERNEL)))
+		return -ENOMEM;
+	ios_sum(st, sum);
+	for (d = 0; d < 2; d++)
+	{
+		seq_printf(m, "%s ops %llu bytes %llu\n", d ? "write" : "read",
+			(unsigned long long)sum->ops[d], (unsigned long long)sum->bytes[d]);
+		seq_printf(m, "%-8s", "sectors");
+		for (l = 0; l < IOS_LAT_BUCKETS; l++)
+			seq_printf(m, " %llu", 1ULL << l);
+		seq_printf(m, " (ns)\n");
+		for (s = 0; s < IOS_SIZE_BUCKETS; s++)
+		{
+			seq_printf(m, "%-8u", 1U << s);
+			for (l = 0; l < IOS_LAT_BUCKETS; l++)
+				seq_printf(m, " %llu", (unsigned long long)sum->lat[d][s][l]);
+			seq_printf(m, "\n");
+		}
+	}
+	kfree(sum);
+	return 0;
+}
+static int ios_hist_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, ios_hist_show, inode->i_private);
+}
+static ssize_t ios_hist_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+	ios_reset(((struct seq_file *)(file->private_data))->private);
+	return count;
+}
+static struct file_operations ios_hist_fops =
+{
+	owner: THIS_MODULE,
+	open: ios_hist_open,
+	read: seq_read,
+	write: ios_hist_write,
+	llseek: seq_lseek,
+	release: single_release
+};
+
+int ios_init(struct io_stats *st)
+{
+	memset(st, 0, sizeof(struct io_stats));
+	if (!(st->cpu = alloc_percpu(struct ios_cpu)))
+		return -ENOMEM;
+	return 0;
+}
+void ios_cleanup(struct io_stats *st)
+{
+	free_percpu(st->cpu);
+	st->cpu = NULL;
+}
+
+void ios_register(struct io_stats *st, struct gendisk *disk, const char *module)
+{
+	init_completion(&st->kobj_released);
+	if (kobject_init_and_add(&st->kobj, &ios_ktype, &disk_to_dev(disk)->kobj, "io_stats") < 0)
+	{
+		printk(KERN_WARNING "%s: I/O stats not available in sysfs for %s\n", module, disk->disk_name);
+		kobject_put(&st->kobj);
+		wait_for_completion(&st->kobj_released);
+	}
+	else
+	{
+		st->registered = 1;
+	}
+
+	mutex_lock(&ios_root_lock);
+	if (!ios_root_users++)
+		ios_root = debugfs_create_dir(module, NULL);
+	if (!IS_ERR_OR_NULL(ios_root)) // No debugfs; the histograms are just not exposed there then
+	{
+		st->debugfs_dir = debugfs_create_dir(disk->disk_name, ios_root);
+		if (IS_ERR_OR_NULL(st->debugfs_dir))
+			st->debugfs_dir = NULL;
+		else
+			debugfs_create_file("latency", S_IRUGO | S_IWUSR, st->debugfs_dir, st, &ios_hist_fops);
+	}
+	mutex_unlock(&ios_root_lock);
+}
+void ios_unregister(struct io_stats *st)
+{
+	mutex_lock(&ios_root_lock);
+	debugfs_remove_recursive(st->debugfs_dir);
+	st->debugfs_dir = NULL;
+	if (!--ios_root_users)
+	{
+		debugfs_remove_recursive(ios_root);
+		ios_root = NULL;
+	}
+	mutex_unlock(&ios_root_lock);
+
+	if (st->registered)
+	{
+		kobject_put(&st->kobj);
+		/* Till sysfs is done w/ it */
+		wait_for_completion(&st->kobj_released);
+		st->registered = 0;
+	}
+}
@@ -0,0 +1,49 @@
+#ifndef IO_STATS_H
+#define IO_STATS_H
+
+#include <linux/types.h>
+#include <linux/kobject.h>
+#include <linux/completion.h>
+#include <linux/ktime.h>
+#include <linux/percpu.h>
+#include <linux/genhd.h>
+
+#define IOS_LAT_BUCKETS 32 /* Latencies in [2^i, 2^(i + 1)) ns; the last one, all beyond */
+#define IOS_SIZE_BUCKETS 8 /* Sizes in [2^i, 2^(i + 1)) sectors; the last one, all beyond */
+
+/* Per CPU, so that accounting is just a few increments, w/o any sharing */
+struct ios_cpu
+{
+	u64 ops[2]; /* By READ / WRITE */
+	u64 bytes[2];
+	u64 lat[2][IOS_SIZE_BUCKETS][IOS_LAT_BUCKETS];
+};
+
+/*
+ * Per device I/O stats: latency histograms by direction & size, & byte & op
+ * counts. In /sys/block/<disk>/io_stats/, & /sys/kernel/debug/<module>/<disk>/
+ */
+struct io_stats
+{
+	struct ios_cpu __percpu *cpu;
+	struct kobject kobj; /* io_stats/ */
+	struct completion kobj_released;
+	int registered;
+	struct dentry *debugfs_dir;
+};
+
+static inline u64 ios_now(void)
+{
+	return ktime_to_ns(ktime_get());
+}
+
+extern int ios_init(struct io_stats *st);
+extern void ios_cleanup(struct io_stats *st);
+/* Exposes the stats, for the disk, once added; module names the debugfs directory */
+extern void ios_register(struct io_stats *st, struct gendisk *disk, const char *module);
+/* & before it is deleted */
+extern void ios_unregister(struct io_stats *st);
+/* Accounts an I/O of bytes, started at start (from ios_now) */
+extern void ios_account(struct io_stats *st, int dir, unsigned int bytes, u64 start);
+extern void ios_reset(struct io_stats *st);
+#endif
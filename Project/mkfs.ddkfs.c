@@ -1,3 +1,4 @@
+#define _GNU_SOURCE /* For fallocate() */
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -7,12 +8,17 @@
 #include <errno.h> /* For errno */
 #include <string.h> /* For strerror() */
 #include <sys/ioctl.h> /* For ioctl() */
-#include <linux/fs.h> /* For BLKGETSIZE64 */
+#include <linux/fs.h> /* For BLKGETSIZE64, BLKDISCARD, BLKZEROOUT */
+#include <linux/falloc.h> /* For FALLOC_FL_* */
 
 #include "ddk_fs_ds.h"
 
-#define DFS_ENTRY_RATIO 0.10 /* 10% of all blocks */
+#define DFS_ENTRY_RATIO 10.0 /* % of all blocks */
 #define DFS_ENTRY_TABLE_BLOCK_START 1
+#define DFS_IO_BUF_SIZE (1024 * 1024) /* Size of each write while zeroing */
+#define DFS_IO_BUF_ALIGN 4096 /* Good for O_DIRECT & the device's pages */
+#define DFS_DATA_ALIGN 4096 /* Of the data blocks, for page-sized I/Os not to straddle the device's pages */
+#define DFS_LAZY_INIT_SIZE (DFS_IO_BUF_SIZE / DDK_FS_BLOCK_SIZE) /* Blocks zeroed upfront, in lazy mode */
 
 dfs_super_block_t sb =
 {
@@ -21,61 +27,190 @@ dfs_super_block_t sb =
 	.entry_size = DDK_FS_ENTRY_SIZE,
 	.entry_table_block_start = DFS_ENTRY_TABLE_BLOCK_START
 };
-dfs_file_entry_t fe; /* All 0's */
 
-void write_super_block(int dfs_handle, dfs_super_block_t *sb)
+int write_super_block(int dfs_handle, dfs_super_block_t *sb)
 {
-	write(dfs_handle, sb, sizeof(dfs_super_block_t));
+	if (pwrite(dfs_handle, sb, sizeof(dfs_super_block_t), 0) != sizeof(dfs_super_block_t))
+		return -1;
+	return 0;
 }
-void clear_file_entries(int dfs_handle, dfs_super_block_t *sb)
+/*
+ * Zeroes len bytes from offset: by the device itself if it can (BLKZEROOUT),
+ * by punching a hole for an image file, or else by large aligned writes
+ */
+int zero_range(int dfs_handle, int is_blk, byte8_t offset, byte8_t len)
 {
-	int i;
-	byte1_t block[DDK_FS_BLOCK_SIZE];
+	byte8_t range[2] = {offset, len};
+	byte1_t *buf;
+	ssize_t chunk;
 
-	for (i = 0; i < sb->block_size / sb->entry_size; i++)
+	if (is_blk && (ioctl(dfs_handle, BLKZEROOUT, range) == 0))
+	{
+		return 0;
+	}
+	if (!is_blk && (fallocate(dfs_handle, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, len) == 0))
+	{
+		return 0;
+	}
+	if (posix_memalign((void **)(&buf), DFS_IO_BUF_ALIGN, DFS_IO_BUF_SIZE))
 	{
-		memcpy(block + i * sb->entry_size, &fe, sizeof(fe));
+		errno = ENOMEM;
+		return -1;
 	}
-	for (i = 0; i < sb->entry_table_size; i++)
+	memset(buf, 0, DFS_IO_BUF_SIZE);
+	while (len)
+	{
+		chunk = (len < DFS_IO_BUF_SIZE) ? len : DFS_IO_BUF_SIZE;
+		if ((chunk = pwrite(dfs_handle, buf, chunk, offset)) <= 0)
+		{
+			free(buf);
+			return -1;
+		}
+		offset += chunk;
+		len -= chunk;
+	}
+	free(buf);
+	return 0;
+}
+/* Discards the whole device, if it supports it; what it then reads back is not relied upon */
+int discard_device(int dfs_handle, byte8_t size)
+{
+	byte8_t range[2] = {0, size};
+
+	return ioctl(dfs_handle, BLKDISCARD, range);
+}
+int clear_file_entries(int dfs_handle, int is_blk, dfs_super_block_t *sb)
+{
+	byte4_t blocks = sb->entry_table_size;
+
+	if (sb->flags & DDK_FS_FLAG_LAZY_INIT)
 	{
-		write(dfs_handle, block, sizeof(block));
+		/* Rest is zeroed by the kernel, in background after mount */
+		blocks = sb->entry_table_init_size;
 	}
+	return zero_range(dfs_handle, is_blk, (byte8_t)sb->entry_table_block_start * sb->block_size,
+		(byte8_t)blocks * sb->block_size);
+}
+
+void usage(char *prog)
+{
+	fprintf(stderr, "Usage: %s [-r <entry table %%>] [-a <data alignment>] [-l] [-d] <partition's device file or image>\n", prog);
+	fprintf(stderr, "\t-r: Percentage of blocks for the entry table (default %.0f)\n", DFS_ENTRY_RATIO);
+	fprintf(stderr, "\t-a: Alignment of the data blocks in bytes, a multiple of %d; the entry table grows up to it (default %d)\n", DDK_FS_BLOCK_SIZE, DFS_DATA_ALIGN);
+	fprintf(stderr, "\t-l: Lazily initialise the entry table, after mount\n");
+	fprintf(stderr, "\t-d: Discard the whole device first, if it supports it\n");
 }
 
 int main(int argc, char *argv[])
 {
-	int dfs_handle;
+	int opt, lazy = 0, discard = 0;
+	double ratio = DFS_ENTRY_RATIO;
+	int dfs_handle, is_blk;
+	struct stat st;
 	byte8_t size;
+	long align = DFS_DATA_ALIGN;
+	byte4_t align_blocks;
 
-	if (argc != 2)
+	while ((opt = getopt(argc, argv, "r:a:ld")) != -1)
 	{
-		fprintf(stderr, "Usage: %s <partition's device file>\n", argv[0]);
+		switch (opt)
+		{
+			case 'r':
+				ratio = atof(optarg);
+				if ((ratio <= 0) || (ratio >= 100))
+				{
+					fprintf(stderr, "Entry table percentage should be in (0, 100)\n");
+					return 1;
+				}
+				break;
+			case 'a':
+				align = atol(optarg);
+				if ((align <= 0) || (align % DDK_FS_BLOCK_SIZE))
+				{
+					fprintf(stderr, "Data alignment should be a non-zero multiple of %d\n", DDK_FS_BLOCK_SIZE);
+					return 1;
+				}
+				break;
+			case 'l':
+				lazy = 1;
+				break;
+			case 'd':
+				discard = 1;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if (optind != argc - 1)
+	{
+		usage(argv[0]);
 		return 1;
 	}
-	dfs_handle = open(argv[1], O_RDWR);
-	if (dfs_handle == -1)
+	dfs_handle = open(argv[optind], O_RDWR);
+	if ((dfs_handle == -1) || (fstat(dfs_handle, &st) == -1))
 	{
-		fprintf(stderr, "Error formatting %s: %s\n", argv[1], strerror(errno));
+		fprintf(stderr, "Error formatting %s: %s\n", argv[optind], strerror(errno));
 		return 2;
 	}
-	if (ioctl(dfs_handle, BLKGETSIZE64, &size) == -1)
+	is_blk = S_ISBLK(st.st_mode);
+	if (is_blk)
 	{
-		fprintf(stderr, "Error getting size of %s: %s\n", argv[1], strerror(errno));
-		return 3;
+		if (ioctl(dfs_handle, BLKGETSIZE64, &size) == -1)
+		{
+			fprintf(stderr, "Error getting size of %s: %s\n", argv[optind], strerror(errno));
+			return 3;
+		}
 	}
-	/* TODO: Fill up the partition size in blocks */
+	else
+	{
+		size = st.st_size;
+	}
+	/* Partition size in blocks */
 	sb.partition_size = size / DDK_FS_BLOCK_SIZE;
-	/* TODO: Fill up the entry table size in blocks */
-	sb.entry_table_size = sb.partition_size * DFS_ENTRY_RATIO;
-	/* TODO: Fill up the total number of entries */
-	sb.entry_count = sb.entry_table_size * sb.block_size / sb.entry_size;
-	/* Block number of the first data block */
+	/* Entry table size in blocks */
+	sb.entry_table_size = sb.partition_size * ratio / 100;
+	if (sb.entry_table_size == 0)
+	{
+		sb.entry_table_size = 1;
+	}
+	/* Block number of the first data block; aligned, w/ the entry table taking up the gap */
+	align_blocks = align / DDK_FS_BLOCK_SIZE;
 	sb.data_block_start = DFS_ENTRY_TABLE_BLOCK_START +  sb.entry_table_size;
+	sb.data_block_start = (sb.data_block_start + align_blocks - 1) / align_blocks * align_blocks;
+	sb.entry_table_size = sb.data_block_start - DFS_ENTRY_TABLE_BLOCK_START;
+	/* Total number of entries */
+	sb.entry_count = sb.entry_table_size * sb.block_size / sb.entry_size;
+	if (sb.data_block_start >= sb.partition_size)
+	{
+		fprintf(stderr, "%s is too small (%Ld bytes) for a DDK FS\n", argv[optind], size);
+		return 3;
+	}
+	if (lazy && (sb.entry_table_size > DFS_LAZY_INIT_SIZE))
+	{
+		sb.flags |= DDK_FS_FLAG_LAZY_INIT;
+		sb.entry_table_init_size = DFS_LAZY_INIT_SIZE;
+	}
 
-	printf("Partitioning %Ld byte sized %s ... ", size, argv[1]);
+	printf("Partitioning %Ld byte sized %s ... ", size, argv[optind]);
 	fflush(stdout);
-	write_super_block(dfs_handle, &sb);
-	clear_file_entries(dfs_handle, &sb);
+	if (is_blk && discard && (discard_device(dfs_handle, size) == -1))
+	{
+		printf("(no discard: %s) ", strerror(errno));
+		fflush(stdout);
+	}
+	/*
+	 * Any old super block is invalidated first & the new one goes last, so
+	 * that an interrupted format isn't taken as valid, w/ a stale table
+	 */
+	if ((zero_range(dfs_handle, is_blk, 0, DDK_FS_BLOCK_SIZE) == -1) || (fsync(dfs_handle) == -1) ||
+		(clear_file_entries(dfs_handle, is_blk, &sb) == -1) || (fsync(dfs_handle) == -1) ||
+		(write_super_block(dfs_handle, &sb) == -1) || (fsync(dfs_handle) == -1))
+	{
+		fprintf(stderr, "\nError formatting %s: %s\n", argv[optind], strerror(errno));
+		close(dfs_handle);
+		return 4;
+	}
 
 	close(dfs_handle);
 	printf("done\n");
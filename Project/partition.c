@@ -1,9 +1,9 @@
+#include <linux/kernel.h>
 #include <linux/string.h>
+#include <linux/errno.h>
 
 #include "partition.h"
 
-#define ARRAY_SIZE(a) (sizeof(a) / sizeof(*a))
-
 #define SECTOR_SIZE 512
 #define MBR_SIZE SECTOR_SIZE
 #define MBR_DISK_SIGNATURE_OFFSET 440
@@ -19,6 +19,15 @@
 #define BR_SIGNATURE_SIZE 2
 #define BR_SIGNATURE 0xAA55
 
+#define PART_TYPE_LINUX 0x83
+#define PART_TYPE_EXTENDED 0x05
+#define PRIMARY_CNT 4
+#define MAX_SECTORS 0xFFFFFFFFULL // As addressed by an entry
+/* Geometry, as in rb_getgeo */
+#define GEO_HEADS 1
+#define GEO_SECTORS 32
+#define GEO_MAX_CYL 1023
+
 typedef struct
 {
 	unsigned char boot_type; // 0x00 - Inactive; 0x80 - Active (Bootable)
@@ -37,140 +46,116 @@ typedef struct
 
 typedef PartEntry PartTable[4];
 
-static PartTable def_part_table =
+/* CHS of the absolute sector, or the max one, if beyond; as the start or the end of the entry */
+static void set_chs(PartEntry *pe, int end, sector_t lba)
 {
+	sector_t c = lba / (GEO_HEADS * GEO_SECTORS);
+	unsigned char head, sec, cyl_hi, cyl;
+
+	if (c > GEO_MAX_CYL)
 	{
-		boot_type: 0x00,
-		start_head: 0x00,
-		start_sec: 0x2,
-		start_cyl: 0x00,
-		part_type: 0x83,
-		end_head: 0x00,
-		end_sec: 0x20,
-		end_cyl: 0x09,
-		abs_start_sec: 0x00000001,
-		sec_in_part: 0x0000013F
-	},
-	{
-		boot_type: 0x00,
-		start_head: 0x00,
-		start_sec: 0x1,
-		start_cyl: 0x0A, // extended partition start cylinder (BR location)
-		part_type: 0x05,
-		end_head: 0x00,
-		end_sec: 0x20,
-		end_cyl: 0x13,
-		abs_start_sec: 0x00000140,
-		sec_in_part: 0x00000140
-	},
-	{
-		boot_type: 0x00,
-		start_head: 0x00,
-		start_sec: 0x1,
-		start_cyl: 0x14,
-		part_type: 0x83,
-		end_head: 0x00,
-		end_sec: 0x20,
-		end_cyl: 0x1F,
-		abs_start_sec: 0x00000280,
-		sec_in_part: 0x00000180
-	},
-	{
+		head = 0xFE;
+		sec = 0x3F;
+		cyl_hi = 0x3;
+		cyl = 0xFF;
 	}
-};
-static unsigned int def_log_part_br_cyl[] = {0x0A, 0x0E, 0x12};
-static const PartTable def_log_part_table[] =
-{
+	else
 	{
-		{
-			boot_type: 0x00,
-			start_head: 0x00,
-			start_sec: 0x2,
-			start_cyl: 0x0A,
-			part_type: 0x83,
-			end_head: 0x00,
-			end_sec: 0x20,
-			end_cyl: 0x0D,
-			abs_start_sec: 0x00000001,
-			sec_in_part: 0x0000007F
-		},
-		{
-			boot_type: 0x00,
-			start_head: 0x00,
-			start_sec: 0x1,
-			start_cyl: 0x0E,
-			part_type: 0x05,
-			end_head: 0x00,
-			end_sec: 0x20,
-			end_cyl: 0x11,
-			abs_start_sec: 0x00000080,
-			sec_in_part: 0x00000080
-		},
-	},
+		head = (lba / GEO_SECTORS) % GEO_HEADS;
+		sec = lba % GEO_SECTORS + 1;
+		cyl_hi = (c >> 8) & 0x3;
+		cyl = c & 0xFF;
+	}
+	if (end)
 	{
-		{
-			boot_type: 0x00,
-			start_head: 0x00,
-			start_sec: 0x2,
-			start_cyl: 0x0E,
-			part_type: 0x83,
-			end_head: 0x00,
-			end_sec: 0x20,
-			end_cyl: 0x11,
-			abs_start_sec: 0x00000001,
-			sec_in_part: 0x0000007F
-		},
-		{
-			boot_type: 0x00,
-			start_head: 0x00,
-			start_sec: 0x1,
-			start_cyl: 0x12,
-			part_type: 0x05,
-			end_head: 0x00,
-			end_sec: 0x20,
-			end_cyl: 0x13,
-			abs_start_sec: 0x00000100,
-			sec_in_part: 0x00000040
-		},
-	},
+		pe->end_head = head;
+		pe->end_sec = sec;
+		pe->end_cyl_hi = cyl_hi;
+		pe->end_cyl = cyl;
+	}
+	else
 	{
-		{
-			boot_type: 0x00,
-			start_head: 0x00,
-			start_sec: 0x2,
-			start_cyl: 0x12,
-			part_type: 0x83,
-			end_head: 0x00,
-			end_sec: 0x20,
-			end_cyl: 0x13,
-			abs_start_sec: 0x00000001,
-			sec_in_part: 0x0000003F
-		},
+		pe->start_head = head;
+		pe->start_sec = sec;
+		pe->start_cyl_hi = cyl_hi;
+		pe->start_cyl = cyl;
 	}
-};
-
-static void copy_mbr(u8 *disk)
+}
+/* An entry of start (relative to base, as per its table) & len sectors */
+static void set_entry(PartEntry *pe, unsigned char type, sector_t base, sector_t start, sector_t len)
 {
-	memset(disk, 0x0, MBR_SIZE);
-	*(unsigned long *)(disk + MBR_DISK_SIGNATURE_OFFSET) = 0x36E5756D;
-	memcpy(disk + PARTITION_TABLE_OFFSET, &def_part_table, PARTITION_TABLE_SIZE);
-	*(unsigned short *)(disk + MBR_SIGNATURE_OFFSET) = MBR_SIGNATURE;
+	memset(pe, 0, sizeof(PartEntry));
+	pe->part_type = type;
+	pe->abs_start_sec = start;
+	pe->sec_in_part = len;
+	set_chs(pe, 0, base + start);
+	set_chs(pe, 1, base + start + len - 1);
 }
-static void copy_br(u8 *disk, int start_cylinder, const PartTable *part_table)
+static int write_table(u8 *sector_buf, sector_t sector, PartTable *pt, int mbr, part_write_t write, void *ctx)
 {
-	disk += (start_cylinder * 32 /* sectors / cyl */ * SECTOR_SIZE);
-	memset(disk, 0x0, BR_SIZE);
-	memcpy(disk + PARTITION_TABLE_OFFSET, part_table,
-		PARTITION_TABLE_SIZE);
-	*(unsigned short *)(disk + BR_SIGNATURE_OFFSET) = BR_SIGNATURE;
+	memset(sector_buf, 0x0, SECTOR_SIZE);
+	if (mbr)
+	{
+		*(u32 *)(sector_buf + MBR_DISK_SIGNATURE_OFFSET) = 0x36E5756D;
+	}
+	memcpy(sector_buf + PARTITION_TABLE_OFFSET, pt, PARTITION_TABLE_SIZE);
+	*(unsigned short *)(sector_buf + (mbr ? MBR_SIGNATURE_OFFSET : BR_SIGNATURE_OFFSET)) = mbr ? MBR_SIGNATURE : BR_SIGNATURE;
+	return write(ctx, sector, sector_buf);
 }
-void copy_mbr_n_br(u8 *disk)
+
+/*
+ * Lays out parts equal Linux partitions over the size sectors, each starting
+ * on an align sectors boundary: up to 4 primaries; or else, 3 primaries & an
+ * extended one w/ the rest as logicals, each w/ its EBR an alignment ahead
+ * of it. Each table sector is handed over to write, through sector_buf (of a
+ * sector). Returns < 0, if they don't fit.
+ */
+int make_part_tables(sector_t size, unsigned int align, int parts, u8 *sector_buf, part_write_t write, void *ctx)
 {
-	int i;
+	PartTable pt;
+	sector_t slot, start, ebr, ext_start = 0, ext_len;
+	int primaries = (parts <= PRIMARY_CNT) ? parts : PRIMARY_CNT - 1;
+	int i, ret;
+
+	if (!align || (parts <= 0))
+		return -EINVAL;
+	size = min_t(sector_t, size, MAX_SECTORS);
+	/* The first alignment has the MBR; the rest is split in equal, aligned slots */
+	if (size < 2 * align)
+		return -ENOSPC;
+	slot = (size - align) / parts;
+	slot -= slot % align;
+	/* Logicals lose an alignment to their EBR */
+	if ((slot == 0) || ((parts > PRIMARY_CNT) && (slot < 2 * align)))
+		return -ENOSPC;
 
-	copy_mbr(disk);
-	for (i = 0; i < ARRAY_SIZE(def_log_part_table); i++)
+	memset(pt, 0, sizeof(pt));
+	for (i = 0; i < primaries; i++)
 	{
-		copy_br(disk, def_log_part_br_cyl[i], &def_log_part_table[i]);
+		set_entry(&pt[i], PART_TYPE_LINUX, 0, align + i * slot, slot);
+	}
+	if (parts > PRIMARY_CNT)
+	{
+		ext_start = align + primaries * slot;
+		ext_len = (parts - primaries) * slot;
+		set_entry(&pt[PRIMARY_CNT - 1], PART_TYPE_EXTENDED, 0, ext_start, ext_len);
+	}
+	if ((ret = write_table(sector_buf, 0, &pt, 1, write, ctx)) < 0)
+		return ret;
+
+	/* The EBR chain: each w/ its logical relative to itself, & the next EBR relative to the extended one */
+	for (i = primaries; i < parts; i++)
+	{
+		ebr = ext_start + (i - primaries) * slot;
+		memset(pt, 0, sizeof(pt));
+		set_entry(&pt[0], PART_TYPE_LINUX, ebr, align, slot - align);
+		if (i + 1 < parts)
+		{
+			start = (i + 1 - primaries) * slot;
+			set_entry(&pt[1], PART_TYPE_EXTENDED, ext_start, start, slot);
+		}
+		if ((ret = write_table(sector_buf, ebr, &pt, 0, write, ctx)) < 0)
+			return ret;
 	}
+	return 0;
 }
@@ -3,5 +3,8 @@
 
 #include <linux/types.h>
 
-extern void copy_mbr_n_br(u8 *disk);
+/* Writes the 512 byte buf as the sector; returns < 0 on failure */
+typedef int (*part_write_t)(void *ctx, sector_t sector, u8 *buf);
+
+extern int make_part_tables(sector_t size, unsigned int align, int parts, u8 *sector_buf, part_write_t write, void *ctx);
 #endif
@@ -0,0 +1,261 @@
+/*
+ * Backing image file of a RAM device: pages loaded from it on their first
+ * access, so the device comes up w/ its data in place & w/o any bulk copy;
+ * & the dirty ones written back to it in batches, periodically, or on flush.
+ * The loads, discards & flushes are done in the I/O path of the device; so
+ * w/ memalloc_noio, for the file's allocations not to recurse into its I/O
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/fs.h>
+#include <linux/falloc.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/mm.h>
+#include <linux/rcupdate.h>
+#include <linux/radix-tree.h>
+#include <linux/workqueue.h>
+#include <linux/jiffies.h>
+#include <linux/sched/mm.h> // For memalloc_noio_save, ...
+
+#include "ram_device.h"
+
+#define RB_PAGE_SECTORS_SHIFT (PAGE_SHIFT - 9)
+
+#define RDB_BATCH 32 /* Dirty pages looked up, & at most written, at a time */
+
+static unsigned int rb_flush_interval = 5000;
+module_param(rb_flush_interval, uint, 0644);
+MODULE_PARM_DESC(rb_flush_interval, "Delay (in ms) of writing back the dirty pages to the backing files (default 5000)");
+
+static ssize_t rdb_read_file(struct file *file, void *buf, size_t len, loff_t pos)
+{
+	return kernel_read(file, buf, len, &pos);
+}
+static ssize_t rdb_write_file(struct file *file, void *buf, size_t len, loff_t pos)
+{
+	return kernel_write(file, buf, len, &pos);
+}
+/* Writes len bytes at pos fully, or fails */
+static int rdb_write_all(struct file *file, u8 *buf, size_t len, loff_t pos)
+{
+	ssize_t done;
+
+	while (len)
+	{
+		if ((done = rdb_write_file(file, buf, len, pos)) <= 0)
+			return done ? (int)done : -EIO;
+		buf += done;
+		pos += done;
+		len -= done;
+	}
+	return 0;
+}
+
+/*
+ * Fills the freshly allocated (& zeroed) page from the file. What lies
+ * beyond its end, stays zeroes. Under bk_sem, for reading
+ */
+int rdb_load_page(struct ram_device *rd, struct page *page)
+{
+	loff_t pos = (loff_t)page->index << PAGE_SHIFT;
+	size_t done = 0;
+	ssize_t ret = 0;
+	unsigned int noio;
+	u8 *dst;
+
+	noio = memalloc_noio_save();
+	dst = kmap(page);
+	while (done < PAGE_SIZE)
+	{
+		if ((ret = rdb_read_file(rd->backing, dst + done, PAGE_SIZE - done, pos + done)) <= 0)
+			break;
+		done += ret;
+	}
+	kunmap(page);
+	memalloc_noio_restore(noio);
+	return (ret < 0) ? (int)ret : 0;
+}
+/*
+ * Marks the page dirty, just after a write into it, & gets it written back
+ * in a while. Under rcu_read_lock
+ */
+void rdb_mark_dirty(struct ram_device *rd, struct page *page)
+{
+	/* Seen after the data, by the write back clearing the mark before copying it */
+	smp_mb();
+	if (radix_tree_tag_get(&rd->pages, page->index, RD_TAG_DIRTY))
+		return;
+	spin_lock(&rd->lock);
+	/* Unless discarded, in the meantime */
+	if (radix_tree_lookup(&rd->pages, page->index) == page)
+		radix_tree_tag_set(&rd->pages, page->index, RD_TAG_DIRTY);
+	spin_unlock(&rd->lock);
+	schedule_delayed_work(&rd->wb_work, msecs_to_jiffies(rb_flush_interval));
+}
+
+/* Writes the run of cnt pages starting at the page idx, gathered in wb_buf */
+static int rdb_write_run(struct ram_device *rd, pgoff_t idx, int cnt)
+{
+	loff_t pos = (loff_t)idx << PAGE_SHIFT;
+	loff_t end = (loff_t)rd->size * RB_SECTOR_SIZE;
+	size_t len = (size_t)cnt << PAGE_SHIFT;
+
+	/* The last page may go past the device end */
+	if (pos + len > end)
+		len = end - pos;
+	return rdb_write_all(rd->backing, rd->wb_buf, len, pos);
+}
+/*
+ * Writes back all the dirty pages, coalescing the consecutive ones into one
+ * write. Pages can't go away in here, as discards take bk_sem for writing
+ */
+static int rdb_writeback(struct ram_device *rd)
+{
+	struct page *pages[RDB_BATCH];
+	pgoff_t idx = 0, run_idx = 0;
+	int run = 0;
+	int i, cnt;
+	u8 *src;
+	int ret = 0;
+
+	mutex_lock(&rd->wb_lock);
+	down_read(&rd->bk_sem);
+	for (;;)
+	{
+		rcu_read_lock();
+		cnt = radix_tree_gang_lookup_tag(&rd->pages, (void **)pages, idx, RDB_BATCH, RD_TAG_DIRTY);
+		rcu_read_unlock();
+		if (cnt <= 0)
+			break;
+		for (i = 0; i < cnt; i++)
+		{
+			/* Flush the run, if this page doesn't extend it, or it is full */
+			if (run && ((pages[i]->index != run_idx + run) || (run == RDB_BATCH)))
+			{
+				if ((ret = rdb_write_run(rd, run_idx, run)) < 0)
+					goto redirty;
+				run = 0;
+			}
+			/* Clear the mark before the copy, so that a write during it marks it again */
+			spin_lock(&rd->lock);
+			radix_tree_tag_clear(&rd->pages, pages[i]->index, RD_TAG_DIRTY);
+			spin_unlock(&rd->lock);
+			smp_mb();
+			if (!run)
+				run_idx = pages[i]->index;
+			src = kmap_atomic(pages[i]);
+			memcpy(rd->wb_buf + ((size_t)run << PAGE_SHIFT), src, PAGE_SIZE);
+			kunmap_atomic(src);
+			run++;
+		}
+		idx = pages[cnt - 1]->index + 1;
+	}
+	if (run && ((ret = rdb_write_run(rd, run_idx, run)) < 0))
+		goto redirty;
+	goto out;
+
+redirty:
+	/* Mark the run dirty again, to be retried */
+	spin_lock(&rd->lock);
+	for (i = 0; i < run; i++)
+	{
+		if (radix_tree_lookup(&rd->pages, run_idx + i))
+			radix_tree_tag_set(&rd->pages, run_idx + i, RD_TAG_DIRTY);
+	}
+	spin_unlock(&rd->lock);
+	printk(KERN_ERR "rb: Write back to the backing file failed (%d)\n", ret);
+out:
+	up_read(&rd->bk_sem);
+	mutex_unlock(&rd->wb_lock);
+	return ret;
+}
+static void rdb_wb_work(struct work_struct *work)
+{
+	struct ram_device *rd = container_of(to_delayed_work(work), struct ram_device, wb_work);
+
+	if (rdb_writeback(rd) < 0)
+		schedule_delayed_work(&rd->wb_work, msecs_to_jiffies(rb_flush_interval));
+}
+
+/* Writes back all the dirty pages, & syncs the file, for a flush request */
+int rdb_flush(struct ram_device *rd)
+{
+	unsigned int noio;
+	int ret;
+
+	noio = memalloc_noio_save();
+	if ((ret = rdb_writeback(rd)) == 0)
+		ret = vfs_fsync(rd->backing, 1);
+	memalloc_noio_restore(noio);
+	return ret;
+}
+
+/*
+ * Drops the sectors from the file too, so they don't get loaded back. Under
+ * bk_sem for writing, so w/ no load or write back in progress
+ */
+int rdb_discard(struct ram_device *rd, sector_t sector_off, sector_t sectors)
+{
+	loff_t pos = (loff_t)sector_off * RB_SECTOR_SIZE;
+	loff_t len = (loff_t)sectors * RB_SECTOR_SIZE;
+	size_t chunk;
+	unsigned int noio;
+	int ret;
+
+	noio = memalloc_noio_save();
+	ret = vfs_fallocate(rd->backing, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, pos, len);
+	if (ret)
+	{
+		/* Can't punch holes; so write the zeroes */
+		memset(rd->wb_buf, 0, RDB_BATCH * PAGE_SIZE);
+		while (len)
+		{
+			chunk = min_t(loff_t, len, RDB_BATCH * PAGE_SIZE);
+			if ((ret = rdb_write_all(rd->backing, rd->wb_buf, chunk, pos)) < 0)
+			{
+				printk(KERN_ERR "rb: Discard in the backing file failed (%d)\n", ret);
+				break;
+			}
+			pos += chunk;
+			len -= chunk;
+		}
+	}
+	memalloc_noio_restore(noio);
+	return (ret < 0) ? ret : 0;
+}
+
+int rdb_init(struct ram_device *rd, const char *path)
+{
+	struct file *file;
+
+	file = filp_open(path, O_RDWR | O_LARGEFILE, 0);
+	if (IS_ERR(file))
+	{
+		printk(KERN_ERR "rb: Unable to open the backing file %s (%ld)\n", path, PTR_ERR(file));
+		return PTR_ERR(file);
+	}
+	if (!(rd->wb_buf = vmalloc(RDB_BATCH * PAGE_SIZE)))
+	{
+		filp_close(file, NULL);
+		return -ENOMEM;
+	}
+	rd->backing = file;
+	init_rwsem(&rd->bk_sem);
+	mutex_init(&rd->wb_lock);
+	INIT_DELAYED_WORK(&rd->wb_work, rdb_wb_work);
+	return 0;
+}
+/* Before the pages are freed: writes them back a last time */
+void rdb_cleanup(struct ram_device *rd)
+{
+	cancel_delayed_work_sync(&rd->wb_work);
+	if (rdb_flush(rd) < 0)
+		printk(KERN_ERR "rb: Backing file left w/ stale data\n");
+	filp_close(rd->backing, NULL);
+	rd->backing = NULL;
+	vfree(rd->wb_buf);
+}
@@ -1,51 +1,172 @@
 /* Disk on RAM Driver */
 #include <linux/module.h>
+#include <linux/version.h>
 #include <linux/kernel.h>
 #include <linux/fs.h>
 #include <linux/types.h>
 #include <linux/genhd.h> // For basic block driver framework
 #include <linux/blkdev.h> // For at least, struct block_device_operations
+#include <linux/blk-mq.h> // For the multi-queue block layer
+#include <linux/cpumask.h> // For num_online_cpus
 #include <linux/hdreg.h> // For struct hd_geometry
+#include <linux/highmem.h> // For kmap_atomic, ...
+#include <linux/bio.h> // For bio_for_each_segment, bio_endio, ...
 #include <linux/errno.h>
+#include <linux/slab.h> // For kzalloc, ...
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/idr.h> // For ida_simple_get, ...
+#include <linux/nodemask.h> // For for_each_online_node, ...
+#include <linux/device.h> // For the device attributes, in sysfs
+#include <linux/hrtimer.h> // For the delayed completions, in emulation
+#include <linux/random.h> // For the latency jitter
+#include <linux/delay.h> // For msleep
+#if IS_ENABLED(CONFIG_CONFIGFS_FS)
+#define RB_CONFIGFS
+#include <linux/configfs.h> // For devices created at runtime
+#endif
+#if IS_ENABLED(CONFIG_DAX)
+/* Direct access to the device memory, through a dax_device of the disk */
+#define RB_DAX
+#include <linux/dax.h> // For alloc_dax, ...
+#include <linux/pfn_t.h> // For page_to_pfn_t
+#include <linux/uio.h> // For copy_from_iter, ...
+#endif
 
 #include "ram_device.h"
+#include "io_stats.h"
+#include "ram_copy.h"
+
+#define CREATE_TRACE_POINTS
+#include "ram_block_trace.h"
 
 #define RB_FIRST_MINOR 0
 #define RB_MINOR_CNT 16
+#define RB_MAX_DEVICES 64
+#define RB_QUEUE_DEPTH 128 /* Default requests in flight per hardware queue */
+#define RB_NUMA_INTERLEAVE -2 /* rb_numa_node for the pages interleaved over the nodes */
+#define RB_PART_MAX (RB_MINOR_CNT - 1) /* Partitions a disk has minors for */
+
+#define RB_QUEUE_BIO 0 /* Bios handled as they come, w/o any request queueing */
+#define RB_QUEUE_RQ 1 /* Requests, through the I/O scheduler & merging */
 
 static u_int rb_major = 0;
+static int rb_queue_mode = RB_QUEUE_RQ;
+module_param(rb_queue_mode, int, 0444);
+MODULE_PARM_DESC(rb_queue_mode, "0: bio based, 1: request based (default)");
+#ifdef RB_DAX
+static bool rb_dax = false;
+module_param(rb_dax, bool, 0444);
+MODULE_PARM_DESC(rb_dax, "Allow direct access (DAX) to the device memory, e.g. for ddkfs -o dax (default 0)");
+#endif
+static bool rb_compress = false;
+module_param(rb_compress, bool, 0444);
+MODULE_PARM_DESC(rb_compress, "Store the data LZO compressed, w/ stats in /sys/block/<disk>/compr/ (default 0)");
+static int rb_nr_devices = 1;
+module_param(rb_nr_devices, int, 0444);
+MODULE_PARM_DESC(rb_nr_devices, "Number of devices to create at load (default 1). More can be created through configfs");
+static unsigned long rb_sectors[RB_MAX_DEVICES] = {RB_DEVICE_SIZE};
+static int rb_sectors_cnt;
+module_param_array(rb_sectors, ulong, &rb_sectors_cnt, 0444);
+MODULE_PARM_DESC(rb_sectors, "Size of each device, in sectors (default 1024). Memory is used only for what gets written");
+static int rb_queue_depth[RB_MAX_DEVICES] = {RB_QUEUE_DEPTH};
+static int rb_queue_depth_cnt;
+module_param_array(rb_queue_depth, int, &rb_queue_depth_cnt, 0444);
+MODULE_PARM_DESC(rb_queue_depth, "Requests in flight per hardware queue of each device (default 128)");
+static int rb_numa_node = NUMA_NO_NODE;
+module_param(rb_numa_node, int, 0444);
+MODULE_PARM_DESC(rb_numa_node, "NUMA node of the backing memory; -1: of the CPU (i.e. queue) writing it (default), -2: interleaved over the online nodes");
+static ulong rb_latency_ns = 0;
+module_param(rb_latency_ns, ulong, 0444);
+MODULE_PARM_DESC(rb_latency_ns, "Emulated latency per request, in ns (default 0). Per device in /sys/block/<disk>/emul/");
+static ulong rb_jitter_ns = 0;
+module_param(rb_jitter_ns, ulong, 0444);
+MODULE_PARM_DESC(rb_jitter_ns, "Emulated random latency per request, up to so many ns, over rb_latency_ns (default 0)");
+static ulong rb_bandwidth = 0;
+module_param(rb_bandwidth, ulong, 0444);
+MODULE_PARM_DESC(rb_bandwidth, "Emulated bandwidth cap, in bytes/s (default 0, i.e. none)");
+static int rb_emul_qd = 0;
+module_param(rb_emul_qd, int, 0444);
+MODULE_PARM_DESC(rb_emul_qd, "Emulated queue depth, i.e. requests in flight per device, w/ latency or bandwidth emulated (default 0, i.e. no limit)");
+static char *rb_backing[RB_MAX_DEVICES];
+static int rb_backing_cnt;
+module_param_array(rb_backing, charp, &rb_backing_cnt, 0444);
+MODULE_PARM_DESC(rb_backing, "Image file backing each device, loaded from on demand & written back to (default none)");
+static int rb_hw_queues = 0;
+module_param(rb_hw_queues, int, 0444);
+MODULE_PARM_DESC(rb_hw_queues, "Number of hardware queues (default 0, i.e. one per CPU)");
+static unsigned int rb_part_align = 4096;
+module_param(rb_part_align, uint, 0444);
+MODULE_PARM_DESC(rb_part_align, "Alignment of the partitions, in bytes; a multiple of 512, e.g. 1048576 (default 4096)");
+static int rb_part_cnt = 5;
+module_param(rb_part_cnt, int, 0444);
+MODULE_PARM_DESC(rb_part_cnt, "Partitions laid out on each device, over 4 as logicals; 0 for none (default 5)");
 
 /* 
  * The internal structure representation of our Device
  */
-static struct rb_device
+struct rb_device
 {
+	/* Its number among the rb devices, deciding its minors & name */
+	int index;
+	/* In rb_devices */
+	struct list_head list;
 	/* Size is the size of the device (in sectors) */
-	unsigned int size;
-	/* For exclusive access to our request queue */
-	spinlock_t lock;
+	sector_t size;
+	/* Requests in flight per hardware queue */
+	int queue_depth;
+	/* NUMA node of its memory; NUMA_NO_NODE if none in particular */
+	int node;
+	/* Its sparse backing store */
+	struct ram_device rd;
+	/* Latency histograms, byte & op counts */
+	struct io_stats stats;
+	/*
+	 * Slow media emulation: any of the first three non-zero, turns it on.
+	 * Set through sysfs, & read in the I/O path (incl. the hrtimer's hard
+	 * IRQ), each w/ a single READ_ONCE / WRITE_ONCE, w/o a lock
+	 */
+	u64 emul_lat_ns;
+	u64 emul_jitter_ns;
+	u64 emul_bw; /* Bytes/s */
+	int emul_qd; /* Requests in flight; request based only */
+	spinlock_t emul_lock; /* Protects the below */
+	u64 emul_busy_until; /* When the emulated medium is done w/ what's been queued to it */
+	atomic_t emul_inflight;
+	atomic_t emul_timers; /* Delayed completions still to be done w/ the device */
+	/* RB_QUEUE_BIO or RB_QUEUE_RQ */
+	int queue_mode;
+	/* Tags & hardware queues, shared by nothing else */
+	struct blk_mq_tag_set tag_set;
 	/* Our request queue */
 	struct request_queue *rb_queue;
 	/* This is kernel's representation of an individual disk device */
 	struct gendisk *rb_disk;
-} rb_dev;
+	/* W/ RD_F_DAX, for the direct access to the device memory */
+	struct dax_device *dax_dev;
+	/* Its sysfs attributes, as the disk's; NULL terminated */
+	const struct attribute_group *groups[3];
+};
+
+static LIST_HEAD(rb_devices);
+static DEFINE_MUTEX(rb_devices_lock); /* Protects rb_devices */
+static DEFINE_IDA(rb_ida); /* Allocates the device indices */
 
 static int rb_open(struct block_device *bdev, fmode_t mode)
 {
-	unsigned unit = iminor(bdev->bd_inode);
+	unsigned unit = iminor(bdev->bd_inode) - bdev->bd_disk->first_minor;
 
 	printk(KERN_INFO "rb: Device is opened\n");
 	printk(KERN_INFO "rb: Inode number is %d\n", unit);
 
-	if (unit > RB_MINOR_CNT)
+	if (unit >= RB_MINOR_CNT)
 		return -ENODEV;
 	return 0;
 }
 
-static int rb_close(struct gendisk *disk, fmode_t mode)
+static void rb_close(struct gendisk *disk, fmode_t mode)
 {
 	printk(KERN_INFO "rb: Device is closed\n");
-	return 0;
 }
 
 static int rb_getgeo(struct block_device *bdev, struct hd_geometry *geo)
@@ -62,13 +183,15 @@ static int rb_getgeo(struct block_device *bdev, struct hd_geometry *geo)
  */
 static int rb_transfer(struct request *req)
 {
-	//struct rb_device *dev = (struct rb_device *)(req->rq_disk->private_data);
+	struct rb_device *dev = (struct rb_device *)(req->rq_disk->private_data);
 
 	int dir = rq_data_dir(req);
 	sector_t start_sector = blk_rq_pos(req);
 	unsigned int sector_cnt = blk_rq_sectors(req);
+	/* Large I/Os stream past the caches */
+	int io_flags = rdc_use_simd(blk_rq_bytes(req)) ? RD_IO_STREAM : 0;
 
-	struct bio_vec *bv;
+	struct bio_vec bv;
 	struct req_iterator iter;
 
 	sector_t sector_offset;
@@ -79,28 +202,42 @@ static int rb_transfer(struct request *req)
 
 	//printk(KERN_DEBUG "rb: Dir:%d; Sec:%lld; Cnt:%d\n", dir, start_sector, sector_cnt);
 
+	if (req_op(req) == REQ_OP_FLUSH)
+	{
+		ret = ramdevice_flush(&dev->rd);
+		trace_rb_transfer(dir, start_sector, 0, ret);
+		return ret;
+	}
+	if ((req_op(req) == REQ_OP_DISCARD) || (req_op(req) == REQ_OP_WRITE_ZEROES))
+	{
+		ret = ramdevice_discard(&dev->rd, start_sector, sector_cnt);
+		trace_rb_transfer(dir, start_sector, sector_cnt, ret);
+		return ret;
+	}
+
 	sector_offset = 0;
 	rq_for_each_segment(bv, req, iter)
 	{
-		buffer = page_address(bv->bv_page) + bv->bv_offset;
-		if (bv->bv_len % RB_SECTOR_SIZE != 0)
+		buffer = page_address(bv.bv_page) + bv.bv_offset;
+		if (bv.bv_len % RB_SECTOR_SIZE != 0)
 		{
 			printk(KERN_ERR "rb: Should never happen: "
 				"bio size (%d) is not a multiple of RB_SECTOR_SIZE (%d).\n"
 				"This may lead to data truncation.\n",
-				bv->bv_len, RB_SECTOR_SIZE);
+				bv.bv_len, RB_SECTOR_SIZE);
 			ret = -EIO;
 		}
-		sectors = bv->bv_len / RB_SECTOR_SIZE;
-		printk(KERN_DEBUG "rb: Sector Offset: %lld; Buffer: %p; Length: %u sectors\n",
-			sector_offset, buffer, sectors);
+		sectors = bv.bv_len / RB_SECTOR_SIZE;
+		trace_rb_segment(dir, start_sector + sector_offset, sectors);
 		if (dir == WRITE) /* Write to the device */
 		{
-			ramdevice_write(start_sector + sector_offset, buffer, sectors);
+			if (ramdevice_write(&dev->rd, start_sector + sector_offset, buffer, sectors, io_flags) < 0)
+				ret = -ENOMEM;
 		}
 		else /* Read from the device */
 		{
-			ramdevice_read(start_sector + sector_offset, buffer, sectors);
+			if (ramdevice_read(&dev->rd, start_sector + sector_offset, buffer, sectors, io_flags) < 0)
+				ret = -EIO;
 		}
 		sector_offset += sectors;
 	}
@@ -109,41 +246,343 @@ static int rb_transfer(struct request *req)
 		printk(KERN_ERR "rb: bio info doesn't match with the request info");
 		ret = -EIO;
 	}
+	if (!ret && (req->cmd_flags & REQ_FUA))
+	{
+		ret = ramdevice_flush(&dev->rd);
+	}
+	trace_rb_transfer(dir, start_sector, sector_cnt, ret);
 
 	return ret;
 }
+
+/*
+ * Slow media emulation: the I/O is done right away, but its completion is
+ * delayed by an hrtimer, till the emulated medium would have been done w/ it
+ */
+struct rb_delay
+{
+	struct hrtimer timer;
+	struct rb_device *dev;
+	void *io; /* The request or the bio */
+	int dir;
+	unsigned int bytes;
+	u64 start;
+	int ret;
+};
+
+static void rb_bio_endio(struct bio *bio, int err);
+
+static inline int rb_emul_on(struct rb_device *dev)
+{
+	return READ_ONCE(dev->emul_lat_ns) || READ_ONCE(dev->emul_jitter_ns) || READ_ONCE(dev->emul_bw);
+}
+/* Request queue to hold off, for the emulated queue depth */
+static inline int rb_emul_busy(struct rb_device *dev)
+{
+	int qd = READ_ONCE(dev->emul_qd);
+
+	return rb_emul_on(dev) && (qd > 0) && (atomic_read(&dev->emul_inflight) >= qd);
+}
+static u64 rb_emul_jitter(u64 max)
+{
+	if (!max)
+		return 0;
+	max = min_t(u64, max, U32_MAX);
+	return prandom_u32_max(max);
+}
+/* When the I/O of bytes submitted now, would be done */
+static u64 rb_emul_done(struct rb_device *dev, unsigned int bytes)
+{
+	u64 now = ios_now();
+	u64 done = now;
+	u64 bw = READ_ONCE(dev->emul_bw);
+
+	if (bw)
+	{
+		/* Transferred after what's already queued to the medium */
+		spin_lock(&dev->emul_lock);
+		done = max(now, dev->emul_busy_until) + div64_u64((u64)bytes * NSEC_PER_SEC, bw);
+		dev->emul_busy_until = done;
+		spin_unlock(&dev->emul_lock);
+	}
+	return done + READ_ONCE(dev->emul_lat_ns) + rb_emul_jitter(READ_ONCE(dev->emul_jitter_ns));
+}
+static enum hrtimer_restart rb_delay_done(struct hrtimer *timer)
+{
+	struct rb_delay *d = container_of(timer, struct rb_delay, timer);
+	struct rb_device *dev = d->dev;
+
+	ios_account(&dev->stats, d->dir, d->bytes, d->start);
+	if (dev->queue_mode == RB_QUEUE_BIO)
+		rb_bio_endio(d->io, d->ret);
+	else
+		blk_mq_end_request(d->io, d->ret ? BLK_STS_IOERR : BLK_STS_OK);
+	/* Let the held off requests in */
+	if (atomic_dec_return(&dev->emul_inflight) < READ_ONCE(dev->emul_qd))
+	{
+		if (dev->queue_mode == RB_QUEUE_RQ)
+			blk_mq_run_hw_queues(dev->rb_queue, true);
+	}
+	kfree(d);
+	/* The last access to the device, as rb_del_device then frees it */
+	smp_mb__before_atomic();
+	atomic_dec(&dev->emul_timers);
+	return HRTIMER_NORESTART;
+}
+/*
+ * Completes the I/O (request or bio) through the emulation, accounting it
+ * then. Returns 0 if so, or < 0 if it is to be completed right away
+ */
+static int rb_delay_io(struct rb_device *dev, void *io, int dir, unsigned int bytes, u64 start, int ret)
+{
+	struct rb_delay *d;
+
+	if (!(d = kmalloc(sizeof(struct rb_delay), GFP_NOIO)))
+		return -ENOMEM;
+	d->dev = dev;
+	d->io = io;
+	d->dir = dir;
+	d->bytes = bytes;
+	d->start = start;
+	d->ret = ret;
+	atomic_inc(&dev->emul_timers);
+	atomic_inc(&dev->emul_inflight);
+	hrtimer_init(&d->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	d->timer.function = rb_delay_done;
+	hrtimer_start(&d->timer, ns_to_ktime(rb_emul_done(dev, bytes)), HRTIMER_MODE_ABS);
+	return 0;
+}
 	
 /*
- * Represents a block I/O request for us to execute
+ * Executes a block I/O request. W/ BLK_MQ_F_BLOCKING, that's in the
+ * submitter's context or in a kworker's, under the queue's SRCU, & so may
+ * sleep, as the backing page allocation may. None of our locks is held
+ * here; the store takes its own, just around its updates
  */
-static void rb_request(struct request_queue *q)
+static blk_status_t rb_queue_rq(struct blk_mq_hw_ctx *hctx, const struct blk_mq_queue_data *bd)
+{
+	struct rb_device *dev = hctx->queue->queuedata;
+	struct request *req = bd->rq;
+	u64 start = ios_now();
+	int ret;
+
+	if (rb_emul_busy(dev))
+		return BLK_STS_RESOURCE;
+	blk_mq_start_request(req);
+	ret = rb_transfer(req);
+	if (rb_emul_on(dev) && (rb_delay_io(dev, req, rq_data_dir(req), blk_rq_bytes(req), start, ret) == 0))
+		return BLK_STS_OK;
+	ios_account(&dev->stats, rq_data_dir(req), blk_rq_bytes(req), start);
+	blk_mq_end_request(req, ret ? BLK_STS_IOERR : BLK_STS_OK);
+	return BLK_STS_OK;
+}
+
+static struct blk_mq_ops rb_mq_ops =
+{
+	.queue_rq = rb_queue_rq,
+};
+
+static int rb_init_rq_queue(struct rb_device *dev)
 {
-	struct request *req;
 	int ret;
 
-	/* Gets the current request from the dispatch queue */
-	while ((req = blk_fetch_request(q)) != NULL)
+	memset(&dev->tag_set, 0, sizeof(dev->tag_set));
+	dev->tag_set.ops = &rb_mq_ops;
+	dev->tag_set.nr_hw_queues = (rb_hw_queues > 0) ? rb_hw_queues : num_online_cpus();
+	dev->tag_set.queue_depth = dev->queue_depth;
+	dev->tag_set.numa_node = dev->node;
+	/* Blocking, as the backing pages get allocated & freed in the I/O path */
+	dev->tag_set.flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_BLOCKING;
+	dev->tag_set.driver_data = dev;
+	if ((ret = blk_mq_alloc_tag_set(&dev->tag_set)) < 0)
+	{
+		printk(KERN_ERR "rb: blk_mq_alloc_tag_set failure\n");
+		return ret;
+	}
+	dev->rb_queue = blk_mq_init_queue(&dev->tag_set);
+	if (IS_ERR(dev->rb_queue))
+	{
+		printk(KERN_ERR "rb: blk_mq_init_queue failure\n");
+		blk_mq_free_tag_set(&dev->tag_set);
+		return PTR_ERR(dev->rb_queue);
+	}
+	dev->rb_queue->queuedata = dev;
+	printk(KERN_INFO "rb: Using %d hardware queue(s) of depth %d\n",
+		dev->tag_set.nr_hw_queues, dev->tag_set.queue_depth);
+	return 0;
+}
+static void rb_cleanup_queue(struct rb_device *dev)
+{
+	blk_cleanup_queue(dev->rb_queue);
+	if (dev->queue_mode == RB_QUEUE_RQ)
+	{
+		blk_mq_free_tag_set(&dev->tag_set);
+	}
+}
+
+/*
+ * Bio based mode, like brd: each segment is copied as the bio comes in, with
+ * no request allocation, scheduling or merging in between
+ */
+static int rb_do_bvec(struct rb_device *dev, struct page *page, unsigned int len, unsigned int off, int dir, sector_t sector, int io_flags)
+{
+	u8 *buffer;
+	int ret = 0;
+
+	if (len % RB_SECTOR_SIZE != 0)
+	{
+		return -EIO;
+	}
+	buffer = kmap(page); // Not atomic, as writes may allocate backing pages
+	if (dir == WRITE)
+	{
+		ret = ramdevice_write(&dev->rd, sector, buffer + off, len / RB_SECTOR_SIZE, io_flags);
+	}
+	else
+	{
+		ret = ramdevice_read(&dev->rd, sector, buffer + off, len / RB_SECTOR_SIZE, io_flags);
+		flush_dcache_page(page);
+	}
+	kunmap(page);
+	return ret;
+}
+static void rb_bio_endio(struct bio *bio, int err)
+{
+	bio->bi_status = errno_to_blk_status(err);
+	bio_endio(bio);
+}
+static blk_qc_t rb_submit_bio(struct request_queue *q, struct bio *bio)
+{
+	struct rb_device *dev = q->queuedata;
+	int dir = bio_data_dir(bio);
+	sector_t start_sector = bio->bi_iter.bi_sector;
+	sector_t sector = start_sector;
+	struct bio_vec bv;
+	struct bvec_iter iter;
+	int io_flags = rdc_use_simd(bio->bi_iter.bi_size) ? RD_IO_STREAM : 0;
+	u64 start = ios_now();
+	int ret = 0;
+
+	if ((bio->bi_opf & REQ_PREFLUSH) && ((ret = ramdevice_flush(&dev->rd)) < 0))
+	{
+		goto done;
+	}
+	if ((bio_op(bio) == REQ_OP_DISCARD) || (bio_op(bio) == REQ_OP_WRITE_ZEROES))
+	{
+		if ((ret = ramdevice_discard(&dev->rd, start_sector, bio_sectors(bio))) == 0)
+			sector += bio_sectors(bio);
+		goto done;
+	}
+	bio_for_each_segment(bv, bio, iter)
 	{
-#if 0
-		/*
-		 * This function tells us whether we are looking at a filesystem request
-		 * - one that moves block of data
-		 */
-		if (!blk_fs_request(req))
+		if ((ret = rb_do_bvec(dev, bv.bv_page, bv.bv_len, bv.bv_offset, dir, sector, io_flags)) < 0)
 		{
-			printk(KERN_NOTICE "rb: Skip non-fs request\n");
-			/* We pass 0 to indicate that we successfully completed the request */
-			__blk_end_request_all(req, 0);
-			//__blk_end_request(req, 0, blk_rq_bytes(req));
-			continue;
+			break;
 		}
+		sector += bv.bv_len / RB_SECTOR_SIZE;
+	}
+	if (!ret && (bio->bi_opf & REQ_FUA))
+	{
+		ret = ramdevice_flush(&dev->rd);
+	}
+done:
+	trace_rb_transfer(dir, start_sector, sector - start_sector, ret);
+	if (!rb_emul_on(dev) || (rb_delay_io(dev, bio, dir, (sector - start_sector) * RB_SECTOR_SIZE, start, ret) < 0))
+	{
+		ios_account(&dev->stats, dir, (sector - start_sector) * RB_SECTOR_SIZE, start);
+		rb_bio_endio(bio, ret);
+	}
+	return BLK_QC_T_NONE;
+}
+/* Single page I/O, e.g. from the page cache or swap, w/o even a bio */
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,18,0))
+static int rb_rw_page(struct block_device *bdev, sector_t sector, struct page *page, unsigned int op)
+#else
+static int rb_rw_page(struct block_device *bdev, sector_t sector, struct page *page, bool is_write)
+#endif
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,18,0))
+	int dir = op_is_write(op) ? WRITE : READ;
+#else
+	int dir = is_write ? WRITE : READ;
+#endif
+	struct rb_device *dev = bdev->bd_disk->private_data;
+	u64 start = ios_now();
+	int ret;
+
+	/* Synchronous; so through bios instead, to be delayed */
+	if (rb_emul_on(dev))
+		return -EOPNOTSUPP;
+	ret = rb_do_bvec(dev, page, PAGE_SIZE, 0, dir, sector, rdc_use_simd(PAGE_SIZE) ? RD_IO_STREAM : 0);
+	ios_account(&dev->stats, dir, PAGE_SIZE, start);
+	trace_rb_transfer(dir, sector, PAGE_SIZE / RB_SECTOR_SIZE, ret);
+	page_endio(page, dir == WRITE, ret);
+	return ret;
+}
+
+static int rb_init_bio_queue(struct rb_device *dev)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0))
+	dev->rb_queue = blk_alloc_queue_node(GFP_KERNEL, dev->node, NULL);
+#else
+	dev->rb_queue = blk_alloc_queue_node(GFP_KERNEL, dev->node);
 #endif
-		ret = rb_transfer(req);
-		__blk_end_request_all(req, ret);
-		//__blk_end_request(req, ret, blk_rq_bytes(req));
+	if (dev->rb_queue != NULL)
+	{
+		blk_queue_make_request(dev->rb_queue, rb_submit_bio);
+	}
+	if (dev->rb_queue == NULL)
+	{
+		printk(KERN_ERR "rb: blk_alloc_queue failure\n");
+		return -ENOMEM;
 	}
+	dev->rb_queue->queuedata = dev;
+	printk(KERN_INFO "rb: Using bio based mode\n");
+	return 0;
 }
 
+#ifdef RB_DAX
+/*
+ * Direct access to the memory of the device page pgoff (of the disk). Just
+ * the one page, as the next one is anywhere. Such pages are never freed
+ * while the dax_device is alive. Not ZONE_DEVICE memory though; so no
+ * QUEUE_FLAG_DAX, for the filesystems to map it into user space
+ */
+static long rb_dax_direct_access(struct dax_device *dax_dev, pgoff_t pgoff, long nr_pages, void **kaddr, pfn_t *pfn)
+{
+	struct rb_device *dev = dax_get_private(dax_dev);
+	sector_t sector = (sector_t)pgoff * (PAGE_SIZE / RB_SECTOR_SIZE);
+	struct page *page;
+
+	if (sector >= dev->size)
+		return -ERANGE;
+	if (!(page = ramdevice_map(&dev->rd, sector)))
+		return -ENOMEM;
+	*kaddr = page_address(page);
+	if (pfn)
+		*pfn = page_to_pfn_t(page);
+	return 1;
+}
+static size_t rb_dax_copy_from_iter(struct dax_device *dax_dev, pgoff_t pgoff, void *addr, size_t bytes, struct iov_iter *i)
+{
+	return copy_from_iter(addr, bytes, i);
+}
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,18,0))
+static size_t rb_dax_copy_to_iter(struct dax_device *dax_dev, pgoff_t pgoff, void *addr, size_t bytes, struct iov_iter *i)
+{
+	return copy_to_iter(addr, bytes, i);
+}
+#endif
+static const struct dax_operations rb_dax_ops =
+{
+	.direct_access = rb_dax_direct_access,
+	.copy_from_iter = rb_dax_copy_from_iter,
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,18,0))
+	.copy_to_iter = rb_dax_copy_to_iter,
+#endif
+};
+#endif
+
 /* 
  * These are the file operations that performed on the ram block device
  */
@@ -154,83 +593,690 @@ static struct block_device_operations rb_fops =
 	.release = rb_close,
 	.getgeo = rb_getgeo,
 };
+static struct block_device_operations rb_bio_fops =
+{
+	.owner = THIS_MODULE,
+	.open = rb_open,
+	.release = rb_close,
+	.getgeo = rb_getgeo,
+	.rw_page = rb_rw_page,
+};
 	
-/* 
- * This is the registration and initialization section of the ram block device
- * driver
+/*
+ * Discards & write zeroes free up the backing pages. W/ a backing file, the
+ * data is cached in here; so flushes & FUA write back to it
  */
-static int __init rb_init(void)
+static void rb_set_limits(struct rb_device *dev)
+{
+	struct request_queue *q = dev->rb_queue;
+
+	if (dev->rd.backing)
+	{
+		blk_queue_write_cache(q, true, true);
+	}
+	q->limits.discard_granularity = PAGE_SIZE;
+	blk_queue_max_discard_sectors(q, UINT_MAX);
+	blk_queue_max_write_zeroes_sectors(q, UINT_MAX);
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4,17,0))
+	blk_queue_flag_set(QUEUE_FLAG_DISCARD, q);
+#else
+	queue_flag_set_unlocked(QUEUE_FLAG_DISCARD, q);
+#endif
+}
+
+/*
+ * Stats of the compressed store, in /sys/block/<disk>/compr/
+ */
+static inline struct ram_device *rb_dev_to_rd(struct device *d)
+{
+	return &((struct rb_device *)(dev_to_disk(d)->private_data))->rd;
+}
+static ssize_t rb_orig_data_size_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+	struct ram_device *rd = rb_dev_to_rd(d);
+
+	return sprintf(buf, "%lu\n", (atomic_long_read(&rd->compr_pages) + atomic_long_read(&rd->zero_pages)) * PAGE_SIZE);
+}
+static ssize_t rb_compr_data_size_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", atomic_long_read(&rb_dev_to_rd(d)->compr_bytes));
+}
+static ssize_t rb_mem_used_total_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", atomic_long_read(&rb_dev_to_rd(d)->mem_used));
+}
+static ssize_t rb_zero_pages_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%lu\n", atomic_long_read(&rb_dev_to_rd(d)->zero_pages));
+}
+/* Of the data stored to the memory used for it, w/ 2 decimals */
+static ssize_t rb_compr_ratio_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+	struct ram_device *rd = rb_dev_to_rd(d);
+	unsigned long orig = (atomic_long_read(&rd->compr_pages) + atomic_long_read(&rd->zero_pages)) * PAGE_SIZE;
+	unsigned long used = atomic_long_read(&rd->mem_used);
+	unsigned long ratio = used ? (unsigned long)(div64_u64((u64)orig * 100, used)) : 0;
+
+	return sprintf(buf, "%lu.%02lu\n", ratio / 100, ratio % 100);
+}
+static DEVICE_ATTR(orig_data_size, S_IRUGO, rb_orig_data_size_show, NULL);
+static DEVICE_ATTR(compr_data_size, S_IRUGO, rb_compr_data_size_show, NULL);
+static DEVICE_ATTR(mem_used_total, S_IRUGO, rb_mem_used_total_show, NULL);
+static DEVICE_ATTR(zero_pages, S_IRUGO, rb_zero_pages_show, NULL);
+static DEVICE_ATTR(compr_ratio, S_IRUGO, rb_compr_ratio_show, NULL);
+
+static struct attribute *rb_compr_attrs[] =
+{
+	&dev_attr_orig_data_size.attr,
+	&dev_attr_compr_data_size.attr,
+	&dev_attr_mem_used_total.attr,
+	&dev_attr_zero_pages.attr,
+	&dev_attr_compr_ratio.attr,
+	NULL,
+};
+static struct attribute_group rb_compr_group =
+{
+	.name = "compr",
+	.attrs = rb_compr_attrs,
+};
+
+/* Backing pages per NUMA node, in /sys/block/<disk>/numa_pages, as N<node>=<pages> ... */
+static ssize_t rb_numa_pages_show(struct device *d, struct device_attribute *attr, char *buf)
+{
+	struct ram_device *rd = rb_dev_to_rd(d);
+	ssize_t len = 0;
+	int node;
+
+	for_each_online_node(node)
+	{
+		len += sprintf(buf + len, "%sN%d=%lu", len ? " " : "", node, atomic_long_read(&rd->node_pages[node]));
+	}
+	len += sprintf(buf + len, "\n");
+	return len;
+}
+static DEVICE_ATTR(numa_pages, S_IRUGO, rb_numa_pages_show, NULL);
+
+static struct attribute *rb_numa_attrs[] =
+{
+	&dev_attr_numa_pages.attr,
+	NULL,
+};
+static struct attribute_group rb_numa_group =
+{
+	.attrs = rb_numa_attrs,
+};
+
+/*
+ * Slow media emulation knobs, in /sys/block/<disk>/emul/, changeable any time
+ */
+#define RB_EMUL_ATTR(_name, _field, _type, _conv) \
+static ssize_t rb_emul_##_name##_show(struct device *d, struct device_attribute *attr, char *buf) \
+{ \
+	struct rb_device *dev = dev_to_disk(d)->private_data; \
+\
+	return sprintf(buf, "%llu\n", (unsigned long long)READ_ONCE(dev->_field)); \
+} \
+static ssize_t rb_emul_##_name##_store(struct device *d, struct device_attribute *attr, const char *buf, size_t count) \
+{ \
+	struct rb_device *dev = dev_to_disk(d)->private_data; \
+	_type val; \
+	int ret; \
+\
+	if ((ret = _conv(buf, 0, &val)) < 0) \
+		return ret; \
+	WRITE_ONCE(dev->_field, val); \
+	return count; \
+} \
+static struct device_attribute rb_emul_attr_##_name = __ATTR(_name, S_IRUGO | S_IWUSR, rb_emul_##_name##_show, rb_emul_##_name##_store)
+
+RB_EMUL_ATTR(latency_ns, emul_lat_ns, u64, kstrtou64);
+RB_EMUL_ATTR(jitter_ns, emul_jitter_ns, u64, kstrtou64);
+RB_EMUL_ATTR(bandwidth, emul_bw, u64, kstrtou64);
+RB_EMUL_ATTR(queue_depth, emul_qd, unsigned int, kstrtouint);
+
+static struct attribute *rb_emul_attrs[] =
+{
+	&rb_emul_attr_latency_ns.attr,
+	&rb_emul_attr_jitter_ns.attr,
+	&rb_emul_attr_bandwidth.attr,
+	&rb_emul_attr_queue_depth.attr,
+	NULL,
+};
+static struct attribute_group rb_emul_group =
+{
+	.name = "emul",
+	.attrs = rb_emul_attrs,
+};
+
+/*
+ * Creates a RAM block device of size sectors, w/ its own queue & backing store
+ */
+static struct rb_device *rb_add_device(sector_t size, int queue_depth, int flags, int node, const char *backing)
 {
+	struct rb_device *dev;
 	int ret;
 
-	/* Set up our RAM Device */
-	if ((ret = ramdevice_init()) < 0)
+	if (!size)
+		return ERR_PTR(-EINVAL);
+	if ((flags & RD_F_DAX) && (flags & RD_F_COMPRESS))
 	{
-		return ret;
+		printk(KERN_ERR "rb: DAX needs the data uncompressed\n");
+		return ERR_PTR(-EINVAL);
+	}
+	if (node == RB_NUMA_INTERLEAVE)
+	{
+		flags |= RD_F_INTERLEAVE;
+		node = NUMA_NO_NODE;
+	}
+	else if ((node != NUMA_NO_NODE) && ((node < 0) || (node >= nr_node_ids) || !node_online(node)))
+	{
+		printk(KERN_ERR "rb: NUMA node %d is not online\n", node);
+		return ERR_PTR(-EINVAL);
+	}
+	if (backing && !*backing)
+		backing = NULL;
+	if (backing && (flags & (RD_F_DAX | RD_F_COMPRESS)))
+	{
+		printk(KERN_ERR "rb: A backing file needs the data uncompressed, & not directly accessed\n");
+		return ERR_PTR(-EINVAL);
+	}
+	if (!(dev = kzalloc_node(sizeof(struct rb_device), GFP_KERNEL, node)))
+		return ERR_PTR(-ENOMEM);
+	if ((ret = ida_simple_get(&rb_ida, 0, RB_MAX_DEVICES, GFP_KERNEL)) < 0)
+	{
+		kfree(dev);
+		return ERR_PTR(ret);
+	}
+	dev->index = ret;
+	dev->size = size;
+	dev->queue_depth = (queue_depth > 0) ? queue_depth : RB_QUEUE_DEPTH;
+	dev->node = node;
+	dev->emul_lat_ns = rb_latency_ns;
+	dev->emul_jitter_ns = rb_jitter_ns;
+	dev->emul_bw = rb_bandwidth;
+	dev->emul_qd = max(rb_emul_qd, 0);
+	spin_lock_init(&dev->emul_lock);
+	atomic_set(&dev->emul_inflight, 0);
+	atomic_set(&dev->emul_timers, 0);
+	if ((ret = ios_init(&dev->stats)) < 0)
+	{
+		goto free_index;
 	}
-	rb_dev.size = ret;
 
-	/* Get Registered */
-	rb_major = register_blkdev(rb_major, "rb");
-	if (rb_major <= 0)
+	/* Set up our RAM Device */
+	if ((ret = ramdevice_init(&dev->rd, size, flags, node, backing, min(rb_part_cnt, RB_PART_MAX), rb_part_align / RB_SECTOR_SIZE)) < 0)
 	{
-		printk(KERN_ERR "rb: Unable to get Major Number\n");
-		ramdevice_cleanup();
-		return -EBUSY;
+		goto cleanup_stats;
 	}
 
 	/* Get a request queue (here queue is created) */
-	spin_lock_init(&rb_dev.lock);
-	rb_dev.rb_queue = blk_init_queue(rb_request, &rb_dev.lock);
-	if (rb_dev.rb_queue == NULL)
+	dev->queue_mode = rb_queue_mode;
+	if (dev->queue_mode == RB_QUEUE_BIO)
+		ret = rb_init_bio_queue(dev);
+	else
+		ret = rb_init_rq_queue(dev);
+	if (ret < 0)
 	{
-		printk(KERN_ERR "rb: blk_init_queue failure\n");
-		unregister_blkdev(rb_major, "rb");
-		ramdevice_cleanup();
-		return -ENOMEM;
+		goto cleanup_rd;
 	}
-	
+	rb_set_limits(dev);
+
 	/*
 	 * Add the gendisk structure
 	 * By using this memory allocation is involved, 
 	 * the minor number we need to pass bcz the device 
 	 * will support this much partitions 
 	 */
-	rb_dev.rb_disk = alloc_disk(RB_MINOR_CNT);
-	if (!rb_dev.rb_disk)
+	dev->rb_disk = alloc_disk(RB_MINOR_CNT);
+	if (!dev->rb_disk)
 	{
 		printk(KERN_ERR "rb: alloc_disk failure\n");
-		blk_cleanup_queue(rb_dev.rb_queue);
-		unregister_blkdev(rb_major, "rb");
-		ramdevice_cleanup();
-		return -ENOMEM;
+		ret = -ENOMEM;
+		goto cleanup_queue;
 	}
 
  	/* Setting the major number */
-	rb_dev.rb_disk->major = rb_major;
+	dev->rb_disk->major = rb_major;
   	/* Setting the first mior number */
-	rb_dev.rb_disk->first_minor = RB_FIRST_MINOR;
+	dev->rb_disk->first_minor = RB_FIRST_MINOR + dev->index * RB_MINOR_CNT;
  	/* Initializing the device operations */
-	rb_dev.rb_disk->fops = &rb_fops;
+	dev->rb_disk->fops = &rb_fops;
+	if (dev->queue_mode == RB_QUEUE_BIO)
+		dev->rb_disk->fops = &rb_bio_fops;
  	/* Driver-specific own internal data */
-	rb_dev.rb_disk->private_data = &rb_dev;
-	rb_dev.rb_disk->queue = rb_dev.rb_queue;
+	dev->rb_disk->private_data = dev;
+	dev->rb_disk->queue = dev->rb_queue;
 	/*
 	 * You do not want partition information to show up in 
 	 * cat /proc/partitions set this flags
 	 */
-	//rb_dev.rb_disk->flags = GENHD_FL_SUPPRESS_PARTITION_INFO;
-	sprintf(rb_dev.rb_disk->disk_name, "rb");
+	//dev->rb_disk->flags = GENHD_FL_SUPPRESS_PARTITION_INFO;
+	/* The first one stays rb, as always; the others can't end in a digit, to not clash w/ its partitions */
+	if (dev->index == 0)
+		sprintf(dev->rb_disk->disk_name, "rb");
+	else
+		sprintf(dev->rb_disk->disk_name, "rb_%d", dev->index);
 	/* Setting the capacity of the device in its gendisk structure */
-	set_capacity(rb_dev.rb_disk, rb_dev.size);
+	set_capacity(dev->rb_disk, dev->size);
+#ifdef RB_DAX
+	/* Found by the disk name, so before the disk goes live */
+	if ((flags & RD_F_DAX) && !(dev->dax_dev = alloc_dax(dev, dev->rb_disk->disk_name, &rb_dax_ops)))
+	{
+		printk(KERN_ERR "rb: alloc_dax failure\n");
+		ret = -ENOMEM;
+		goto free_disk;
+	}
+#endif
+
+	/* Created w/ the disk (& removed w/ it), so that they are there by its uevent */
+	dev->groups[0] = (flags & RD_F_COMPRESS) ? &rb_compr_group : &rb_numa_group;
+	dev->groups[1] = &rb_emul_group;
+	disk_to_dev(dev->rb_disk)->groups = dev->groups;
 
 	/* Adding the disk to the system */
-	add_disk(rb_dev.rb_disk);
+	add_disk(dev->rb_disk);
+	ios_register(&dev->stats, dev->rb_disk, KBUILD_MODNAME);
 	/* Now the disk is "live" */
-	printk(KERN_INFO "rb: Ram Block driver initialised (%d sectors; %d bytes)\n",
-		rb_dev.size, rb_dev.size * RB_SECTOR_SIZE);
+	printk(KERN_INFO "rb: %s initialised (%llu sectors; %llu KiB)\n", dev->rb_disk->disk_name,
+		(unsigned long long)dev->size, (unsigned long long)dev->size * RB_SECTOR_SIZE / 1024);
+	if (backing)
+		printk(KERN_INFO "rb: %s backed by %s\n", dev->rb_disk->disk_name, backing);
+
+	mutex_lock(&rb_devices_lock);
+	list_add_tail(&dev->list, &rb_devices);
+	mutex_unlock(&rb_devices_lock);
+
+	return dev;
+
+#ifdef RB_DAX
+free_disk:
+	put_disk(dev->rb_disk);
+#endif
+cleanup_queue:
+	rb_cleanup_queue(dev);
+cleanup_rd:
+	ramdevice_cleanup(&dev->rd);
+cleanup_stats:
+	ios_cleanup(&dev->stats);
+free_index:
+	ida_simple_remove(&rb_ida, dev->index);
+	kfree(dev);
+	return ERR_PTR(ret);
+}
+static void rb_del_device(struct rb_device *dev)
+{
+	mutex_lock(&rb_devices_lock);
+	list_del(&dev->list);
+	mutex_unlock(&rb_devices_lock);
+
+	printk(KERN_INFO "rb: %s removed\n", dev->rb_disk->disk_name);
+	ios_unregister(&dev->stats);
+	del_gendisk(dev->rb_disk);
+#ifdef RB_DAX
+	/* Waits out the direct accesses in progress, before the pages go */
+	if (dev->dax_dev)
+	{
+		kill_dax(dev->dax_dev);
+		put_dax(dev->dax_dev);
+	}
+#endif
+	/*
+	 * The delayed completions, which the bio based queue doesn't wait for;
+	 * nor the request based one, for them to be done w/ the device
+	 */
+	while (atomic_read(&dev->emul_timers))
+		msleep(1);
+	put_disk(dev->rb_disk);
+	rb_cleanup_queue(dev);
+	ramdevice_cleanup(&dev->rd);
+	ios_cleanup(&dev->stats);
+	ida_simple_remove(&rb_ida, dev->index);
+	kfree(dev);
+}
+
+#ifdef RB_CONFIGFS
+/*
+ * Runtime creation of devices, through configfs:
+ *	# mkdir /sys/kernel/config/rb/<name>
+ *	# echo <sectors> > /sys/kernel/config/rb/<name>/sectors
+ *	# echo 1 > /sys/kernel/config/rb/<name>/power
+ * & "echo 0 > .../power" or rmdir to remove it
+ */
+struct rb_cfg
+{
+	struct config_item item;
+	unsigned long sectors;
+	int queue_depth;
+	bool compress;
+	int numa_node;
+	char *backing;
+	struct rb_device *dev; /* Once powered on */
+};
+
+static DEFINE_MUTEX(rb_cfg_lock); /* Serialises power on / off */
+
+static inline struct rb_cfg *to_rb_cfg(struct config_item *item)
+{
+	return container_of(item, struct rb_cfg, item);
+}
+
+static ssize_t rb_cfg_sectors_show(struct config_item *item, char *page)
+{
+	return sprintf(page, "%lu\n", to_rb_cfg(item)->sectors);
+}
+static ssize_t rb_cfg_sectors_store(struct config_item *item, const char *page, size_t count)
+{
+	struct rb_cfg *cfg = to_rb_cfg(item);
+	unsigned long sectors;
+	int ret;
+
+	if ((ret = kstrtoul(page, 0, &sectors)) < 0)
+		return ret;
+	if (!sectors)
+		return -EINVAL;
+	mutex_lock(&rb_cfg_lock);
+	if (cfg->dev)
+		ret = -EBUSY;
+	else
+		cfg->sectors = sectors;
+	mutex_unlock(&rb_cfg_lock);
+	return ret ? ret : count;
+}
+static ssize_t rb_cfg_queue_depth_show(struct config_item *item, char *page)
+{
+	return sprintf(page, "%d\n", to_rb_cfg(item)->queue_depth);
+}
+static ssize_t rb_cfg_queue_depth_store(struct config_item *item, const char *page, size_t count)
+{
+	struct rb_cfg *cfg = to_rb_cfg(item);
+	int queue_depth;
+	int ret;
+
+	if ((ret = kstrtoint(page, 0, &queue_depth)) < 0)
+		return ret;
+	if (queue_depth <= 0)
+		return -EINVAL;
+	mutex_lock(&rb_cfg_lock);
+	if (cfg->dev)
+		ret = -EBUSY;
+	else
+		cfg->queue_depth = queue_depth;
+	mutex_unlock(&rb_cfg_lock);
+	return ret ? ret : count;
+}
+static ssize_t rb_cfg_compress_show(struct config_item *item, char *page)
+{
+	return sprintf(page, "%d\n", to_rb_cfg(item)->compress ? 1 : 0);
+}
+static ssize_t rb_cfg_compress_store(struct config_item *item, const char *page, size_t count)
+{
+	struct rb_cfg *cfg = to_rb_cfg(item);
+	bool compress;
+	int ret;
+
+	if ((ret = strtobool(page, &compress)) < 0)
+		return ret;
+	mutex_lock(&rb_cfg_lock);
+	if (cfg->dev)
+		ret = -EBUSY;
+	else
+		cfg->compress = compress;
+	mutex_unlock(&rb_cfg_lock);
+	return ret ? ret : count;
+}
+static ssize_t rb_cfg_numa_node_show(struct config_item *item, char *page)
+{
+	return sprintf(page, "%d\n", to_rb_cfg(item)->numa_node);
+}
+static ssize_t rb_cfg_numa_node_store(struct config_item *item, const char *page, size_t count)
+{
+	struct rb_cfg *cfg = to_rb_cfg(item);
+	int numa_node;
+	int ret;
+
+	if ((ret = kstrtoint(page, 0, &numa_node)) < 0)
+		return ret;
+	if (numa_node < RB_NUMA_INTERLEAVE)
+		return -EINVAL;
+	mutex_lock(&rb_cfg_lock);
+	if (cfg->dev)
+		ret = -EBUSY;
+	else
+		cfg->numa_node = numa_node;
+	mutex_unlock(&rb_cfg_lock);
+	return ret ? ret : count;
+}
+static ssize_t rb_cfg_backing_show(struct config_item *item, char *page)
+{
+	struct rb_cfg *cfg = to_rb_cfg(item);
+	ssize_t ret;
+
+	mutex_lock(&rb_cfg_lock);
+	ret = sprintf(page, "%s\n", cfg->backing ? cfg->backing : "");
+	mutex_unlock(&rb_cfg_lock);
+	return ret;
+}
+static ssize_t rb_cfg_backing_store(struct config_item *item, const char *page, size_t count)
+{
+	struct rb_cfg *cfg = to_rb_cfg(item);
+	char *backing;
+	int ret = 0;
+
+	if (!(backing = kstrndup(page, count, GFP_KERNEL)))
+		return -ENOMEM;
+	strim(backing);
+	mutex_lock(&rb_cfg_lock);
+	if (cfg->dev)
+	{
+		ret = -EBUSY;
+	}
+	else
+	{
+		swap(cfg->backing, backing);
+	}
+	mutex_unlock(&rb_cfg_lock);
+	kfree(backing);
+	return ret ? ret : count;
+}
+static ssize_t rb_cfg_power_show(struct config_item *item, char *page)
+{
+	return sprintf(page, "%d\n", to_rb_cfg(item)->dev ? 1 : 0);
+}
+static ssize_t rb_cfg_power_store(struct config_item *item, const char *page, size_t count)
+{
+	struct rb_cfg *cfg = to_rb_cfg(item);
+	struct rb_device *dev;
+	bool power;
+	int ret;
+
+	if ((ret = strtobool(page, &power)) < 0)
+		return ret;
+	mutex_lock(&rb_cfg_lock);
+	if (power && !cfg->dev)
+	{
+		dev = rb_add_device(cfg->sectors, cfg->queue_depth, cfg->compress ? RD_F_COMPRESS : 0, cfg->numa_node, cfg->backing);
+		if (IS_ERR(dev))
+			ret = PTR_ERR(dev);
+		else
+			cfg->dev = dev;
+	}
+	else if (!power && cfg->dev)
+	{
+		rb_del_device(cfg->dev);
+		cfg->dev = NULL;
+	}
+	mutex_unlock(&rb_cfg_lock);
+	return ret ? ret : count;
+}
+static ssize_t rb_cfg_disk_show(struct config_item *item, char *page)
+{
+	struct rb_cfg *cfg = to_rb_cfg(item);
+	ssize_t ret;
+
+	mutex_lock(&rb_cfg_lock);
+	ret = sprintf(page, "%s\n", cfg->dev ? cfg->dev->rb_disk->disk_name : "");
+	mutex_unlock(&rb_cfg_lock);
+	return ret;
+}
+
+CONFIGFS_ATTR(rb_cfg_, sectors);
+CONFIGFS_ATTR(rb_cfg_, queue_depth);
+CONFIGFS_ATTR(rb_cfg_, compress);
+CONFIGFS_ATTR(rb_cfg_, numa_node);
+CONFIGFS_ATTR(rb_cfg_, backing);
+CONFIGFS_ATTR(rb_cfg_, power);
+CONFIGFS_ATTR_RO(rb_cfg_, disk);
+
+static struct configfs_attribute *rb_cfg_attrs[] =
+{
+	&rb_cfg_attr_sectors,
+	&rb_cfg_attr_queue_depth,
+	&rb_cfg_attr_compress,
+	&rb_cfg_attr_numa_node,
+	&rb_cfg_attr_backing,
+	&rb_cfg_attr_power,
+	&rb_cfg_attr_disk,
+	NULL,
+};
+
+static void rb_cfg_release(struct config_item *item)
+{
+	struct rb_cfg *cfg = to_rb_cfg(item);
+
+	kfree(cfg->backing);
+	kfree(cfg);
+}
+
+static struct configfs_item_operations rb_cfg_item_ops =
+{
+	.release = rb_cfg_release,
+};
+
+static struct config_item_type rb_cfg_type =
+{
+	.ct_item_ops = &rb_cfg_item_ops,
+	.ct_attrs = rb_cfg_attrs,
+	.ct_owner = THIS_MODULE,
+};
+
+static struct config_item *rb_cfg_make_item(struct config_group *group, const char *name)
+{
+	struct rb_cfg *cfg;
+
+	if (!(cfg = kzalloc(sizeof(struct rb_cfg), GFP_KERNEL)))
+		return ERR_PTR(-ENOMEM);
+	cfg->sectors = RB_DEVICE_SIZE;
+	cfg->queue_depth = RB_QUEUE_DEPTH;
+	cfg->compress = rb_compress;
+	cfg->numa_node = rb_numa_node;
+	config_item_init_type_name(&cfg->item, name, &rb_cfg_type);
+	return &cfg->item;
+}
+static void rb_cfg_drop_item(struct config_group *group, struct config_item *item)
+{
+	struct rb_cfg *cfg = to_rb_cfg(item);
+
+	mutex_lock(&rb_cfg_lock);
+	if (cfg->dev)
+	{
+		rb_del_device(cfg->dev);
+		cfg->dev = NULL;
+	}
+	mutex_unlock(&rb_cfg_lock);
+	config_item_put(item);
+}
+
+static struct configfs_group_operations rb_group_ops =
+{
+	.make_item = rb_cfg_make_item,
+	.drop_item = rb_cfg_drop_item,
+};
+
+static struct config_item_type rb_group_type =
+{
+	.ct_group_ops = &rb_group_ops,
+	.ct_owner = THIS_MODULE,
+};
+
+static struct configfs_subsystem rb_subsys =
+{
+	.su_group =
+	{
+		.cg_item =
+		{
+			.ci_namebuf = "rb",
+			.ci_type = &rb_group_type,
+		},
+	},
+};
+#endif
+
+/* 
+ * This is the registration and initialization section of the ram block device
+ * driver
+ */
+static int __init rb_init(void)
+{
+	struct rb_device *dev, *next;
+	int flags = rb_compress ? RD_F_COMPRESS : 0;
+	int i;
+	int ret;
+
+	if ((rb_nr_devices < 0) || (rb_nr_devices > RB_MAX_DEVICES))
+	{
+		printk(KERN_ERR "rb: rb_nr_devices should be in [0, %d]\n", RB_MAX_DEVICES);
+		return -EINVAL;
+	}
+	if (!rb_part_align || (rb_part_align % RB_SECTOR_SIZE))
+	{
+		printk(KERN_ERR "rb: rb_part_align should be a non-zero multiple of %d\n", RB_SECTOR_SIZE);
+		return -EINVAL;
+	}
+#ifdef RB_DAX
+	if (rb_dax)
+		flags |= RD_F_DAX;
+#endif
+
+	/* Get Registered */
+	rb_major = register_blkdev(rb_major, "rb");
+	if (rb_major <= 0)
+	{
+		printk(KERN_ERR "rb: Unable to get Major Number\n");
+		return -EBUSY;
+	}
+
+	for (i = 0; i < rb_nr_devices; i++)
+	{
+		/* Devices beyond the ones given, take after the last one given */
+		dev = rb_add_device(rb_sectors[min(i, max(rb_sectors_cnt, 1) - 1)],
+			rb_queue_depth[min(i, max(rb_queue_depth_cnt, 1) - 1)], flags, rb_numa_node,
+			(i < rb_backing_cnt) ? rb_backing[i] : NULL);
+		if (IS_ERR(dev))
+		{
+			ret = PTR_ERR(dev);
+			goto del_devices;
+		}
+	}
+
+#ifdef RB_CONFIGFS
+	config_group_init(&rb_subsys.su_group);
+	mutex_init(&rb_subsys.su_mutex);
+	if ((ret = configfs_register_subsystem(&rb_subsys)) < 0)
+	{
+		printk(KERN_ERR "rb: configfs_register_subsystem failure\n");
+		goto del_devices;
+	}
+#endif
 
 	return 0;
+
+del_devices:
+	list_for_each_entry_safe(dev, next, &rb_devices, list)
+	{
+		rb_del_device(dev);
+	}
+	unregister_blkdev(rb_major, "rb");
+	return ret;
 }
 /*
  * This is the unregistration and uninitialization section of the ram block
@@ -238,11 +1284,17 @@ static int __init rb_init(void)
  */
 static void __exit rb_cleanup(void)
 {
-	del_gendisk(rb_dev.rb_disk);
-	put_disk(rb_dev.rb_disk);
-	blk_cleanup_queue(rb_dev.rb_queue);
+	struct rb_device *dev, *next;
+
+#ifdef RB_CONFIGFS
+	/* No items left here, as each of them pins the module */
+	configfs_unregister_subsystem(&rb_subsys);
+#endif
+	list_for_each_entry_safe(dev, next, &rb_devices, list)
+	{
+		rb_del_device(dev);
+	}
 	unregister_blkdev(rb_major, "rb");
-	ramdevice_cleanup();
 }
 
 module_init(rb_init);
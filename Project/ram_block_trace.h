@@ -0,0 +1,55 @@
+/* Ram Block Tracepoints, replacing the per segment printk */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM rb
+
+#if !defined(RAM_BLOCK_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define RAM_BLOCK_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(rb_transfer,
+	TP_PROTO(int dir, sector_t sector, unsigned int sector_cnt, int ret),
+	TP_ARGS(dir, sector, sector_cnt, ret),
+	TP_STRUCT__entry(
+		__field(int, dir)
+		__field(sector_t, sector)
+		__field(unsigned int, sector_cnt)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__entry->dir = dir;
+		__entry->sector = sector;
+		__entry->sector_cnt = sector_cnt;
+		__entry->ret = ret;
+	),
+	TP_printk("%s sector %llu cnt %u ret %d",
+		__entry->dir == WRITE ? "W" : "R",
+		(unsigned long long)__entry->sector, __entry->sector_cnt, __entry->ret)
+);
+
+TRACE_EVENT(rb_segment,
+	TP_PROTO(int dir, sector_t sector, unsigned int sectors),
+	TP_ARGS(dir, sector, sectors),
+	TP_STRUCT__entry(
+		__field(int, dir)
+		__field(sector_t, sector)
+		__field(unsigned int, sectors)
+	),
+	TP_fast_assign(
+		__entry->dir = dir;
+		__entry->sector = sector;
+		__entry->sectors = sectors;
+	),
+	TP_printk("%s sector %llu cnt %u",
+		__entry->dir == WRITE ? "W" : "R",
+		(unsigned long long)__entry->sector, __entry->sectors)
+);
+
+#endif
+
+/* Outside the include guard, as define_trace.h re-includes this file */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE ram_block_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,405 @@
+/*
+ * Compressed backing store of a RAM device, a la zram: each page LZO
+ * compressed into an object of the smallest fitting size class, all zero
+ * pages kept as just a marker, & the incompressible ones as is
+ */
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include <linux/rcupdate.h>
+#include <linux/radix-tree.h>
+#include <linux/lzo.h>
+
+#include "ram_device.h"
+
+#define RB_PAGE_SECTORS_SHIFT (PAGE_SHIFT - 9)
+#define RB_PAGE_SECTORS (1 << RB_PAGE_SECTORS_SHIFT)
+
+#define RDZ_LOCK_CNT 256 /* Per page locks per device, hashed by page index */
+#define RDZ_CLASS_SIZE 64 /* Granularity of the size classes */
+#define RDZ_CLASS_CNT DIV_ROUND_UP(PAGE_SIZE + sizeof(struct rdz_obj), RDZ_CLASS_SIZE)
+#define RDZ_MAX_LEN (PAGE_SIZE * 3 / 4) /* Compressed beyond this, a page is kept as is */
+#define RDZ_FREE_BATCH 16 /* Objects freed per radix tree lookup, at cleanup */
+
+struct rdz_obj
+{
+	unsigned int len; /* Compressed length; PAGE_SIZE, if kept as is */
+	u8 data[0];
+};
+/* Stands for an all zero page */
+static struct rdz_obj rdz_zero;
+#define RDZ_ZERO (&rdz_zero)
+
+/* Per CPU scratch space, for the compression & the partial page updates */
+struct rdz_buf
+{
+	void *wrkmem;
+	u8 *cbuf; /* Compressed */
+	u8 *pbuf; /* Plain */
+};
+
+/* Shared by all the compressed devices; set up for the first one */
+static DEFINE_MUTEX(rdz_global_lock);
+static int rdz_users;
+static struct kmem_cache *rdz_classes[RDZ_CLASS_CNT];
+static char rdz_class_names[RDZ_CLASS_CNT][24];
+static struct rdz_buf __percpu *rdz_bufs;
+
+static inline int rdz_class(unsigned int len)
+{
+	return DIV_ROUND_UP(sizeof(struct rdz_obj) + len, RDZ_CLASS_SIZE) - 1;
+}
+static inline spinlock_t *rdz_lock(struct ram_device *rd, pgoff_t idx)
+{
+	return &rd->zlocks[idx % RDZ_LOCK_CNT];
+}
+
+static void rdz_global_cleanup(void)
+{
+	struct rdz_buf *buf;
+	int cpu, i;
+
+	if (rdz_bufs)
+	{
+		for_each_possible_cpu(cpu)
+		{
+			buf = per_cpu_ptr(rdz_bufs, cpu);
+			vfree(buf->wrkmem);
+			kfree(buf->cbuf);
+			kfree(buf->pbuf);
+		}
+		free_percpu(rdz_bufs);
+		rdz_bufs = NULL;
+	}
+	for (i = 0; i < RDZ_CLASS_CNT; i++)
+	{
+		if (rdz_classes[i])
+		{
+			kmem_cache_destroy(rdz_classes[i]);
+			rdz_classes[i] = NULL;
+		}
+	}
+}
+static int rdz_global_init(void)
+{
+	struct rdz_buf *buf;
+	int cpu, i;
+
+	for (i = 0; i < RDZ_CLASS_CNT; i++)
+	{
+		snprintf(rdz_class_names[i], sizeof(rdz_class_names[i]), "rb_zobj_%u", (i + 1) * RDZ_CLASS_SIZE);
+		if (!(rdz_classes[i] = kmem_cache_create(rdz_class_names[i], (i + 1) * RDZ_CLASS_SIZE, 0, 0, NULL)))
+			goto fail;
+	}
+	if (!(rdz_bufs = alloc_percpu(struct rdz_buf)))
+		goto fail;
+	for_each_possible_cpu(cpu)
+	{
+		buf = per_cpu_ptr(rdz_bufs, cpu);
+		buf->wrkmem = vmalloc(LZO1X_MEM_COMPRESS);
+		buf->cbuf = kmalloc(lzo1x_worst_compress(PAGE_SIZE), GFP_KERNEL);
+		buf->pbuf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+		if (!buf->wrkmem || !buf->cbuf || !buf->pbuf)
+			goto fail;
+	}
+	return 0;
+
+fail:
+	rdz_global_cleanup();
+	return -ENOMEM;
+}
+
+static void rdz_free(struct ram_device *rd, struct rdz_obj *obj)
+{
+	if (!obj)
+		return;
+	if (obj == RDZ_ZERO)
+	{
+		atomic_long_dec(&rd->zero_pages);
+		return;
+	}
+	atomic_long_dec(&rd->compr_pages);
+	atomic_long_sub(obj->len, &rd->compr_bytes);
+	atomic_long_sub((rdz_class(obj->len) + 1) * RDZ_CLASS_SIZE, &rd->mem_used);
+	kmem_cache_free(rdz_classes[rdz_class(obj->len)], obj);
+}
+/* Decompresses the object into the page sized dst. Under the page lock */
+static int rdz_get(struct rdz_obj *obj, u8 *dst)
+{
+	size_t len = PAGE_SIZE;
+
+	if (!obj || (obj == RDZ_ZERO))
+	{
+		memset(dst, 0, PAGE_SIZE);
+		return 0;
+	}
+	if (obj->len == PAGE_SIZE)
+	{
+		memcpy(dst, obj->data, PAGE_SIZE);
+		return 0;
+	}
+	if ((lzo1x_decompress_safe(obj->data, obj->len, dst, &len) != LZO_E_OK) || (len != PAGE_SIZE))
+	{
+		printk(KERN_ERR "rb: Corrupt compressed page\n");
+		return -EIO;
+	}
+	return 0;
+}
+/*
+ * Stores the page sized src as the page idx. Under the page lock, w/ the
+ * radix tree preloaded. The object is allocated w/o sleeping, or else taken
+ * from *spare (of the spare_class), if of the right one; failing both,
+ * -EAGAIN asks the caller for a spare of the class *need, allocated out of
+ * the lock
+ */
+static int rdz_put(struct ram_device *rd, pgoff_t idx, struct rdz_obj *old, u8 *src, struct rdz_buf *buf,
+	struct rdz_obj **spare, int spare_class, int *need)
+{
+	struct rdz_obj *obj;
+	size_t len;
+
+	if (!memchr_inv(src, 0, PAGE_SIZE))
+	{
+		obj = RDZ_ZERO;
+	}
+	else
+	{
+		if ((lzo1x_1_compress(src, PAGE_SIZE, buf->cbuf, &len, buf->wrkmem) != LZO_E_OK) ||
+			(len > RDZ_MAX_LEN))
+		{
+			len = PAGE_SIZE;
+		}
+		if (*spare && (spare_class == rdz_class(len)))
+		{
+			obj = *spare;
+			*spare = NULL;
+		}
+		else if (!(obj = kmem_cache_alloc(rdz_classes[rdz_class(len)], GFP_NOWAIT | __GFP_NOWARN)))
+		{
+			*need = rdz_class(len);
+			return -EAGAIN;
+		}
+		obj->len = len;
+		memcpy(obj->data, (len == PAGE_SIZE) ? src : buf->cbuf, len);
+	}
+
+	spin_lock(&rd->lock);
+	if (old)
+		radix_tree_delete(&rd->pages, idx);
+	radix_tree_insert(&rd->pages, idx, obj); // Can't fail, being preloaded
+	spin_unlock(&rd->lock);
+
+	rdz_free(rd, old);
+	if (obj == RDZ_ZERO)
+	{
+		atomic_long_inc(&rd->zero_pages);
+	}
+	else
+	{
+		atomic_long_inc(&rd->compr_pages);
+		atomic_long_add(len, &rd->compr_bytes);
+		atomic_long_add((rdz_class(len) + 1) * RDZ_CLASS_SIZE, &rd->mem_used);
+	}
+	return 0;
+}
+/* Writes len bytes of data (or zeroes, if NULL) at offset in the page idx */
+static int rdz_write_page(struct ram_device *rd, pgoff_t idx, unsigned int offset, unsigned int len, u8 *data)
+{
+	spinlock_t *lock = rdz_lock(rd, idx);
+	struct rdz_buf *buf;
+	struct rdz_obj *old, *spare = NULL;
+	int spare_class = 0, need = 0;
+	u8 *src;
+	int ret;
+
+again:
+	if (radix_tree_preload(GFP_NOIO))
+	{
+		ret = -ENOMEM;
+		goto free_spare;
+	}
+	spin_lock(lock);
+	buf = this_cpu_ptr(rdz_bufs);
+	old = radix_tree_lookup(&rd->pages, idx);
+	if ((len == PAGE_SIZE) && data)
+	{
+		src = data;
+	}
+	else
+	{
+		if ((ret = rdz_get(old, buf->pbuf)) < 0)
+			goto out;
+		if (data)
+			memcpy(buf->pbuf + offset, data, len);
+		else
+			memset(buf->pbuf + offset, 0, len);
+		src = buf->pbuf;
+	}
+	ret = rdz_put(rd, idx, old, src, buf, &spare, spare_class, &need);
+out:
+	spin_unlock(lock);
+	radix_tree_preload_end();
+	if (ret == -EAGAIN)
+	{
+		/*
+		 * As zram: under memory pressure, allocate w/ reclaim out of the
+		 * lock, & redo the store, as the page may have changed meanwhile
+		 */
+		if (spare)
+			kmem_cache_free(rdz_classes[spare_class], spare);
+		spare_class = need;
+		if ((spare = kmem_cache_alloc(rdz_classes[spare_class], GFP_NOIO)))
+			goto again;
+		return -ENOMEM;
+	}
+free_spare:
+	if (spare) // Not needed after all
+		kmem_cache_free(rdz_classes[spare_class], spare);
+	return ret;
+}
+
+int rdz_init(struct ram_device *rd)
+{
+	int i, ret = 0;
+
+	if (!(rd->zlocks = kmalloc(RDZ_LOCK_CNT * sizeof(spinlock_t), GFP_KERNEL)))
+		return -ENOMEM;
+	for (i = 0; i < RDZ_LOCK_CNT; i++)
+		spin_lock_init(&rd->zlocks[i]);
+	atomic_long_set(&rd->zero_pages, 0);
+	atomic_long_set(&rd->compr_pages, 0);
+	atomic_long_set(&rd->compr_bytes, 0);
+	atomic_long_set(&rd->mem_used, 0);
+
+	mutex_lock(&rdz_global_lock);
+	if ((rdz_users == 0) && ((ret = rdz_global_init()) < 0))
+	{
+		kfree(rd->zlocks);
+	}
+	else
+	{
+		rdz_users++;
+	}
+	mutex_unlock(&rdz_global_lock);
+	return ret;
+}
+void rdz_cleanup(struct ram_device *rd)
+{
+	void **slots[RDZ_FREE_BATCH];
+	unsigned long idx[RDZ_FREE_BATCH];
+	unsigned long next = 0;
+	int i, cnt;
+
+	/* No I/O by now; so, no locking */
+	while ((cnt = radix_tree_gang_lookup_slot(&rd->pages, slots, idx, next, RDZ_FREE_BATCH)) > 0)
+	{
+		for (i = 0; i < cnt; i++)
+		{
+			rdz_free(rd, radix_tree_delete(&rd->pages, idx[i]));
+		}
+		next = idx[cnt - 1] + 1;
+	}
+	kfree(rd->zlocks);
+
+	mutex_lock(&rdz_global_lock);
+	if (--rdz_users == 0)
+		rdz_global_cleanup();
+	mutex_unlock(&rdz_global_lock);
+}
+
+int rdz_write(struct ram_device *rd, sector_t sector_off, u8 *buffer, unsigned int sectors)
+{
+	unsigned int offset, len;
+	int ret;
+
+	while (sectors)
+	{
+		offset = (sector_off & (RB_PAGE_SECTORS - 1)) * RB_SECTOR_SIZE;
+		len = min_t(unsigned int, sectors * RB_SECTOR_SIZE, PAGE_SIZE - offset);
+		if ((ret = rdz_write_page(rd, (pgoff_t)(sector_off >> RB_PAGE_SECTORS_SHIFT), offset, len, buffer)) < 0)
+			return ret;
+		buffer += len;
+		sector_off += len / RB_SECTOR_SIZE;
+		sectors -= len / RB_SECTOR_SIZE;
+	}
+	return 0;
+}
+int rdz_read(struct ram_device *rd, sector_t sector_off, u8 *buffer, unsigned int sectors)
+{
+	pgoff_t idx;
+	unsigned int offset, len;
+	spinlock_t *lock;
+	struct rdz_obj *obj;
+	int ret;
+
+	while (sectors)
+	{
+		idx = (pgoff_t)(sector_off >> RB_PAGE_SECTORS_SHIFT);
+		offset = (sector_off & (RB_PAGE_SECTORS - 1)) * RB_SECTOR_SIZE;
+		len = min_t(unsigned int, sectors * RB_SECTOR_SIZE, PAGE_SIZE - offset);
+		lock = rdz_lock(rd, idx);
+		spin_lock(lock);
+		rcu_read_lock();
+		obj = radix_tree_lookup(&rd->pages, idx);
+		rcu_read_unlock();
+		if (!obj || (obj == RDZ_ZERO))
+		{
+			memset(buffer, 0, len);
+			ret = 0;
+		}
+		else if (len == PAGE_SIZE)
+		{
+			ret = rdz_get(obj, buffer);
+		}
+		else
+		{
+			if ((ret = rdz_get(obj, this_cpu_ptr(rdz_bufs)->pbuf)) == 0)
+				memcpy(buffer, this_cpu_ptr(rdz_bufs)->pbuf + offset, len);
+		}
+		spin_unlock(lock);
+		if (ret < 0)
+			return ret;
+		buffer += len;
+		sector_off += len / RB_SECTOR_SIZE;
+		sectors -= len / RB_SECTOR_SIZE;
+	}
+	return 0;
+}
+int rdz_discard(struct ram_device *rd, sector_t sector_off, sector_t sectors)
+{
+	pgoff_t idx;
+	unsigned int offset, len;
+	spinlock_t *lock;
+	struct rdz_obj *obj;
+	int ret;
+
+	while (sectors)
+	{
+		idx = (pgoff_t)(sector_off >> RB_PAGE_SECTORS_SHIFT);
+		offset = (sector_off & (RB_PAGE_SECTORS - 1)) * RB_SECTOR_SIZE;
+		len = min_t(sector_t, sectors * RB_SECTOR_SIZE, PAGE_SIZE - offset);
+		if (len == PAGE_SIZE)
+		{
+			lock = rdz_lock(rd, idx);
+			spin_lock(lock);
+			spin_lock(&rd->lock);
+			obj = radix_tree_delete(&rd->pages, idx);
+			spin_unlock(&rd->lock);
+			rdz_free(rd, obj);
+			spin_unlock(lock);
+		}
+		else if ((ret = rdz_write_page(rd, idx, offset, len, NULL)) < 0)
+		{
+			return ret; // As write zeroes must zero
+		}
+		sector_off += len / RB_SECTOR_SIZE;
+		sectors -= len / RB_SECTOR_SIZE;
+	}
+	return 0;
+}
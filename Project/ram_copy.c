@@ -0,0 +1,69 @@
+/*
+ * Copies of large I/Os into & out of the RAM device, w/ the SIMD kernels of
+ * ram_copy.h, so that they don't flush the hot data out of the CPU caches
+ */
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/string.h>
+#ifdef CONFIG_X86_64
+#include <asm/fpu/api.h> // For kernel_fpu_begin, ...
+#endif
+
+#include "ram_copy.h"
+
+static unsigned int rb_simd_threshold = 65536;
+module_param(rb_simd_threshold, uint, 0644);
+MODULE_PARM_DESC(rb_simd_threshold, "I/Os of at least these many bytes are copied w/ non-temporal SIMD; 0 to not (default 65536)");
+/* Off by default, as prefetchnta trades bandwidth for the cache; see rb_copy_bench */
+static bool rb_simd_reads = false;
+module_param(rb_simd_reads, bool, 0644);
+MODULE_PARM_DESC(rb_simd_reads, "Also for the reads, w/ non-temporal prefetches (default 0)");
+
+#ifdef RDC_HAVE_SIMD
+int rdc_use_simd(unsigned long len)
+{
+	return rb_simd_threshold && (len >= rb_simd_threshold);
+}
+/* Not from an interrupt, which may have interrupted another FPU user */
+static inline int rdc_fpu_begin(void *dst, const void *src, unsigned long len)
+{
+	if (!rdc_aligned(dst, src, len) || !irq_fpu_usable())
+		return 0;
+	kernel_fpu_begin();
+	return 1;
+}
+void rdc_write(void *dst, const void *src, unsigned long len)
+{
+	if (!rdc_fpu_begin(dst, src, len))
+	{
+		memcpy(dst, src, len);
+		return;
+	}
+	rdc_copy_nt(dst, src, len);
+	kernel_fpu_end();
+}
+void rdc_read(void *dst, const void *src, unsigned long len)
+{
+	if (!rb_simd_reads || !rdc_fpu_begin(dst, src, len))
+	{
+		memcpy(dst, src, len);
+		return;
+	}
+	rdc_copy_nta(dst, src, len);
+	kernel_fpu_end();
+}
+#else
+int rdc_use_simd(unsigned long len)
+{
+	return 0;
+}
+void rdc_write(void *dst, const void *src, unsigned long len)
+{
+	memcpy(dst, src, len);
+}
+void rdc_read(void *dst, const void *src, unsigned long len)
+{
+	memcpy(dst, src, len);
+}
+#endif
@@ -0,0 +1,85 @@
+#ifndef RAM_COPY_H
+#define RAM_COPY_H
+
+/*
+ * Cache friendly copy kernels for large segments, shared by ram_copy.c &
+ * rb_copy_bench:
+ *	rdc_copy_nt: SSE2 streaming (non-temporal) stores, so the destination
+ *		isn't pulled into the cache; for writes into the backing pages
+ *	rdc_copy_nta: SSE2 copy w/ the source prefetched non-temporally, so it
+ *		evicts little of the cache; for reads out of them
+ * Both need 16 byte aligned buffers, & a length in multiples of 64 bytes.
+ * In the kernel, only between kernel_fpu_begin & kernel_fpu_end.
+ */
+#if defined(__x86_64__)
+#define RDC_HAVE_SIMD
+
+#define RDC_ALIGN 16
+#define RDC_UNIT 64 /* Bytes per loop iteration */
+
+#ifdef __KERNEL__
+/* Saved & restored by kernel_fpu_begin / end; & unknown to the compiler, w/ -mno-sse */
+#define RDC_XMM_CLOBBERS
+#else
+#define RDC_XMM_CLOBBERS , "xmm0", "xmm1", "xmm2", "xmm3"
+#endif
+
+static inline int rdc_aligned(const void *dst, const void *src, unsigned long len)
+{
+	return !((((unsigned long)dst | (unsigned long)src) & (RDC_ALIGN - 1)) || (len & (RDC_UNIT - 1)) || !len);
+}
+
+static inline void rdc_copy_nt(void *dst, const void *src, unsigned long len)
+{
+	asm volatile(
+		"1:\n\t"
+		"movdqa (%[s]), %%xmm0\n\t"
+		"movdqa 16(%[s]), %%xmm1\n\t"
+		"movdqa 32(%[s]), %%xmm2\n\t"
+		"movdqa 48(%[s]), %%xmm3\n\t"
+		"movntdq %%xmm0, (%[d])\n\t"
+		"movntdq %%xmm1, 16(%[d])\n\t"
+		"movntdq %%xmm2, 32(%[d])\n\t"
+		"movntdq %%xmm3, 48(%[d])\n\t"
+		"add $64, %[s]\n\t"
+		"add $64, %[d]\n\t"
+		"sub $64, %[n]\n\t"
+		"jnz 1b\n\t"
+		/* Streaming stores are weakly ordered; so order them before whatever follows */
+		"sfence"
+		: [d] "+r" (dst), [s] "+r" (src), [n] "+r" (len)
+		:
+		: "memory", "cc" RDC_XMM_CLOBBERS);
+}
+
+static inline void rdc_copy_nta(void *dst, const void *src, unsigned long len)
+{
+	asm volatile(
+		"1:\n\t"
+		"prefetchnta 256(%[s])\n\t"
+		"movdqa (%[s]), %%xmm0\n\t"
+		"movdqa 16(%[s]), %%xmm1\n\t"
+		"movdqa 32(%[s]), %%xmm2\n\t"
+		"movdqa 48(%[s]), %%xmm3\n\t"
+		"movdqa %%xmm0, (%[d])\n\t"
+		"movdqa %%xmm1, 16(%[d])\n\t"
+		"movdqa %%xmm2, 32(%[d])\n\t"
+		"movdqa %%xmm3, 48(%[d])\n\t"
+		"add $64, %[s]\n\t"
+		"add $64, %[d]\n\t"
+		"sub $64, %[n]\n\t"
+		"jnz 1b"
+		: [d] "+r" (dst), [s] "+r" (src), [n] "+r" (len)
+		:
+		: "memory", "cc" RDC_XMM_CLOBBERS);
+}
+#endif
+
+#ifdef __KERNEL__
+/* Picks the above for an I/O of len bytes (& aligned segments), or else memcpy */
+extern int rdc_use_simd(unsigned long len);
+extern void rdc_write(void *dst, const void *src, unsigned long len);
+extern void rdc_read(void *dst, const void *src, unsigned long len);
+#endif
+
+#endif
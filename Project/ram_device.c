@@ -1,39 +1,355 @@
+#include <linux/module.h>
+#include <linux/kernel.h>
 #include <linux/types.h>
-#include <linux/vmalloc.h>
 #include <linux/string.h>
 #include <linux/errno.h>
+#include <linux/gfp.h>
+#include <linux/highmem.h>
+#include <linux/rcupdate.h>
+#include <linux/radix-tree.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/nodemask.h>
 
 #include "ram_device.h"
 #include "partition.h"
+#include "ram_copy.h"
 
-#define RB_DEVICE_SIZE 1024 /* sectors */
-/* So, total device size = 1024 * 512 bytes = 512 KiB */
+#define RB_PAGE_SECTORS_SHIFT (PAGE_SHIFT - 9)
+#define RB_PAGE_SECTORS (1 << RB_PAGE_SECTORS_SHIFT)
+#define RB_FREE_BATCH 16 /* Pages freed per radix tree lookup, at cleanup */
 
-/* Array where the disk stores its data */
-static u8 *dev_data;
+/*
+ * Pages are looked up, & copied to / from, under rcu_read_lock, so that
+ * ramdevice_discard can free them after a grace period, w/o any lock on the
+ * I/O path
+ */
+static inline struct page *rd_lookup_page(struct ram_device *rd, sector_t sector)
+{
+	return radix_tree_lookup(&rd->pages, (pgoff_t)(sector >> RB_PAGE_SECTORS_SHIFT));
+}
+/* The n-th online node, n wrapping around */
+static int rd_interleave_node(pgoff_t n)
+{
+	int node;
 
-int ramdevice_init(void)
+	n %= num_online_nodes();
+	for_each_online_node(node)
+	{
+		if (!n--)
+			return node;
+	}
+	return NUMA_NO_NODE; // Just went offline
+}
+static struct page *rd_alloc_page(struct ram_device *rd, pgoff_t idx, gfp_t gfp)
+{
+	int node = (rd->flags & RD_F_INTERLEAVE) ? rd_interleave_node(idx) : rd->node;
+
+	/* NUMA_NO_NODE: the node of this CPU, i.e. of its blk-mq queue */
+	if (node == NUMA_NO_NODE)
+		return alloc_page(gfp);
+	return alloc_pages_node(node, gfp, 0);
+}
+static void rd_free_page(struct ram_device *rd, struct page *page)
+{
+	atomic_long_dec(&rd->node_pages[page_to_nid(page)]);
+	__free_page(page);
+}
+/* Allocates a zeroed page for the sector (or its data, from the backing file), if none yet */
+static int rd_insert_page(struct ram_device *rd, sector_t sector)
 {
-	dev_data = vmalloc(RB_DEVICE_SIZE * RB_SECTOR_SIZE);
-	if (dev_data == NULL)
+	pgoff_t idx = (pgoff_t)(sector >> RB_PAGE_SECTORS_SHIFT);
+	struct page *page;
+	int ret = 0;
+
+	/* In the I/O path; so no I/O for reclaim */
+	if (!(page = rd_alloc_page(rd, idx, GFP_NOIO | __GFP_ZERO | ((rd->flags & RD_F_DAX) ? 0 : __GFP_HIGHMEM))))
 		return -ENOMEM;
-	/* Setup its partition table */
-	copy_mbr_n_br(dev_data);
-	return RB_DEVICE_SIZE;
+	page->index = idx; // For freeing them up, by gang lookups
+	if (rd->backing)
+	{
+		/* Not to load what a discard is dropping from the file */
+		down_read(&rd->bk_sem);
+		if ((ret = rdb_load_page(rd, page)) < 0)
+			goto out;
+	}
+	if (radix_tree_preload(GFP_NOIO))
+	{
+		ret = -ENOMEM;
+		goto out;
+	}
+	spin_lock(&rd->lock);
+	if (radix_tree_insert(&rd->pages, idx, page))
+	{
+		/* Lost the race to another writer of the same page */
+		__free_page(page);
+	}
+	else
+	{
+		rd->page_cnt++;
+		atomic_long_inc(&rd->node_pages[page_to_nid(page)]);
+		page = NULL;
+	}
+	spin_unlock(&rd->lock);
+	radix_tree_preload_end();
+out:
+	if (rd->backing)
+		up_read(&rd->bk_sem);
+	if (ret < 0)
+		__free_page(page);
+	return ret;
+}
+static void rd_free_pages(struct ram_device *rd)
+{
+	struct page *pages[RB_FREE_BATCH];
+	pgoff_t idx = 0;
+	int i, cnt;
+
+	while ((cnt = radix_tree_gang_lookup(&rd->pages, (void **)pages, idx, RB_FREE_BATCH)) > 0)
+	{
+		for (i = 0; i < cnt; i++)
+		{
+			idx = pages[i]->index;
+			radix_tree_delete(&rd->pages, idx);
+			rd_free_page(rd, pages[i]);
+		}
+		idx++;
+	}
+	rd->page_cnt = 0;
 }
 
-void ramdevice_cleanup(void)
+static int rd_write_part_table(void *ctx, sector_t sector, u8 *buf)
 {
-	vfree(dev_data);
+	return ramdevice_write((struct ram_device *)ctx, sector, buf, 1, 0);
 }
+int ramdevice_init(struct ram_device *rd, sector_t size, int flags, int node, const char *backing, int parts, unsigned int part_align)
+{
+	u8 *sector_buf;
+	int ret;
+
+	rd->size = size;
+	spin_lock_init(&rd->lock);
+	INIT_RADIX_TREE(&rd->pages, GFP_ATOMIC);
+	rd->page_cnt = 0;
+	rd->flags = flags;
+	rd->node = node;
+	rd->backing = NULL;
+	if (!(rd->node_pages = kcalloc(nr_node_ids, sizeof(atomic_long_t), GFP_KERNEL)))
+		return -ENOMEM;
+	if ((flags & RD_F_COMPRESS) && ((ret = rdz_init(rd)) < 0))
+		goto free_node_pages;
+	if (backing && ((ret = rdb_init(rd, backing)) < 0))
+		goto free_node_pages;
 
-void ramdevice_write(sector_t sector_off, u8 *buffer, unsigned int sectors)
+	/* Setup its partition table, storing only the sectors it wrote; unless its data is in place */
+	if (parts <= 0)
+		return 0;
+	if (rd->backing && i_size_read(rd->backing->f_mapping->host))
+		return 0;
+	if (!(sector_buf = kmalloc(RB_SECTOR_SIZE, GFP_KERNEL)))
+	{
+		ramdevice_cleanup(rd);
+		return -ENOMEM;
+	}
+	ret = make_part_tables(size, part_align, parts, sector_buf, rd_write_part_table, rd);
+	kfree(sector_buf);
+	if (ret == -ENOSPC)
+	{
+		printk(KERN_INFO "rb: Too small for %d partitions, aligned at %u sectors; left unpartitioned\n", parts, part_align);
+	}
+	else if (ret < 0)
+	{
+		ramdevice_cleanup(rd);
+		return ret;
+	}
+	return 0;
+
+free_node_pages:
+	kfree(rd->node_pages);
+	return ret;
+}
+
+void ramdevice_cleanup(struct ram_device *rd)
+{
+	if (rd->backing)
+		rdb_cleanup(rd);
+	if (rd->flags & RD_F_COMPRESS)
+		rdz_cleanup(rd);
+	else
+		rd_free_pages(rd);
+	kfree(rd->node_pages);
+}
+
+int ramdevice_write(struct ram_device *rd, sector_t sector_off, u8 *buffer, unsigned int sectors, int io_flags)
+{
+	struct page *page;
+	unsigned int offset, len;
+	u8 *dst;
+	int ret;
+
+	if (rd->flags & RD_F_COMPRESS)
+		return rdz_write(rd, sector_off, buffer, sectors);
+	while (sectors)
+	{
+		offset = (sector_off & (RB_PAGE_SECTORS - 1)) * RB_SECTOR_SIZE;
+		len = min_t(unsigned int, sectors * RB_SECTOR_SIZE, PAGE_SIZE - offset);
+		rcu_read_lock();
+		if (!(page = rd_lookup_page(rd, sector_off)))
+		{
+			rcu_read_unlock();
+			if ((ret = rd_insert_page(rd, sector_off)) < 0)
+				return ret;
+			continue; // & look it up again
+		}
+		dst = kmap_atomic(page);
+		if (io_flags & RD_IO_STREAM) // Not to evict the hot data w/ what's just being stored away
+			rdc_write(dst + offset, buffer, len);
+		else
+			memcpy(dst + offset, buffer, len);
+		kunmap_atomic(dst);
+		if (rd->backing)
+			rdb_mark_dirty(rd, page);
+		rcu_read_unlock();
+		buffer += len;
+		sector_off += len / RB_SECTOR_SIZE;
+		sectors -= len / RB_SECTOR_SIZE;
+	}
+	return 0;
+}
+int ramdevice_read(struct ram_device *rd, sector_t sector_off, u8 *buffer, unsigned int sectors, int io_flags)
+{
+	struct page *page;
+	unsigned int offset, len;
+	u8 *src;
+	int ret;
+
+	if (rd->flags & RD_F_COMPRESS)
+		return rdz_read(rd, sector_off, buffer, sectors);
+	while (sectors)
+	{
+		offset = (sector_off & (RB_PAGE_SECTORS - 1)) * RB_SECTOR_SIZE;
+		len = min_t(unsigned int, sectors * RB_SECTOR_SIZE, PAGE_SIZE - offset);
+		rcu_read_lock();
+		if ((page = rd_lookup_page(rd, sector_off)))
+		{
+			src = kmap_atomic(page);
+			if (io_flags & RD_IO_STREAM)
+				rdc_read(buffer, src + offset, len);
+			else
+				memcpy(buffer, src + offset, len);
+			kunmap_atomic(src);
+		}
+		else if (rd->backing) /* Not loaded yet */
+		{
+			rcu_read_unlock();
+			if ((ret = rd_insert_page(rd, sector_off)) < 0)
+				return ret;
+			continue; // & look it up again
+		}
+		else /* Never written */
+		{
+			memset(buffer, 0, len);
+		}
+		rcu_read_unlock();
+		buffer += len;
+		sector_off += len / RB_SECTOR_SIZE;
+		sectors -= len / RB_SECTOR_SIZE;
+	}
+	return 0;
+}
+/* The page backing the sector, allocated if need be, for mapping it directly */
+struct page *ramdevice_map(struct ram_device *rd, sector_t sector_off)
 {
-	memcpy(dev_data + sector_off * RB_SECTOR_SIZE, buffer,
-		sectors * RB_SECTOR_SIZE);
+	struct page *page;
+
+	if (!(rd->flags & RD_F_DAX))
+		return NULL;
+	for (;;)
+	{
+		/* Stays, as DAX pages are never freed before cleanup */
+		rcu_read_lock();
+		page = rd_lookup_page(rd, sector_off);
+		rcu_read_unlock();
+		if (page)
+			return page;
+		if (rd_insert_page(rd, sector_off) < 0)
+			return NULL;
+	}
+}
+/*
+ * Discards (or zeroes) the sectors: the pages fully covered are freed, &
+ * the partly covered ones zeroed. Either way, they read back as zeroes; or
+ * else, an error is returned, w/ the pages as they were, if the backing
+ * file couldn't be updated
+ */
+int ramdevice_discard(struct ram_device *rd, sector_t sector_off, sector_t sectors)
+{
+	struct page *page, *next;
+	unsigned int offset, len;
+	LIST_HEAD(freed);
+	u8 *dst;
+	int ret;
+
+	if (rd->flags & RD_F_COMPRESS)
+	{
+		return rdz_discard(rd, sector_off, sectors);
+	}
+	if (rd->backing)
+	{
+		down_write(&rd->bk_sem);
+		/* Else, the pages dropped would be loaded back w/ the old data */
+		if ((ret = rdb_discard(rd, sector_off, sectors)) < 0)
+		{
+			up_write(&rd->bk_sem);
+			return ret;
+		}
+	}
+	while (sectors)
+	{
+		offset = (sector_off & (RB_PAGE_SECTORS - 1)) * RB_SECTOR_SIZE;
+		len = min_t(sector_t, sectors * RB_SECTOR_SIZE, PAGE_SIZE - offset);
+		if ((len == PAGE_SIZE) && !(rd->flags & RD_F_DAX))
+		{
+			spin_lock(&rd->lock);
+			page = radix_tree_delete(&rd->pages, (pgoff_t)(sector_off >> RB_PAGE_SECTORS_SHIFT));
+			if (page)
+			{
+				rd->page_cnt--;
+				list_add(&page->lru, &freed);
+			}
+			spin_unlock(&rd->lock);
+		}
+		else
+		{
+			rcu_read_lock();
+			if ((page = rd_lookup_page(rd, sector_off)))
+			{
+				dst = kmap_atomic(page);
+				memset(dst + offset, 0, len);
+				kunmap_atomic(dst);
+			}
+			rcu_read_unlock();
+		}
+		sector_off += len / RB_SECTOR_SIZE;
+		sectors -= len / RB_SECTOR_SIZE;
+	}
+	if (rd->backing)
+		up_write(&rd->bk_sem);
+	if (list_empty(&freed))
+		return 0;
+	/* Let the copies in progress, if any, be done w/ them */
+	synchronize_rcu();
+	list_for_each_entry_safe(page, next, &freed, lru)
+	{
+		rd_free_page(rd, page);
+	}
+	return 0;
 }
-void ramdevice_read(sector_t sector_off, u8 *buffer, unsigned int sectors)
+/* Makes the data written so far, stable in the backing file, if any */
+int ramdevice_flush(struct ram_device *rd)
 {
-	memcpy(buffer, dev_data + sector_off * RB_SECTOR_SIZE,
-		sectors * RB_SECTOR_SIZE);
+	if (!rd->backing)
+		return 0;
+	return rdb_flush(rd);
 }
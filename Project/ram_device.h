@@ -1,10 +1,83 @@
 #ifndef RAMDEVICE_H
 #define RAMDEVICE_H
 
+#include <linux/types.h>
+#include <linux/spinlock.h>
+#include <linux/radix-tree.h>
+#include <linux/atomic.h>
+#include <linux/fs.h>
+#include <linux/rwsem.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/numa.h>
+
 #define RB_SECTOR_SIZE 512
+#define RB_DEVICE_SIZE 1024 /* Default, in sectors */
+
+#define RD_F_DAX 0x1 /* Pages may get mapped directly: so kept in lowmem, & never freed till cleanup */
+#define RD_F_COMPRESS 0x2 /* Pages stored compressed, in ram_compress.c */
+#define RD_F_INTERLEAVE 0x4 /* Pages interleaved over the online NUMA nodes, by their index */
+
+#define RD_IO_STREAM 0x1 /* Part of a large I/O: copied so as not to evict the hot data from the caches */
+
+#define RD_TAG_DIRTY 0 /* Radix tree tag of the pages to be written back to the backing file */
+
+/*
+ * Sparse backing store of a RAM device: pages allocated on their first
+ * write, & looked up by page index. Never written sectors read as zeroes.
+ */
+struct ram_device
+{
+	/* Size of the device (in sectors) */
+	sector_t size;
+	/* For inserting into pages */
+	spinlock_t lock;
+	/* Backing pages, indexed by sector / sectors per page */
+	struct radix_tree_root pages;
+	/* Pages in there, i.e. the memory actually used */
+	unsigned long page_cnt;
+	/* RD_F_* */
+	int flags;
+	/* Node the pages are allocated on; NUMA_NO_NODE for the writer's */
+	int node;
+	/* Pages per node, indexed by node id */
+	atomic_long_t *node_pages;
+	/* Compressed store: per page locks, hashed by the page index */
+	spinlock_t *zlocks;
+	/* & its stats */
+	atomic_long_t zero_pages; /* Stored as just a marker */
+	atomic_long_t compr_pages; /* Stored compressed, or as is if incompressible */
+	atomic_long_t compr_bytes; /* Their compressed size */
+	atomic_long_t mem_used; /* Memory taken by them, in their size classes */
+	/* Backing image file, if any, in ram_backing.c */
+	struct file *backing;
+	struct rw_semaphore bk_sem; /* Loads & write backs (read) vs discards (write) */
+	struct mutex wb_lock; /* One write back at a time */
+	struct delayed_work wb_work; /* The periodic write back */
+	u8 *wb_buf; /* Where the consecutive dirty pages are gathered */
+};
+
+/* W/ parts partitions laid out, each aligned at part_align sectors; unless parts <= 0, or backed by a non-empty file */
+extern int ramdevice_init(struct ram_device *rd, sector_t size, int flags, int node, const char *backing, int parts, unsigned int part_align);
+extern void ramdevice_cleanup(struct ram_device *rd);
+extern int ramdevice_write(struct ram_device *rd, sector_t sector_off, u8 *buffer, unsigned int sectors, int io_flags);
+extern int ramdevice_read(struct ram_device *rd, sector_t sector_off, u8 *buffer, unsigned int sectors, int io_flags);
+extern struct page *ramdevice_map(struct ram_device *rd, sector_t sector_off);
+extern int ramdevice_discard(struct ram_device *rd, sector_t sector_off, sector_t sectors);
+extern int ramdevice_flush(struct ram_device *rd);
+
+/* The compressed store, for RD_F_COMPRESS; used through the above */
+extern int rdz_init(struct ram_device *rd);
+extern void rdz_cleanup(struct ram_device *rd);
+extern int rdz_write(struct ram_device *rd, sector_t sector_off, u8 *buffer, unsigned int sectors);
+extern int rdz_read(struct ram_device *rd, sector_t sector_off, u8 *buffer, unsigned int sectors);
+extern int rdz_discard(struct ram_device *rd, sector_t sector_off, sector_t sectors);
 
-extern int ramdevice_init(void);
-extern void ramdevice_cleanup(void);
-extern void ramdevice_write(sector_t sector_off, u8 *buffer, unsigned int sectors);
-extern void ramdevice_read(sector_t sector_off, u8 *buffer, unsigned int sectors);
+/* The backing file; used through the above */
+extern int rdb_init(struct ram_device *rd, const char *path);
+extern void rdb_cleanup(struct ram_device *rd);
+extern int rdb_load_page(struct ram_device *rd, struct page *page);
+extern void rdb_mark_dirty(struct ram_device *rd, struct page *page);
+extern int rdb_flush(struct ram_device *rd);
+extern int rdb_discard(struct ram_device *rd, sector_t sector_off, sector_t sectors);
 #endif
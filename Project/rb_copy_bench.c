@@ -0,0 +1,190 @@
+/*
+ * Microbenchmark of the rb copy kernels (ram_copy.h) against memcpy: the
+ * bandwidth of large copies into (write) & out of (read) a RAM area larger
+ * than the caches, & their impact on a hot working set touched in between,
+ * by its walk time & by the cache misses (where perf events are allowed)
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h> /* For memcpy() */
+#include <time.h> /* For clock_gettime() */
+#include <sys/syscall.h> /* For SYS_perf_event_open */
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+
+#include "ram_copy.h"
+
+#define DEF_AREA_SIZE (256 << 20) /* The "device": well beyond the LLC */
+#define DEF_COPY_SIZE (128 << 10) /* Per I/O */
+#define DEF_TOTAL_SIZE (2ULL << 30) /* Per test */
+#define DEF_HOT_SIZE (1 << 20) /* Working set that should stay cached */
+#define CACHE_LINE 64
+
+typedef unsigned long long nsec_t;
+typedef void (*copy_fn_t)(void *dst, const void *src, unsigned long len);
+
+static struct
+{
+	size_t area_size;
+	size_t copy_size;
+	unsigned long long total_size;
+	size_t hot_size;
+	char *area;
+	char *buf; /* The I/O's pages */
+	char *hot;
+	int first; /* For the JSON separators */
+} b;
+
+static nsec_t now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (nsec_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+static void copy_memcpy(void *dst, const void *src, unsigned long len)
+{
+	memcpy(dst, src, len);
+}
+/* Touches each line of the hot set */
+static unsigned long walk_hot(void)
+{
+	volatile char *p = b.hot;
+	unsigned long sum = 0;
+	size_t i;
+
+	for (i = 0; i < b.hot_size; i += CACHE_LINE)
+		sum += p[i];
+	return sum;
+}
+/* Counter of the LLC misses of this thread, or -1 if not allowed */
+static int perf_open(void)
+{
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = PERF_COUNT_HW_CACHE_MISSES;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void bench(const char *name, int write, copy_fn_t copy)
+{
+	unsigned long long done = 0;
+	size_t off = 0;
+	nsec_t copy_time = 0, hot_time = 0, t;
+	long long misses = -1;
+	unsigned long walks = 0;
+	int fd;
+
+	/* Warm up the hot set, & fault in the area */
+	memset(b.area, 1, b.area_size);
+	walk_hot();
+	fd = perf_open();
+	if (fd != -1)
+	{
+		ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+		ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+	}
+	while (done < b.total_size)
+	{
+		t = now();
+		if (write)
+			copy(b.area + off, b.buf, b.copy_size);
+		else
+			copy(b.buf, b.area + off, b.copy_size);
+		copy_time += now() - t;
+		t = now();
+		walk_hot();
+		hot_time += now() - t;
+		walks++;
+		done += b.copy_size;
+		off += b.copy_size;
+		if (off + b.copy_size > b.area_size)
+			off = 0;
+	}
+	if (fd != -1)
+	{
+		ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+		if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+			misses = -1;
+		close(fd);
+	}
+
+	printf("%s\n\t{\"test\": \"%s\", \"dir\": \"%s\", \"copy_size\": %zu, \"bytes\": %llu, ",
+		b.first ? "" : ",", name, write ? "write" : "read", b.copy_size, done);
+	printf("\"mb_per_s\": %.1f, \"hot_walk_ns\": %llu, ",
+		(double)done * 1000 / copy_time, hot_time / walks);
+	if (misses >= 0)
+		printf("\"cache_misses\": %lld}", misses);
+	else
+		printf("\"cache_misses\": null}");
+	b.first = 0;
+}
+
+static void usage(char *prog)
+{
+	fprintf(stderr, "Usage: %s [-a <area MiB>] [-s <copy KiB>] [-t <total MiB>] [-w <hot set KiB>]\n", prog);
+	fprintf(stderr, "\t-a: Size of the RAM area copied into & out of (default %d)\n", DEF_AREA_SIZE >> 20);
+	fprintf(stderr, "\t-s: Size of each copy, i.e. I/O (default %d)\n", DEF_COPY_SIZE >> 10);
+	fprintf(stderr, "\t-t: Bytes copied per test (default %llu)\n", DEF_TOTAL_SIZE >> 20);
+	fprintf(stderr, "\t-w: Size of the hot working set, walked after each copy (default %d)\n", DEF_HOT_SIZE >> 10);
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+
+	b.area_size = DEF_AREA_SIZE;
+	b.copy_size = DEF_COPY_SIZE;
+	b.total_size = DEF_TOTAL_SIZE;
+	b.hot_size = DEF_HOT_SIZE;
+	b.first = 1;
+	while ((opt = getopt(argc, argv, "a:s:t:w:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'a': b.area_size = (size_t)atol(optarg) << 20; break;
+			case 's': b.copy_size = (size_t)atol(optarg) << 10; break;
+			case 't': b.total_size = (unsigned long long)atol(optarg) << 20; break;
+			case 'w': b.hot_size = (size_t)atol(optarg) << 10; break;
+			default: usage(argv[0]); return 1;
+		}
+	}
+	if (!b.copy_size || (b.copy_size % CACHE_LINE) || (b.copy_size > b.area_size) || !b.total_size || !b.hot_size)
+	{
+		fprintf(stderr, "Copy size should be a non-zero multiple of %d, within the area\n", CACHE_LINE);
+		return 1;
+	}
+	if (posix_memalign((void **)(&b.area), 4096, b.area_size) ||
+		posix_memalign((void **)(&b.buf), 4096, b.copy_size) ||
+		posix_memalign((void **)(&b.hot), 4096, b.hot_size))
+	{
+		fprintf(stderr, "Out of memory\n");
+		return 2;
+	}
+	memset(b.buf, 2, b.copy_size);
+	memset(b.hot, 3, b.hot_size);
+
+	printf("[");
+	bench("memcpy", 1, copy_memcpy);
+#ifdef RDC_HAVE_SIMD
+	bench("simd_nt", 1, rdc_copy_nt);
+#endif
+	bench("memcpy", 0, copy_memcpy);
+#ifdef RDC_HAVE_SIMD
+	bench("simd_nta", 0, rdc_copy_nta);
+#endif
+	printf("\n]\n");
+
+	free(b.area);
+	free(b.buf);
+	free(b.hot);
+	return 0;
+}